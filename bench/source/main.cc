@@ -0,0 +1,176 @@
+// main.cc
+
+#include <charlie_network.hpp>
+#include "charlie_protocol.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+using namespace charlie;
+using namespace charlie::network;
+
+namespace {
+	enum class Storm {
+		None,
+		Requests,
+		Responses,
+		Source,
+	};
+
+	const char* storm_name(const Storm storm)
+	{
+		switch (storm) {
+		case Storm::None:
+			return "none";
+		case Storm::Requests:
+			return "requests";
+		case Storm::Responses:
+			return "responses";
+		case Storm::Source:
+			return "source";
+		}
+		return "";
+	}
+
+	struct Result {
+		int32 handshakes_;
+		Time elapsed_;
+		uint64 storm_packets_;
+		uint64 backlog_;
+		uint64 dropped_;
+		int32 pool_in_use_;
+		int32 pending_;
+	};
+
+	// note: the storm bypasses any socket and writes straight into the hub,
+	//       every packet comes from a new spoofed address so the challenges
+	//       and rejections sent back are unroutable and simply dropped, the
+	//       source storm sends requests from one address over and over
+	PacketHandle make_storm_packet(const Storm storm, Random& random)
+	{
+		PacketHandle packet = PacketHandle::acquire();
+		NetworkStreamWriter writer(packet);
+		if (storm == Storm::Requests || storm == Storm::Source) {
+			ProtocolRequestPacket request(random());
+			request.write(writer);
+		}
+		else {
+			ProtocolResponsePacket response(random(), random());
+			response.write(writer);
+		}
+		return packet;
+	}
+
+	Result run(const Storm storm, const int32 client_count, const int32 storm_per_update)
+	{
+		const IPAddress server_address(10, 0, 0, 1, 1000);
+
+		LoopbackHub hub;
+		LoopbackTransport server_transport;
+		server_transport.open(hub, server_address);
+
+		Service server;
+		server.set_allow_connections(true);
+		server.set_connection_limit(client_count);
+		server.initialize(&server_transport, server_address);
+
+		DynamicArray<std::unique_ptr<LoopbackTransport>> transports;
+		DynamicArray<std::unique_ptr<Service>> services;
+		DynamicArray<std::unique_ptr<Connection>> connections;
+		for (int32 index = 0; index < client_count; index++) {
+			const IPAddress address(10, 1, static_cast<uint8>(index >> 8), static_cast<uint8>(index), 2000);
+			transports.emplace_back(new LoopbackTransport);
+			transports.back()->open(hub, address);
+			services.emplace_back(new Service);
+			services.back()->set_handshake_resend_time(Time(TIMER_RESOLUTION));
+			services.back()->initialize(transports.back().get(), address);
+			connections.emplace_back(new Connection);
+		}
+
+		Random random(storm_per_update);
+		uint64 storm_packets = 0;
+		int32 handshakes = 0;
+
+		const Time start = Time::now();
+		for (int32 index = 0; index < client_count; index++) {
+			connections[index]->connect(*services[index], server_address);
+		}
+
+		while (handshakes < client_count && (Time::now() - start) < Time(10.0)) {
+			if (storm != Storm::None) {
+				const Time now = Time::now();
+				for (int32 index = 0; index < storm_per_update; index++) {
+					const IPAddress spoofed = storm == Storm::Source ? IPAddress(172, 16, 0, 1, 4000) :
+						IPAddress(172, 16, static_cast<uint8>(random()), static_cast<uint8>(random()), static_cast<uint16>(random()));
+					hub.route(spoofed, server_address, make_storm_packet(storm, random), now);
+				}
+				storm_packets += storm_per_update;
+			}
+
+			server.update();
+
+			handshakes = 0;
+			for (int32 index = 0; index < client_count; index++) {
+				services[index]->update();
+				if (connections[index]->is_connected()) {
+					handshakes++;
+				}
+			}
+		}
+
+		Result result;
+		result.handshakes_ = handshakes;
+		result.elapsed_ = Time::now() - start;
+		result.storm_packets_ = storm_packets;
+		result.backlog_ = server_transport.inbox_.size();
+		result.dropped_ = server.admission_.dropped_;
+		result.pool_in_use_ = server.connection_pool_.connection_count_;
+		result.pending_ = static_cast<int32>(server.pending_connections_.size());
+
+		for (auto& connection : connections) {
+			connection->disconnect();
+		}
+		for (auto& service : services) {
+			service->shutdown();
+		}
+		server.shutdown();
+
+		return result;
+	}
+} // !anon
+
+// note: usage - bench [clients] [storm packets per server update]
+int main(int argc, char** argv)
+{
+	const int32 client_count = argc > 1 ? atoi(argv[1]) : 256;
+	const int32 storm_per_update = argc > 2 ? atoi(argv[2]) : 512;
+
+	// note: the first run pays for page faults and the packet pool
+	run(Storm::None, client_count, storm_per_update);
+
+	Result results[4] = {};
+	const Storm storms[4] = { Storm::None, Storm::Requests, Storm::Responses, Storm::Source };
+	for (int32 index = 0; index < 4; index++) {
+		results[index] = run(storms[index], client_count, storm_per_update);
+	}
+
+	printf("\nhandshake benchmark, %d clients, %d storm packets per update\n", client_count, storm_per_update);
+	printf("%-10s %10s %10s %14s %14s %10s %8s %8s\n", "storm", "connected", "seconds", "handshakes/s", "handled pkt/s", "dropped", "pool", "pending");
+	for (int32 index = 0; index < 4; index++) {
+		const Result& result = results[index];
+		const float seconds = result.elapsed_.as_seconds();
+		const uint64 handled = result.storm_packets_ > result.backlog_ ? result.storm_packets_ - result.backlog_ : 0;
+		printf("%-10s %10d %10.3f %14.1f %14.1f %10llu %8d %8d\n",
+			storm_name(storms[index]),
+			result.handshakes_,
+			seconds,
+			static_cast<float>(result.handshakes_) / seconds,
+			static_cast<float>(handled) / seconds,
+			result.dropped_,
+			result.pool_in_use_,
+			result.pending_);
+	}
+
+	return 0;
+}
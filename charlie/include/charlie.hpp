@@ -171,6 +171,22 @@ namespace charlie {
 		uint8* data_;
 	};
 
+	// note: read only view of a whole file, pages are loaded on first touch
+	//       and shared with the file cache instead of being copied
+	struct MappedFile {
+		MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		~MappedFile();
+
+		bool open(const char* filename);
+		void close();
+
+		uint64 size_;
+		const uint8* data_;
+		void* mapping_;
+	};
+
 	struct Mouse {
 		enum class Button {
 			Left,
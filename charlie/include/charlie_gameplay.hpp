@@ -73,22 +73,76 @@ namespace charlie {
 			int size_ = 32;
 		};
 
-		struct Message
+		// note: estimate of the server clock from the time stamped on each
+		//       server tick message, ntp style every sample is the server time
+		//       plus half a round trip minus the local arrival time, the sample
+		//       with the lowest round trip in a short window waited least in
+		//       queues and a least squares line through those gives the drift
+		struct ClockSync
 		{
-			uint16 seq_;
-			int32 id_;
-			bool received_;
+			static constexpr int32 FILTER_SIZE = 8;
+			static constexpr int32 HISTORY_SIZE = 32;
+			static constexpr double MAX_DRIFT = 0.001;
+			static constexpr float SLEW_GAIN = 0.05f;
+			static constexpr float MAX_SLEW = 0.1f;
+			static constexpr float SNAP_TICKS = 16.0f;
+			static Time tick_interval(const Time& tickrate, float tick_error);
+
+			struct Sample
+			{
+				Time local_;
+				Time offset_;
+				Time round_trip_;
+			};
+
+			ClockSync();
+			void reset();
+			void add_sample(const Time& server_time, const Time& local_time, const Time& round_trip);
+			void fit();
+			Time offset(const Time& local_time) const;
+			Time server_time(const Time& local_time) const;
+
+			Sample filter_[FILTER_SIZE];
+			int32 sample_count_;
+			Sample history_[HISTORY_SIZE];
+			int32 history_count_;
+			Time reference_;
+			double offset_; // Server minus local ticks at reference_
+			double drift_; // Server ticks gained per local tick
+		};
+
+		// note: entity state quantized the way it goes on the wire, so both
+		//       ends of a delta compare exactly the same values
+		struct EntityState
+		{
+			uint8 id_;
+			int16 x_;
+			int16 y_;
+			int16 rotation_;
+			int16 turret_rotation_;
+		};
+
+		struct EntitySnapshot
+		{
+			EntitySnapshot();
+			void add(const EntityState& state);
+			const EntityState* find(uint8 id) const;
+			void encode(const EntitySnapshot* baseline, network::NetworkMessageEntityDelta& message) const;
+			bool decode(const EntitySnapshot* baseline, const network::NetworkMessageEntityDelta& message);
+			uint16 sequence_;
+			bool valid_;
+			DynamicArray<EntityState> entities_;
 		};
 
-		struct ReliableMessageQueue
+		// note: snapshots by packet sequence, the server keeps one per client
+		//       for what it sent and the client one for what it decoded
+		struct SnapshotRing
 		{
-			ReliableMessageQueue();
-			void add_message(Message& msg);
-			Message get_message(int32 tick);
-			void mark_received(int32 id);
-			static constexpr int buffer_size_ = 100;
-			Message buffer_[buffer_size_];
-			uint32 index_;
+			static constexpr int32 SIZE = 64;
+			EntitySnapshot& insert(uint16 sequence);
+			const EntitySnapshot* find(uint16 sequence) const;
+			void clear();
+			EntitySnapshot snapshots_[SIZE];
 		};
 
 	} // !gameplay
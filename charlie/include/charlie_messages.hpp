@@ -12,6 +12,8 @@ namespace charlie {
 	namespace network {
 		struct NetworkStreamReader;
 		struct NetworkStreamWriter;
+		struct BitStreamReader;
+		struct BitStreamWriter;
 
 		enum NetworkMessageType {
 			NETWORK_MESSAGE_SERVER_TICK,
@@ -29,12 +31,28 @@ namespace charlie {
 			NETWORK_MESSAGE_LEVEL_INFO,
 			NETWORK_MESSAGE_LEVEL_REQUEST,
 			NETWORK_MESSAGE_LEVEL_DATA,
-			NETWORK_MESSAGE_ACK,
+			NETWORK_MESSAGE_ENTITY_DELTA,
 			NETWORK_MESSAGE_COUNT,
 		};
 
 		static_assert(NETWORK_MESSAGE_COUNT <= 255, "network message type cannot exceed 255!");
 
+		// note: quantization ranges, levels are at most 255 tiles of 50 pixels
+		//       and turret rotation is -90 + atan2 in degrees
+		static constexpr int32 MESSAGE_POSITION_MIN = -1024;
+		static constexpr int32 MESSAGE_POSITION_MAX = 255 * 50 + 1024;
+		static constexpr int32 MESSAGE_TURRET_ROTATION_MIN = -270;
+		static constexpr int32 MESSAGE_TURRET_ROTATION_MAX = 90;
+		static constexpr float MESSAGE_POSITION_MIN_F = static_cast<float>(MESSAGE_POSITION_MIN);
+		static constexpr float MESSAGE_POSITION_MAX_F = static_cast<float>(MESSAGE_POSITION_MAX);
+		static constexpr float MESSAGE_POSITION_PRECISION = 0.1f;
+		static constexpr float MESSAGE_TURRET_ROTATION_MIN_F = static_cast<float>(MESSAGE_TURRET_ROTATION_MIN);
+		static constexpr float MESSAGE_TURRET_ROTATION_MAX_F = static_cast<float>(MESSAGE_TURRET_ROTATION_MAX);
+		static constexpr float MESSAGE_TURRET_ROTATION_PRECISION = 0.1f;
+		static constexpr int32 MESSAGE_INPUT_BITS_MAX = 15;
+		static constexpr int32 MESSAGE_DELTA_SMALL_MIN = -32;
+		static constexpr int32 MESSAGE_DELTA_SMALL_MAX = 31;
+
 		struct NetworkMessageServerTick {
 			NetworkMessageServerTick();
 			explicit NetworkMessageServerTick(int64  server_time,
@@ -42,6 +60,8 @@ namespace charlie {
 
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
@@ -64,17 +84,19 @@ namespace charlie {
 
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
 			{
 				bool result = true;
 				result &= stream.serialize(type_);
-				result &= stream.serialize(x_);
-				result &= stream.serialize(y_);
+				result &= stream.serialize_int(x_, MESSAGE_POSITION_MIN, MESSAGE_POSITION_MAX);
+				result &= stream.serialize_int(y_, MESSAGE_POSITION_MIN, MESSAGE_POSITION_MAX);
 				result &= stream.serialize(rotation_);
 				result &= stream.serialize(entity_id_);
-				result &= stream.serialize(turret_rotation_);
+				result &= stream.serialize_int(turret_rotation_, MESSAGE_TURRET_ROTATION_MIN, MESSAGE_TURRET_ROTATION_MAX);
 				return result;
 			}
 
@@ -86,22 +108,30 @@ namespace charlie {
 			int16 turret_rotation_;
 		};
 
+		// note: snapshot_ is the last entity snapshot the client decoded, the
+		//       server only deltas against snapshots the client reported
 		struct NetworkMessageInputCommand {
 			NetworkMessageInputCommand();
-			explicit NetworkMessageInputCommand(uint8 bits, float rotation, bool fire, int32 tick);
+			explicit NetworkMessageInputCommand(uint8 bits, float rotation, bool fire, int32 tick, bool has_snapshot, uint16 snapshot);
 
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
 			{
 				bool result = true;
 				result &= stream.serialize(type_);
-				result &= stream.serialize(bits_);
-				result &= stream.serialize(rot_);
+				result &= stream.serialize_int(bits_, 0, MESSAGE_INPUT_BITS_MAX);
+				result &= stream.serialize_int(rot_, MESSAGE_TURRET_ROTATION_MIN, MESSAGE_TURRET_ROTATION_MAX);
 				result &= stream.serialize(fire_);
 				result &= stream.serialize(tick_);
+				result &= stream.serialize(has_snapshot_);
+				if (has_snapshot_) {
+					result &= stream.serialize(snapshot_);
+				}
 				return result;
 			}
 
@@ -110,70 +140,146 @@ namespace charlie {
 			int16 rot_;
 			bool fire_;
 			uint32 tick_;
+			bool has_snapshot_;
+			uint16 snapshot_;
 		};
 
-		struct NetworkMessagePlayerState {
-			NetworkMessagePlayerState();
-			explicit NetworkMessagePlayerState(const Transform& transform, float turret_rotation);
+		// note: entity state relative to a snapshot the client acknowledged,
+		//       entities that did not change since the baseline are left out
+		//       and changed fields are sent as a small delta when they can be
+		struct NetworkMessageEntityDelta {
+			static constexpr int32 MAX_ENTRY_COUNT = 255;
+
+			enum Field {
+				FIELD_X = 1 << 0,
+				FIELD_Y = 1 << 1,
+				FIELD_ROTATION = 1 << 2,
+				FIELD_TURRET_ROTATION = 1 << 3,
+				FIELD_REMOVED = 1 << 4,
+				FIELD_ALL = FIELD_X | FIELD_Y | FIELD_ROTATION | FIELD_TURRET_ROTATION,
+			};
+
+			struct Entry {
+				uint8 id_;
+				uint8 changed_;
+				uint8 small_;
+				int16 x_;
+				int16 y_;
+				int16 rotation_;
+				int16 turret_rotation_;
+			};
+
+			NetworkMessageEntityDelta();
 
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
+
+			template <typename Stream>
+			static bool serialize_field(Stream& stream, Entry& entry, const uint8 field, int16& value, const int32 min, const int32 max)
+			{
+				if (!(entry.changed_ & field)) {
+					return true;
+				}
+
+				bool small = (entry.small_ & field) != 0;
+				if (!stream.serialize(small)) {
+					return false;
+				}
+
+				entry.small_ = static_cast<uint8>(small ? (entry.small_ | field) : (entry.small_ & ~field));
+				if (small) {
+					return stream.serialize_int(value, MESSAGE_DELTA_SMALL_MIN, MESSAGE_DELTA_SMALL_MAX);
+				}
+
+				return stream.serialize_int(value, min, max);
+			}
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
 			{
 				bool result = true;
 				result &= stream.serialize(type_);
-				result &= stream.serialize(y_);
-				result &= stream.serialize(x_);
-				result &= stream.serialize(rotation_);
-				result &= stream.serialize(turret_rotation_);
+				result &= stream.serialize(has_baseline_);
+				if (has_baseline_) {
+					result &= stream.serialize(baseline_);
+				}
+
+				result &= stream.serialize_int(count_, 0, MAX_ENTRY_COUNT);
+				if (!result) {
+					return false;
+				}
+
+				entries_.resize(count_);
+				for (Entry& entry : entries_) {
+					result &= stream.serialize(entry.id_);
+					result &= stream.serialize_int(entry.changed_, 0, FIELD_ALL | FIELD_REMOVED);
+					result &= serialize_field(stream, entry, FIELD_X, entry.x_, MESSAGE_POSITION_MIN, MESSAGE_POSITION_MAX);
+					result &= serialize_field(stream, entry, FIELD_Y, entry.y_, MESSAGE_POSITION_MIN, MESSAGE_POSITION_MAX);
+					result &= serialize_field(stream, entry, FIELD_ROTATION, entry.rotation_, -32768, 32767);
+					result &= serialize_field(stream, entry, FIELD_TURRET_ROTATION, entry.turret_rotation_, MESSAGE_TURRET_ROTATION_MIN, MESSAGE_TURRET_ROTATION_MAX);
+					if (!result) {
+						return false;
+					}
+				}
+
 				return result;
 			}
 
 			uint8 type_;
-			int16 rotation_;
-			int16 y_;
-			int16 x_;
-			int16 turret_rotation_;
+			bool has_baseline_;
+			uint16 baseline_;
+			uint8 count_;
+			DynamicArray<Entry> entries_;
 		};
 
-		// Reliable messages
+		struct NetworkMessagePlayerState {
+			NetworkMessagePlayerState();
+			explicit NetworkMessagePlayerState(const Transform& transform, float turret_rotation);
 
-		struct NetworkMessageAck
-		{
-			NetworkMessageAck();
-			explicit NetworkMessageAck(const int32 id);
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
 			{
 				bool result = true;
 				result &= stream.serialize(type_);
-				result &= stream.serialize(event_id_);
+				result &= stream.serialize_int(y_, MESSAGE_POSITION_MIN, MESSAGE_POSITION_MAX);
+				result &= stream.serialize_int(x_, MESSAGE_POSITION_MIN, MESSAGE_POSITION_MAX);
+				result &= stream.serialize(rotation_);
+				result &= stream.serialize_int(turret_rotation_, MESSAGE_TURRET_ROTATION_MIN, MESSAGE_TURRET_ROTATION_MAX);
 				return result;
 			}
 
 			uint8 type_;
-			int32 event_id_;
+			int16 rotation_;
+			int16 y_;
+			int16 x_;
+			int16 turret_rotation_;
 		};
 
+		// Reliable messages
+
 		struct NetworkMessagePlayerSpawn
 		{
 			NetworkMessagePlayerSpawn();
 			explicit NetworkMessagePlayerSpawn(int32 event_id, int32 entity_id, const Vector2& position);
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
 			{
 				bool result = true;
 				result &= stream.serialize(type_);
-				result &= stream.serialize(position_.x_);
-				result &= stream.serialize(position_.y_);
+				result &= stream.serialize_float(position_.x_, MESSAGE_POSITION_MIN_F, MESSAGE_POSITION_MAX_F, MESSAGE_POSITION_PRECISION);
+				result &= stream.serialize_float(position_.y_, MESSAGE_POSITION_MIN_F, MESSAGE_POSITION_MAX_F, MESSAGE_POSITION_PRECISION);
 				result &= stream.serialize(entity_id_);
 				result &= stream.serialize(event_id_);
 				return result;
@@ -191,14 +297,16 @@ namespace charlie {
 			explicit NetworkMessageEntitySpawn(int32 event_id, int32 entity_id, const Vector2& position);
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
 			{
 				bool result = true;
 				result &= stream.serialize(type_);
-				result &= stream.serialize(position_.x_);
-				result &= stream.serialize(position_.y_);
+				result &= stream.serialize_float(position_.x_, MESSAGE_POSITION_MIN_F, MESSAGE_POSITION_MAX_F, MESSAGE_POSITION_PRECISION);
+				result &= stream.serialize_float(position_.y_, MESSAGE_POSITION_MIN_F, MESSAGE_POSITION_MAX_F, MESSAGE_POSITION_PRECISION);
 				result &= stream.serialize(entity_id_);
 				result &= stream.serialize(event_id_);
 				return result;
@@ -216,6 +324,8 @@ namespace charlie {
 			explicit NetworkMessageProjectileSpawn(int32 event_id, int32 entity_id, int32 shot_by, const Vector2& position, float rotation);
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
@@ -225,9 +335,9 @@ namespace charlie {
 				result &= stream.serialize(entity_id_);
 				result &= stream.serialize(shot_by_);
 				result &= stream.serialize(event_id_);
-				result &= stream.serialize(pos_.x_);
-				result &= stream.serialize(pos_.y_);
-				result &= stream.serialize(rotation_);
+				result &= stream.serialize_float(pos_.x_, MESSAGE_POSITION_MIN_F, MESSAGE_POSITION_MAX_F, MESSAGE_POSITION_PRECISION);
+				result &= stream.serialize_float(pos_.y_, MESSAGE_POSITION_MIN_F, MESSAGE_POSITION_MAX_F, MESSAGE_POSITION_PRECISION);
+				result &= stream.serialize_float(rotation_, MESSAGE_TURRET_ROTATION_MIN_F, MESSAGE_TURRET_ROTATION_MAX_F, MESSAGE_TURRET_ROTATION_PRECISION);
 				return result;
 			}
 
@@ -245,6 +355,8 @@ namespace charlie {
 			explicit NetworkMessagePlayerDisconnected(int32 entity_id, int32 message_id);
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
@@ -267,6 +379,8 @@ namespace charlie {
 			explicit NetworkMessageProjectileDestroy(int32 entity_id, int32 event_id);
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
@@ -289,6 +403,8 @@ namespace charlie {
 			explicit NetworkMessageEntityDestroy(int32 entity_id, int32 event_id);
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
@@ -311,6 +427,8 @@ namespace charlie {
 			explicit NetworkMessagePlayerDestroy(int32 entity_id, int32 event_id);
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
@@ -330,9 +448,11 @@ namespace charlie {
 		struct NetworkMessageLevelInfo
 		{
 			NetworkMessageLevelInfo();
-			explicit NetworkMessageLevelInfo(uint8 level_id, uint8 size_x_, uint8 size_y_, int32 event_id);
+			explicit NetworkMessageLevelInfo(uint8 level_id, uint8 size_x_, uint8 size_y_, uint64 hash, int32 event_id);
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
@@ -342,6 +462,7 @@ namespace charlie {
 				result &= stream.serialize(level_id_);
 				result &= stream.serialize(size_x_);
 				result &= stream.serialize(size_y_);
+				result &= stream.serialize(hash_);
 				result &= stream.serialize(event_id_);
 				return result;
 			}
@@ -350,6 +471,7 @@ namespace charlie {
 			uint8 level_id_;
 			uint8 size_x_;
 			uint8 size_y_;
+			uint64 hash_;
 			int32 event_id_;
 		};
 
@@ -359,6 +481,8 @@ namespace charlie {
 			explicit NetworkMessageLevelDataRequest(int32 event_id_);
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
@@ -373,30 +497,37 @@ namespace charlie {
 			int32 event_id_;
 		};
 
+		// note: header of the level stream, a fragmented message carrying
+		//       length bytes of the run length coded compiled map right after
+		//       it, size is the length of the map once decoded
 		struct NetworkMessageLevelData
 		{
 			NetworkMessageLevelData();
-			explicit NetworkMessageLevelData(Tile level_tile, int32 event_id);
+			explicit NetworkMessageLevelData(uint8 level_id, uint8 size_x, uint8 size_y, uint32 length, uint32 size);
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
 			{
 				bool result = true;
 				result &= stream.serialize(type_);
-				result &= stream.serialize(level_tile_);
-				result &= stream.serialize(x_);
-				result &= stream.serialize(y_);
-				result &= stream.serialize(event_id_);
+				result &= stream.serialize(level_id_);
+				result &= stream.serialize(size_x_);
+				result &= stream.serialize(size_y_);
+				result &= stream.serialize(length_);
+				result &= stream.serialize(size_);
 				return result;
 			}
 
 			uint8 type_;
-			uint8 level_tile_;
-			uint8 x_;
-			uint8 y_;
-			int32 event_id_;
+			uint8 level_id_;
+			uint8 size_x_;
+			uint8 size_y_;
+			uint32 length_;
+			uint32 size_;
 		};
 
 		struct NetworkMessageMasterServer
@@ -405,6 +536,8 @@ namespace charlie {
 			explicit NetworkMessageMasterServer(uint8 a_, uint8 b_, uint8 c_, uint8 d_);
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
+			bool read(BitStreamReader& reader);
+			bool write(BitStreamWriter& writer);
 
 			template <typename Stream>
 			bool serialize(Stream& stream)
@@ -0,0 +1,135 @@
+// charlie_metrics.hpp
+
+#ifndef CHARLIE_METRICS_HPP_INCLUDED
+#define CHARLIE_METRICS_HPP_INCLUDED
+
+#include <charlie.hpp>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+namespace charlie {
+	namespace metrics {
+		// note: metrics are meant to live at namespace scope next to the code
+		//       they measure, they register themselves on construction and
+		//       every update is a single relaxed atomic, reading them is only
+		//       done by the snapshot writer
+		struct Counter {
+			Counter(const char* name, const char* help);
+			Counter(const Counter&) = delete;
+			Counter& operator=(const Counter&) = delete;
+			~Counter();
+
+			void add(const uint64 value = 1)
+			{
+				value_.fetch_add(value, std::memory_order_relaxed);
+			}
+
+			uint64 value() const;
+
+			const char* name_;
+			const char* help_;
+			std::atomic<uint64> value_;
+		};
+
+		struct Gauge {
+			Gauge(const char* name, const char* help);
+			Gauge(const Gauge&) = delete;
+			Gauge& operator=(const Gauge&) = delete;
+			~Gauge();
+
+			void set(const int64 value)
+			{
+				value_.store(value, std::memory_order_relaxed);
+			}
+
+			void add(const int64 value)
+			{
+				value_.fetch_add(value, std::memory_order_relaxed);
+			}
+
+			int64 value() const;
+
+			const char* name_;
+			const char* help_;
+			std::atomic<int64> value_;
+		};
+
+		// note: observations are integers, time in ticks, and the scale turns
+		//       them into the exported unit, the default buckets cover 50us
+		//       to 50ms and export seconds
+		struct Histogram {
+			static constexpr int32 MAX_BUCKET_COUNT = 12;
+			static const int64 TIME_BUCKETS[];
+			static const int32 TIME_BUCKET_COUNT;
+
+			Histogram(const char* name, const char* help);
+			Histogram(const char* name, const char* help, const int64* limits, const int32 count, const double scale);
+			Histogram(const Histogram&) = delete;
+			Histogram& operator=(const Histogram&) = delete;
+			~Histogram();
+
+			void observe(const int64 value)
+			{
+				int32 bucket = 0;
+				while (bucket < bucket_count_ && value > limits_[bucket]) {
+					bucket++;
+				}
+
+				buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+				sum_.fetch_add(value, std::memory_order_relaxed);
+			}
+
+			void observe(const Time& time)
+			{
+				observe(time.as_ticks());
+			}
+
+			const char* name_;
+			const char* help_;
+			double scale_;
+			int32 bucket_count_;
+			int64 limits_[MAX_BUCKET_COUNT];
+			std::atomic<uint64> buckets_[MAX_BUCKET_COUNT + 1]; // Last one is +Inf
+			std::atomic<int64> sum_;
+		};
+
+		struct Registry {
+			static Registry& instance();
+
+			void add(Counter* counter);
+			void add(Gauge* gauge);
+			void add(Histogram* histogram);
+			void remove(const Counter* counter);
+			void remove(const Gauge* gauge);
+			void remove(const Histogram* histogram);
+
+			// note: prometheus text exposition format, version 0.0.4
+			void write(std::string& output) const;
+
+			mutable std::mutex mutex_;
+			DynamicArray<Counter*> counters_;
+			DynamicArray<Gauge*> gauges_;
+			DynamicArray<Histogram*> histograms_;
+		};
+
+		// note: rewrites a snapshot of the registry every interval, the file
+		//       is written aside and renamed over the old one so a scraper
+		//       never reads it half written
+		struct SnapshotFile {
+			SnapshotFile();
+
+			void open(const char* filename, const Time& interval);
+			void close();
+			bool update(const Time& time);
+			bool write();
+
+			std::string filename_;
+			std::string buffer_;
+			Time interval_;
+			Time last_write_;
+		};
+	} // !metrics
+} // !charlie
+
+#endif // !CHARLIE_METRICS_HPP_INCLUDED
@@ -4,6 +4,10 @@
 #define CHARLIE_NETWORK_HPP_INCLUDED
 
 #include <charlie.hpp>
+#include <charlie_queue.hpp>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 namespace charlie {
 	namespace network {
@@ -35,20 +39,109 @@ namespace charlie {
 			uint16 port_;
 		};
 
-		struct UDPSocket {
+		struct Datagram;
+		struct IORing;
+
+		struct SendCounters {
+			SendCounters();
+
+			uint64 syscalls_saved() const;
+
+			uint64 datagrams_;
+			uint64 syscalls_;
+			uint64 segmented_;
+		};
+
+		// note: what Service sends and receives datagrams through, a real
+		//       socket or an in-process loopback
+		struct ITransport {
+			virtual ~ITransport() = default;
+			virtual bool is_valid() const = 0;
+			virtual void close() = 0;
+			virtual int32 receive_batch(Datagram* datagrams, const int32 count) = 0;
+			virtual int32 send_batch(const Datagram* datagrams, const int32 count, SendCounters& counters) = 0;
+			// note: blocks until a datagram may be waiting or the timeout passes
+			virtual void wait(const Time& timeout) = 0;
+		};
+
+		struct UDPSocket final : ITransport {
+			enum class Backend {
+				Socket,
+				IOUring,
+			};
+
+			static constexpr int32 MAX_BATCH_SIZE = 64;
+			static constexpr int32 MAX_SEGMENT_COUNT = 64;
 			static bool get_address(const UDPSocket& socket, IPAddress& address);
 
 			UDPSocket();
 
-			bool is_valid() const;
+			bool is_valid() const override;
 			bool open();
 			bool open(const IPAddress& address);
-			void close();
+			bool open(const IPAddress& address, const Backend backend);
+			void close() override;
+			Backend backend() const;
 
 			bool send(const IPAddress& address, const uint8* data, const int32 length) const;
 			bool receive(IPAddress& address, uint8* data, int32& length) const;
+			int32 receive_batch(Datagram* datagrams, const int32 count) override;
+			int32 send_batch(const Datagram* datagrams, const int32 count, SendCounters& counters) override;
+			void wait(const Time& timeout) override;
 
 			uint64 id_;
+			bool segmentation_;
+			IORing* ring_;
+		};
+
+		struct PacketBuffer {
+			static constexpr int32 CAPACITY = 1024;
+
+			std::atomic<int32> references_;
+			int32 length_;
+			PacketBuffer* next_;
+			uint8 data_[CAPACITY];
+		};
+
+		// note: process wide freelist of packet buffers, both the game and
+		//       the network thread acquire and release through it
+		struct PacketPool {
+			static constexpr int32 BLOCK_SIZE = 64;
+			static PacketPool& get();
+
+			PacketPool();
+			~PacketPool();
+
+			PacketBuffer* acquire();
+			void release(PacketBuffer* buffer);
+
+			std::mutex mutex_;
+			PacketBuffer* free_;
+			DynamicArray<PacketBuffer*> blocks_;
+			int32 allocated_;
+			int32 available_;
+		};
+
+		struct PacketHandle {
+			static PacketHandle acquire();
+
+			PacketHandle();
+			PacketHandle(const PacketHandle& rhs);
+			PacketHandle(PacketHandle&& rhs);
+			~PacketHandle();
+
+			PacketHandle& operator=(const PacketHandle& rhs);
+			PacketHandle& operator=(PacketHandle&& rhs);
+
+			bool is_valid() const;
+			bool is_unique() const;
+			uint8* data() const;
+			int32 length() const;
+			int32 capacity() const;
+			void set_length(const int32 length);
+			void reset();
+
+			PacketBuffer* buffer_;
 		};
 
 		struct NetworkStream {
@@ -60,8 +153,138 @@ namespace charlie {
 			uint8 buffer_[1024];
 		};
 
+		struct Datagram {
+			IPAddress address_;
+			PacketHandle packet_;
+		};
+
+		struct ReceivedDatagram {
+			Time time_;
+			IPAddress address_;
+			PacketHandle packet_;
+		};
+
+		struct LoopbackTransport;
+
+		// note: routes datagrams between loopback transports of one process
+		//       by their virtual address, optionally after a fixed delay
+		struct LoopbackHub {
+			LoopbackHub();
+
+			void set_delay(const Time& delay);
+			bool attach(LoopbackTransport* transport);
+			void detach(LoopbackTransport* transport);
+			bool route(const IPAddress& from, const IPAddress& to, const PacketHandle& packet, const Time& time);
+			int32 collect(LoopbackTransport* transport, Datagram* datagrams, const int32 count, const Time& time);
+
+			std::mutex mutex_;
+			Time delay_;
+			Map<uint64, LoopbackTransport*> transports_;
+			uint64 routed_;
+			uint64 unroutable_;
+		};
+
+		struct LoopbackTransport final : ITransport {
+			struct Entry {
+				Time time_;
+				IPAddress address_;
+				PacketHandle packet_;
+			};
+
+			LoopbackTransport();
+			~LoopbackTransport();
+
+			bool open(LoopbackHub& hub, const IPAddress& address);
+			bool is_valid() const override;
+			void close() override;
+			int32 receive_batch(Datagram* datagrams, const int32 count) override;
+			int32 send_batch(const Datagram* datagrams, const int32 count, SendCounters& counters) override;
+			void wait(const Time& timeout) override;
+
+			LoopbackHub* hub_;
+			IPAddress address_;
+			Queue<Entry> inbox_;
+		};
+
+		// note: link conditions applied to one direction, burst loss is a
+		//       two state chain entered and left with the burst chances
+		struct ConditionerProfile {
+			enum class Preset {
+				None,
+				Broadband,
+				Wifi,
+				Mobile,
+				Congested,
+			};
+
+			static ConditionerProfile from_preset(const Preset preset);
+			static bool from_name(const char* name, ConditionerProfile& profile);
+
+			ConditionerProfile();
+
+			bool is_enabled() const;
+
+			Time latency_;
+			Time jitter_;
+			float loss_;
+			float burst_enter_;
+			float burst_exit_;
+			float duplicate_;
+			float reorder_;
+			Time reorder_delay_;
+			int32 bandwidth_;
+		};
+
+		struct ConditionerCounters {
+			ConditionerCounters();
+
+			uint64 submitted_;
+			uint64 delivered_;
+			uint64 dropped_;
+			uint64 burst_dropped_;
+			uint64 throttled_;
+			uint64 duplicated_;
+			uint64 reordered_;
+			uint64 bytes_;
+		};
+
+		// note: holds datagrams until their conditioned delivery time, the
+		//       same seed and traffic always give the same outcome
+		struct NetworkConditioner {
+			static constexpr double MAX_QUEUE_DELAY = 1.0;
+
+			struct Entry {
+				Time time_;
+				uint64 order_;
+				IPAddress address_;
+				PacketHandle packet_;
+			};
+
+			NetworkConditioner();
+
+			bool is_enabled() const;
+			void set_profile(const ConditionerProfile& profile, const uint64 seed);
+			void clear();
+			void submit(const Time& time, const IPAddress& address, const PacketHandle& packet);
+			bool poll(const Time& time, IPAddress& address, PacketHandle& packet);
+
+			float random_unit();
+			void schedule(const Time& time, const IPAddress& address, const PacketHandle& packet);
+
+			ConditionerProfile profile_;
+			ConditionerCounters counters_;
+			Random random_;
+			bool burst_;
+			uint64 order_;
+			Time last_time_;
+			Time link_free_time_;
+			DynamicArray<Entry> entries_;
+		};
+
 		struct NetworkStreamWriter {
 			NetworkStreamWriter(NetworkStream& stream);
+			NetworkStreamWriter(PacketHandle& packet);
+			NetworkStreamWriter(uint8* data, const int32 capacity);
 
 			int32 length() const;
 			uint8* data() const;
@@ -80,17 +303,37 @@ namespace charlie {
 			bool serialize(const uint64 length, const char* values);
 			bool serialize(const bool& value);
 
-			NetworkStream& stream_;
+			bool serialize_range(const uint32 value, const uint32 range);
+			bool serialize_float(const float& value, const float min, const float max, const float precision);
+
+			template <typename T>
+			bool serialize_int(const T& value, const int32 min, const int32 max)
+			{
+				assert(min < max);
+				const int64 wide = static_cast<int64>(value);
+				if (wide < min || wide > max) {
+					return false;
+				}
+
+				return serialize_range(static_cast<uint32>(wide - min), static_cast<uint32>(int64(max) - min));
+			}
+
+			uint8* base_;
+			uint8* end_;
+			int32* length_;
 			uint8* at_;
 		};
 
 		struct NetworkStreamReader {
 			NetworkStreamReader(const NetworkStream& stream);
+			NetworkStreamReader(const PacketHandle& packet);
+			NetworkStreamReader(const uint8* data, const int32 length);
 
 			uint8 peek() const;
 			int32 length() const;
 			int32 position() const;
 			const uint8* data() const;
+			const PacketHandle& packet() const;
 
 			bool serialize(float& value);
 			bool serialize(double& value);
@@ -106,16 +349,308 @@ namespace charlie {
 			bool serialize(const uint64 length, char* values);
 			bool serialize(bool& value);
 
-			const NetworkStream& stream_;
+			bool serialize_range(uint32& value, const uint32 range);
+			bool serialize_float(float& value, const float min, const float max, const float precision);
+
+			template <typename T>
+			bool serialize_int(T& value, const int32 min, const int32 max)
+			{
+				assert(min < max);
+				uint32 offset = 0;
+				if (!serialize_range(offset, static_cast<uint32>(int64(max) - min))) {
+					return false;
+				}
+
+				const int64 wide = min + static_cast<int64>(offset);
+				if (wide > max) {
+					return false;
+				}
+
+				value = static_cast<T>(wide);
+				return true;
+			}
+
+			const uint8* base_;
+			int32 length_;
 			const uint8* at_;
+			PacketHandle packet_;
+		};
+
+		// note: number of bits needed to hold every value in [0, range]
+		inline int32 bits_required(const uint32 range)
+		{
+			int32 bits = 0;
+			while (bits < 32 && (range >> bits) != 0) {
+				bits++;
+			}
+			return bits;
+		}
+
+		// note: packs values msb first into the free space of a byte stream,
+		//       nothing reaches the underlying writer until flush() pads the
+		//       last byte and advances it
+		struct BitStreamWriter {
+			BitStreamWriter(NetworkStreamWriter& writer);
+
+			int32 bits() const;
+			int32 length() const;
+			bool flush();
+
+			bool serialize(const float& value);
+			bool serialize(const double& value);
+			bool serialize(const uint8& value);
+			bool serialize(const int8& value);
+			bool serialize(const uint16& value);
+			bool serialize(const int16& value);
+			bool serialize(const uint32& value);
+			bool serialize(const int32& value);
+			bool serialize(const uint64& value);
+			bool serialize(const int64& value);
+			bool serialize(const uint64 length, const uint8* values);
+			bool serialize(const uint64 length, const char* values);
+			bool serialize(const bool& value);
+
+			bool serialize_bits(const uint32 value, const int32 count);
+			bool serialize_range(const uint32 value, const uint32 range);
+			bool serialize_float(const float& value, const float min, const float max, const float precision);
+
+			template <typename T>
+			bool serialize_int(const T& value, const int32 min, const int32 max)
+			{
+				assert(min < max);
+				const int64 wide = static_cast<int64>(value);
+				if (wide < min || wide > max) {
+					return false;
+				}
+
+				return serialize_range(static_cast<uint32>(wide - min), static_cast<uint32>(int64(max) - min));
+			}
+
+			NetworkStreamWriter& writer_;
+			uint8* base_;
+			int32 bytes_;
+			uint64 scratch_;
+			int32 scratch_bits_;
+			int32 bits_;
+		};
+
+		// note: reads the bytes left in a byte stream without advancing it
+		struct BitStreamReader {
+			BitStreamReader(const NetworkStreamReader& reader);
+			BitStreamReader(const uint8* data, const int32 length);
+
+			uint8 peek() const;
+			int32 bits_remaining() const;
+
+			bool serialize(float& value);
+			bool serialize(double& value);
+			bool serialize(uint8& value);
+			bool serialize(int8& value);
+			bool serialize(uint16& value);
+			bool serialize(int16& value);
+			bool serialize(uint32& value);
+			bool serialize(int32& value);
+			bool serialize(uint64& value);
+			bool serialize(int64& value);
+			bool serialize(const uint64 length, uint8* values);
+			bool serialize(const uint64 length, char* values);
+			bool serialize(bool& value);
+
+			bool serialize_bits(uint32& value, const int32 count);
+			bool serialize_range(uint32& value, const uint32 range);
+			bool serialize_float(float& value, const float min, const float max, const float precision);
+
+			template <typename T>
+			bool serialize_int(T& value, const int32 min, const int32 max)
+			{
+				assert(min < max);
+				uint32 offset = 0;
+				if (!serialize_range(offset, static_cast<uint32>(int64(max) - min))) {
+					return false;
+				}
+
+				const int64 wide = min + static_cast<int64>(offset);
+				if (wide > max) {
+					return false;
+				}
+
+				value = static_cast<T>(wide);
+				return true;
+			}
+
+			const uint8* base_;
+			int32 length_;
+			int32 at_;
+		};
+
+		// note: every connection carries one message channel of each kind
+		//       next to the data packet payload
+		enum Channel {
+			CHANNEL_UNRELIABLE,
+			CHANNEL_RELIABLE_UNORDERED,
+			CHANNEL_RELIABLE_ORDERED,
+			CHANNEL_COUNT,
 		};
 
 		struct Connection;
+		struct Service;
 		struct IConnectionListener {
 			virtual ~IConnectionListener() = default;
+			// note: every sent data packet ends in exactly one of these two,
+			//       acknowledged in sequence order or lost once it falls out
+			//       of the 32 packet ack window without being acknowledged
 			virtual void on_acknowledge(Connection* connection, const uint16 sequence) = 0;
+			virtual void on_lost(Connection*, const uint16) {}
 			virtual void on_receive(Connection* connection, NetworkStreamReader& reader) = 0;
 			virtual void on_send(Connection* connection, const uint16 sequence, NetworkStreamWriter& writer) = 0;
+			virtual void on_receive_message(Connection*, NetworkStreamReader&) {}
+			virtual void on_channel_message(Connection*, const Channel, NetworkStreamReader&) {}
+		};
+
+		// note: messages live in a window of ids, reliable ones stay in the
+		//       send window until a packet that carried them is acknowledged
+		//       and ordered ones wait in the receive window for the gaps
+		struct MessageChannel {
+			static constexpr int32 WINDOW_SIZE = 256;
+			static constexpr int32 MAX_MESSAGE_SIZE = 256;
+
+			struct Entry {
+				bool valid_;
+				bool sent_;
+				uint16 id_;
+				Time sent_time_;
+				DynamicArray<uint8> data_;
+			};
+
+			MessageChannel();
+
+			bool is_reliable() const;
+			void reset();
+			bool queue(const uint8* data, const int32 length);
+			void acknowledge(const uint16 id);
+
+			Channel channel_;
+			uint16 send_id_;
+			uint16 send_base_;
+			uint16 receive_base_;
+			DynamicArray<Entry> send_entries_;
+			DynamicArray<Entry> receive_entries_;
+			DynamicArray<DynamicArray<uint8>> unreliable_;
+		};
+
+		// note: a congestion level between healthy (0) and congested (1) sets
+		//       the send interval and payload budget inside their bounds,
+		//       loss or a growing round trip backs off multiplicatively and
+		//       a healthy link recovers additively
+		struct CongestionControl {
+			static constexpr float LOSS_THRESHOLD = 0.05f;
+			static constexpr float ROUND_TRIP_GROWTH = 1.5f;
+			static constexpr float ROUND_TRIP_SLACK = 20.0f;
+			static constexpr float RECOVERY_STEP = 0.05f;
+			static constexpr double UPDATE_TIME = 0.25;
+			static constexpr double BASELINE_TIME = 10.0;
+
+			CongestionControl();
+
+			void reset();
+			void set_bounds(const Time& min_interval, const Time& max_interval, const int32 min_budget, const int32 max_budget);
+			void add_loss_sample(const int32 lost, const int32 count);
+			void add_round_trip_sample(const Time& round_trip);
+			void update(const Time& time);
+			bool is_congested() const;
+			Time send_interval() const;
+			int32 payload_budget() const;
+
+			Time min_interval_;
+			Time max_interval_;
+			int32 min_budget_;
+			int32 max_budget_;
+			uint32 sent_count_;
+			float level_;
+			float loss_;
+			float round_trip_;
+			float base_round_trip_;
+			float window_round_trip_;
+			Time last_update_time_;
+			Time base_time_;
+		};
+
+		struct SentPacket {
+			struct Message {
+				uint8 channel_;
+				uint16 id_;
+			};
+
+			bool pending_;
+			uint16 sequence_;
+			DynamicArray<Message> messages_;
+		};
+
+		// note: a message larger than one datagram, split into fragments
+		//       which are resent until the receiver acknowledges them
+		struct OutgoingMessage {
+			uint16 id_;
+			int32 count_;
+			uint64 sent_[2];
+			uint64 acked_[2];
+			DynamicArray<Time> sent_time_;
+			DynamicArray<uint8> data_;
+		};
+
+		struct IncomingMessage {
+			bool active_;
+			uint16 id_;
+			int32 count_;
+			int32 length_;
+			uint64 received_[2];
+			DynamicArray<uint8> data_;
+		};
+
+		// note: rolling transport counters of one connection, the totals run
+		//       from when it was set up while the loss ratio and the round
+		//       trip histogram age so they follow the recent state of the link,
+		//       histogram buckets end at 25, 50, 100, 150, 200, 300, 500 ms
+		//       and the last one holds everything slower
+		struct ConnectionStats {
+			static constexpr int32 ROUND_TRIP_BUCKET_COUNT = 8;
+			static constexpr uint32 ROUND_TRIP_WINDOW = 256;
+			static constexpr float LOSS_WEIGHT = 1.0f / 32.0f;
+			static int32 round_trip_bucket(const Time& round_trip);
+
+			ConnectionStats();
+
+			void reset();
+			void add_round_trip_sample(const Time& round_trip);
+			void add_delivery(const bool lost);
+
+			uint64 packets_sent_;
+			uint64 packets_received_;
+			uint64 bytes_sent_;
+			uint64 bytes_received_;
+			uint64 packets_acked_;
+			uint64 packets_lost_;
+			uint64 messages_resent_;
+			uint64 fragments_resent_;
+			float loss_;
+			uint32 round_trip_samples_;
+			uint32 round_trip_histogram_[ROUND_TRIP_BUCKET_COUNT];
+		};
+
+		// note: copy of what the service knows about one connection
+		struct ConnectionInfo {
+			ConnectionInfo();
+
+			uint16 id_;
+			IPAddress address_;
+			Time connected_time_;
+			Time round_trip_time_;
+			Time smoothed_round_trip_time_;
+			Time round_trip_variance_;
+			Time send_interval_;
+			int32 payload_budget_;
+			int32 reliable_queue_; // Unacknowledged reliable messages
+			int32 pending_messages_; // Fragmented messages not yet delivered
+			ConnectionStats stats_;
 		};
 
 		struct Connection {
@@ -131,6 +666,9 @@ namespace charlie {
 				Disconnecting,
 			};
 
+			static constexpr int32 SENT_PACKET_COUNT = 256;
+			static const int32 MAX_MESSAGE_SIZE; // Largest message send_message takes
+
 			Connection();
 
 			bool is_valid() const;
@@ -141,11 +679,17 @@ namespace charlie {
 			bool is_responding() const;
 			bool is_challenging() const;
 			bool is_disconnecting() const;
-			bool has_timedout(const Time& time) const;
+			bool has_timedout(const Time& time, const Time& timeout) const;
 			Time latency() const;
 			Time round_trip_time() const;
+			bool has_round_trip_sample() const;
+			Time smoothed_round_trip_time() const;
+			Time round_trip_variance() const;
+			Time send_interval() const;
+			int32 payload_budget() const;
 
 			void connect(const IPAddress& address);
+			void connect(Service& service, const IPAddress& address);
 			void disconnect();
 
 			virtual void on_rejected(const uint8 reason);
@@ -155,6 +699,7 @@ namespace charlie {
 
 			void invalidate();
 			void set_state(const State state);
+			void set_id(const uint16 id);
 			void set_address(const IPAddress& address);
 			void set_key(const uint64 key);
 			void set_challenge(const uint64 challenge);
@@ -164,36 +709,170 @@ namespace charlie {
 			void set_listener(IConnectionListener* listener);
 			void receive(NetworkStreamReader& reader);
 			void send();
-
+			void process_acknowledges(const uint16 acknowledge, const uint32 acknowledge_bits);
+			void add_round_trip_sample(const Time& sample);
+			void fill_info(ConnectionInfo& info, const Time& time) const;
+			uint32 data_tag(const uint16 sequence, const uint16 acknowledge, const uint32 acknowledge_bits, const uint32 ticks) const;
+			uint32 disconnect_tag() const;
+			Time resend_time() const;
+
+			bool queue_message(const Channel channel, const uint8* data, const int32 length);
+			void write_channels(NetworkStreamWriter& writer, SentPacket& packet, const Time& time);
+			bool read_channels(NetworkStreamReader& reader);
+			void deliver_message(const Channel channel, const uint8* data, const int32 length);
+
+			bool send_message(const uint8* data, const int32 length);
+			bool has_pending_messages() const;
+			void receive_fragment(NetworkStreamReader& reader);
+			void receive_fragment_ack(NetworkStreamReader& reader);
+			void update_fragments(const Time& time);
+
+			Service* service_;
+			uint32 timer_epoch_;
+			bool in_pending_list_;
+			bool in_established_list_;
 			State state_;
+			uint16 id_;
 			IPAddress address_;
 			uint64 key_;
 			uint64 challenge_;
 			uint16 sequence_;
 			uint16 acknowledge_;
 			uint32 acknowledge_bits_;
+			bool has_received_;
+			SentPacket sent_packets_[SENT_PACKET_COUNT];
+			MessageChannel channels_[CHANNEL_COUNT];
 			uint8 rejection_reason_;
 			int32 disconnect_counter_;
 			Time last_sent_time_;
 			Time last_received_time_;
 			Time connection_established_time_;
 			Time round_trip_time_;
+			bool has_round_trip_sample_;
+			uint16 round_trip_sequence_; // Received packet that measured round_trip_time_
+			Time smoothed_round_trip_time_;
+			Time round_trip_variance_;
 			Time round_trip_buffer_[64];
+			CongestionControl congestion_;
+			ConnectionStats stats_;
 			IConnectionListener* listener_;
+			Queue<OutgoingMessage> outgoing_messages_;
+			uint16 next_message_id_;
+			IncomingMessage incoming_message_;
+			bool has_completed_message_;
+			uint16 completed_message_id_;
+			bool fragment_ack_pending_;
+			uint16 fragment_ack_message_;
+			uint64 fragment_ack_received_[2];
+			int32 fragment_credit_;
+			Time fragment_credit_time_;
 		};
 
 		struct ConnectionPool {
+			// note: a connection id is the pool index in the low bits and a
+			//       slot generation in the high bits, zero is never handed out
+			static constexpr uint16 INDEX_BITS = 10;
+			static constexpr uint16 INDEX_MASK = (1 << INDEX_BITS) - 1;
+			static constexpr uint16 GENERATION_COUNT = 1 << (16 - INDEX_BITS);
+			static int32 index_of(const uint16 id);
+
 			ConnectionPool(const int32 capacity = 32);
 			~ConnectionPool();
 
 			void resize(const int32 capacity);
 
 			Connection* create();
+			Connection* find(const uint16 id) const;
 			void release(Connection* connection);
 
 			int32 capacity_;
 			int32 connection_count_;
 			Connection* connections_;
+			DynamicArray<uint16> generations_;
+		};
+
+		// note: hierarchical wheel of connection timers, every level spans
+		//       64 times the level below and its entries cascade down as
+		//       they come closer, so only expiring timers are ever touched
+		struct TimerWheel {
+			static constexpr int32 LEVEL_COUNT = 4;
+			static constexpr int32 SLOT_BITS = 6;
+			static constexpr int32 SLOT_COUNT = 1 << SLOT_BITS;
+
+			enum class Kind : uint8 {
+				Handshake,
+				Keepalive,
+				Timeout,
+			};
+
+			struct Timer {
+				int64 expires_;
+				Connection* connection_;
+				uint32 epoch_;
+				Kind kind_;
+			};
+
+			TimerWheel();
+
+			void reset(const Time& time, const Time& resolution);
+			void schedule(Connection* connection, const Kind kind, const Time& time);
+			void advance(const Time& time, DynamicArray<Timer>& expired);
+			void insert(Timer timer);
+			void cascade(const int32 level);
+			int32 count() const;
+
+			Time resolution_;
+			int64 current_;
+			int32 count_;
+			DynamicArray<Timer> slots_[LEVEL_COUNT][SLOT_COUNT];
+		};
+
+		// note: stateless handshake, the challenge is a keyed siphash-2-4
+		//       of the source address, the client key and a time bucket,
+		//       so a response can be checked without remembering the request
+		struct HandshakeCookie {
+			static uint64 siphash(const uint64 k0, const uint64 k1, const uint8* data, const int32 length);
+
+			HandshakeCookie();
+
+			void reset(const uint64 k0, const uint64 k1);
+			uint64 generate(const IPAddress& address, const uint64 key, const int64 bucket) const;
+			bool verify(const IPAddress& address, const uint64 key, const uint64 cookie, const int64 bucket) const;
+
+			uint64 k0_;
+			uint64 k1_;
+		};
+
+		// note: token bucket per source address checked before a datagram
+		//       is dispatched, sources live in a fixed open addressed table
+		//       and only a slot idle for idle_time_ is handed to a new source,
+		//       when every probed slot is busy the datagram is charged to the
+		//       stalest one's bucket
+		struct AdmissionFilter {
+			static constexpr int32 SLOT_COUNT = 4096;
+			static constexpr int32 PROBE_COUNT = 8;
+
+			struct Slot {
+				uint64 key_;
+				Time last_;
+				float tokens_;
+			};
+
+			AdmissionFilter();
+
+			void configure(const float rate, const float burst, const Time& idle_time);
+			void reset(const uint64 salt);
+			bool is_enabled() const;
+			bool admit(const IPAddress& address, const Time& time);
+
+			float rate_;
+			float burst_;
+			Time idle_time_;
+			uint64 salt_;
+			uint64 admitted_;
+			uint64 dropped_;
+			uint64 shared_; // Charged to another source's busy slot
+			DynamicArray<Slot> slots_;
 		};
 
 		struct IServiceListener {
@@ -212,16 +891,31 @@ namespace charlie {
 				Send,
 			};
 
+			static constexpr uint32 NETWORK_THREAD_QUEUE_SIZE = 256;
+
 			Service();
 			~Service();
 
-			bool initialize(const IPAddress& address);
+			bool initialize(const IPAddress& address, const UDPSocket::Backend backend = UDPSocket::Backend::Socket);
+			bool initialize(ITransport* transport, const IPAddress& address);
 			void shutdown();
 			void update();
 
 			void set_send_rate(const Time& rate);
+			void set_send_rate(const Time& min_rate, const Time& max_rate);
+			void set_payload_budget(const int32 min_budget, const int32 max_budget);
+			void set_receive_budget(const Time& budget);
+			void set_network_thread(const bool enabled);
 			void set_allow_connections(const bool allow_connections);
 			void set_connection_limit(const int32 connection_limit);
+			void set_handshake_resend_time(const Time& time);
+			void set_keepalive_time(const Time& time);
+			void set_connection_timeout(const Time& time);
+			void set_cookie_secret(const uint64 k0, const uint64 k1);
+			void set_admission_rate(const float rate, const float burst);
+			void set_conditioner(const ConditionerProfile& profile, const uint64 seed);
+			void set_send_conditioner(const ConditionerProfile& profile, const uint64 seed);
+			void set_receive_conditioner(const ConditionerProfile& profile, const uint64 seed);
 
 			void add_service_listener(IServiceListener* listener);
 			void remove_service_listener(IServiceListener* listener);
@@ -234,33 +928,76 @@ namespace charlie {
 			void add_established_connection(Connection* connection);
 			void remove_established_connection(Connection* connection);
 			Connection* find_established_connection(const IPAddress& address) const;
+			Connection* find_established_connection(const uint16 id, const IPAddress& address) const;
+			int32 established_connection_count() const;
+			void collect_connection_info(DynamicArray<ConnectionInfo>& infos) const;
 
+			void handle_datagram(const IPAddress& address, NetworkStreamReader& reader);
 			void handle_connection_request(const IPAddress& address, NetworkStreamReader& reader);
 			void handle_connection_challenge(const IPAddress& address, NetworkStreamReader& reader) const;
 			void handle_connection_response(const IPAddress& address, NetworkStreamReader& reader);
 			void handle_connection_rejected(const IPAddress& address, NetworkStreamReader& reader);
 			void handle_connection_payload(const IPAddress& address, NetworkStreamReader& reader);
+			void handle_connection_fragment(const IPAddress& address, NetworkStreamReader& reader);
+			void handle_connection_fragment_ack(const IPAddress& address, NetworkStreamReader& reader);
 			void handle_connection_disconnect(const IPAddress& address, NetworkStreamReader& reader);
 			void handle_master_server_package(const IPAddress& address, const NetworkStreamReader& reader);
 
 			void send_connection_request(Connection* connection);
 			void send_connection_response(Connection* connection);
-			void send_connection_challenge(Connection* connection);
+			void send_connection_challenge(const IPAddress& address, const uint64 challenge);
 			void send_connection_rejected(Connection* connection, const uint8 reason);
 			void send_connection_disconnect(Connection* connection);
 			void send_stream(Connection* connection, const NetworkStream& stream);
 			void send_stream(const IPAddress& address, const NetworkStream& stream);
-
-			void perform_periodic_timeout_check(const Time& time);
+			void send_packet(Connection* connection, const PacketHandle& packet);
+			void send_packet(const IPAddress& address, const PacketHandle& packet);
+			void queue_datagram(const IPAddress& address, const PacketHandle& packet);
+			void append_datagram(const IPAddress& address, const PacketHandle& packet);
+			void process_datagram(const IPAddress& address, const PacketHandle& packet);
+			void release_conditioned(const Time& time);
+			void flush();
+			void release_send_queue();
+
+			void run_network_thread();
+			int64 cookie_bucket(const Time& time) const;
+			void process_timers(const Time& time);
+			void on_handshake_timer(Connection* connection, const Time& time);
+			void on_keepalive_timer(Connection* connection, const Time& time);
+			void on_timeout_timer(Connection* connection, const Time& time);
+			bool reap_established_connection(Connection* connection);
 
 			UDPSocket socket_;
+			ITransport* transport_;
 			Random random_;
 			bool initialized_;
-			Time send_rate_;
-			Time last_timeout_check_;
+			Time min_send_rate_;
+			Time max_send_rate_;
+			int32 min_payload_budget_;
+			int32 max_payload_budget_;
+			Time receive_budget_;
+			Time handshake_resend_time_;
+			Time keepalive_time_;
+			Time connection_timeout_;
+			TimerWheel timers_;
+			DynamicArray<TimerWheel::Timer> expired_timers_;
+			HandshakeCookie cookie_;
+			AdmissionFilter admission_;
 			bool allow_connections_;
 			int32 connection_limit_;
 			ConnectionPool connection_pool_;
+			DynamicArray<Datagram> receive_batch_;
+			DynamicArray<Datagram> send_queue_;
+			int32 send_queue_count_;
+			SendCounters send_counters_;
+			NetworkConditioner send_conditioner_;
+			NetworkConditioner receive_conditioner_;
+			bool threaded_;
+			std::atomic<bool> running_;
+			std::thread network_thread_;
+			SPSCQueue<ReceivedDatagram> inbound_;
+			SPSCQueue<Datagram> outbound_;
+			Time received_time_;
 			DynamicArray<Connection*> pending_connections_;
 			DynamicArray<Connection*> established_connections_;
 			DynamicArray<IServiceListener*> connection_listeners_;
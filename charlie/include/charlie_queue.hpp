@@ -0,0 +1,107 @@
+// charlie_queue.hpp
+
+#ifndef CHARLIE_QUEUE_HPP_INCLUDED
+#define CHARLIE_QUEUE_HPP_INCLUDED
+
+#include <charlie.hpp>
+#include <atomic>
+
+namespace charlie {
+	// note: single producer, single consumer ring, one thread pushes and
+	//       one other thread pops without any locking, capacity must be
+	//       a power of two
+	template <typename T>
+	struct SPSCQueue {
+		SPSCQueue()
+			: mask_(0)
+			, head_(0)
+			, tail_(0)
+		{
+		}
+
+		void resize(const uint32 capacity)
+		{
+			assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+			entries_.resize(capacity);
+			mask_ = capacity - 1;
+			head_.store(0, std::memory_order_relaxed);
+			tail_.store(0, std::memory_order_relaxed);
+		}
+
+		uint32 capacity() const
+		{
+			return static_cast<uint32>(entries_.size());
+		}
+
+		bool is_empty() const
+		{
+			return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+		}
+
+		// note: producer side, fill the slot from acquire() then commit()
+		T* acquire()
+		{
+			const uint32 tail = tail_.load(std::memory_order_relaxed);
+			if (tail - head_.load(std::memory_order_acquire) > mask_) {
+				return nullptr;
+			}
+
+			return &entries_[tail & mask_];
+		}
+
+		void commit()
+		{
+			tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		bool push(const T& value)
+		{
+			T* entry = acquire();
+			if (!entry) {
+				return false;
+			}
+
+			*entry = value;
+			commit();
+			return true;
+		}
+
+		// note: consumer side, read the slot from front() then release()
+		T* front()
+		{
+			const uint32 head = head_.load(std::memory_order_relaxed);
+			if (head == tail_.load(std::memory_order_acquire)) {
+				return nullptr;
+			}
+
+			return &entries_[head & mask_];
+		}
+
+		void release()
+		{
+			head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		bool pop(T& value)
+		{
+			T* entry = front();
+			if (!entry) {
+				return false;
+			}
+
+			value = *entry;
+			release();
+			return true;
+		}
+
+		// note: padding keeps both indices on their own cache line
+		DynamicArray<T> entries_;
+		uint32 mask_;
+		uint8 head_padding_[64];
+		std::atomic<uint32> head_;
+		uint8 tail_padding_[64];
+		std::atomic<uint32> tail_;
+	};
+} // !charlie
+
+#endif // !CHARLIE_QUEUE_HPP_INCLUDED
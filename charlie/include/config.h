@@ -13,6 +13,10 @@ namespace charlie
 		static constexpr uint8  IP_B = 117;
 		static constexpr uint8  IP_C = 111;
 		static constexpr uint8  IP_D = 100;
+		// note: conditioner preset on the client side, one of none, broadband,
+		//       wifi, mobile or congested, the seed makes runs repeatable
+		static constexpr const char* NETWORK_CONDITIONER = "none";
+		static constexpr uint64 NETWORK_CONDITIONER_SEED = 1;
 		static constexpr int  SCREEN_WIDTH = 640;
 		static constexpr int  SCREEN_HEIGHT = 480;
 		static constexpr int  PLAYER_WIDTH = 100;
@@ -39,6 +43,14 @@ namespace charlie
 		static const std::string BLOCK_TEXTURE("../assets/block.png");
 		static const std::string LEVEL_PATH_PREFIX("../assets/");
 		static const std::string MASTER_SERVER_FILE("../assets/masterserver.txt");
+		// note: downloaded maps are kept here by content hash, least recently
+		//       used ones are removed once the directory grows past the cap
+		static const std::string MAP_CACHE_DIRECTORY("../map_cache/");
+		static constexpr uint64 MAP_CACHE_CAPACITY = 4 * 1024 * 1024;
+		// note: the server rewrites this prometheus text snapshot every
+		//       interval, point a node exporter textfile collector at it
+		static const std::string METRICS_FILE("../server_metrics.prom");
+		static constexpr double METRICS_INTERVAL = 1.0;
 	};
 }
 #endif
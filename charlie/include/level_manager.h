@@ -6,6 +6,13 @@
 namespace charlie
 {
 	struct Leveldata;
+	struct CompiledMap;
+
+	namespace network
+	{
+		struct Connection;
+		struct NetworkStreamReader;
+	}
 
 	enum class LevelManagerState
 	{
@@ -22,6 +29,13 @@ namespace charlie
 		COUNT
 	};
 
+	enum class LevelStreamResult
+	{
+		SENT,
+		BUSY, // Too many messages pending on the connection, try again later
+		UNAVAILABLE, // The map does not fit one message
+	};
+
 	struct LevelObject
 	{
 		LevelObject();
@@ -36,26 +50,32 @@ namespace charlie
 		LevelManager();
 		~LevelManager();
 		bool waiting_for_data() const;
-		void create_tile(uint8 level_tile, uint8 x, uint8 y);
-		uint32 get_chunk(const uint32 send_to);
-		bool is_done_sending() const;
 		static SDLSprite* load_asset_with_id(int type, int x, int y);
 		void create_level_object(const int type, int i, int y);
 		bool load_assets(Leveldata& data);
+		bool load_compiled(const CompiledMap& map);
 		void render(SDL_Rect camera, SDL_Renderer* renderer);
 		Vector2 get_spawn_pos();
-		void request_map_data(uint8 level_id, uint8 size_x, uint8 size_y);
-		Tile get_level_data(uint32 player_id);
+		void request_map_data(uint8 level_id, uint8 size_x, uint8 size_y, uint64 hash);
+
+		// Level streaming, the server sends the whole map as one message
+		const DynamicArray<uint8>& level_stream();
+		LevelStreamResult stream_level(network::Connection* connection);
+		bool receive_level(network::NetworkStreamReader& reader);
 
 		Leveldata data_;
+		DynamicArray<uint8> compiled_; // The loaded map as a compiled map file, streamed and cached as is
 		int height_;
 		int width_;
 		DynamicArray<LevelObject> levelObjects_;
+		DynamicArray<LevelObject> decorations_; // Layers of compiled maps, drawn over the tiles
 		DynamicArray<LevelObject> colliders_;
 		DynamicArray<Vector2> spawn_points_;
 		int spawn_index_;
 		LevelManagerState state_;
 		uint8 level_id_;
-		DynamicArray<std::pair<uint32, uint32>> send_progress_;
+		uint64 hash_; // Content hash of the loaded or expected map
+		DynamicArray<uint8> stream_; // Encoded once per map
+		DynamicArray<uint16> streamed_to_; // Connection id per connection slot
 	};
 }
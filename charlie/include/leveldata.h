@@ -14,13 +14,15 @@ namespace charlie
 	struct Leveldata
 	{
 		Leveldata();
-		void get_size(std::string path);
 		bool create_level(uint8 name);
+		bool load_text(const std::string& path);
 		int get_tile_type(int x, int y);
-		Tile get_tile(uint32 tile_number);
+
+		// Identifies a map by its content, see leveldata.cpp
+		uint64 content_hash() const;
+
 		DynamicArray<Tile> tiles_; // Array of tiletypes
 		int sizeX_;
 		int sizeY_;
-		int tiles_loaded_;
 	};
 }
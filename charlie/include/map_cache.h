@@ -0,0 +1,39 @@
+﻿#pragma once
+#include <string>
+#include "charlie.hpp"
+
+namespace charlie
+{
+	struct CompiledMap;
+
+	// note: content addressed store for downloaded maps, every entry file is
+	//       a compiled map named after its content hash and an index file keeps
+	//       sizes and use order, least recently used entries are removed
+	//       once the entries together grow past the capacity
+	struct MapCache
+	{
+		struct Entry
+		{
+			uint64 hash_;
+			uint64 size_;
+			uint64 last_used_;
+		};
+
+		MapCache();
+		bool open(const std::string& directory, uint64 capacity);
+		bool load(uint64 hash, CompiledMap& map);
+		bool store(uint64 hash, const DynamicArray<uint8>& map);
+		void evict(uint64 hash);
+		void trim();
+		bool read_index();
+		bool write_index() const;
+		Entry* find(uint64 hash);
+		std::string path_of(uint64 hash) const;
+
+		std::string directory_;
+		uint64 capacity_;
+		uint64 size_;
+		uint64 clock_;
+		DynamicArray<Entry> entries_;
+	};
+}
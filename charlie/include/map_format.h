@@ -0,0 +1,127 @@
+﻿#pragma once
+#include "charlie.hpp"
+
+namespace charlie
+{
+	struct Leveldata;
+
+	// note: compiled map, a header and a section table followed by the
+	//       section data, every section starts 8 byte aligned so the loader
+	//       reads it in place from a mapped file, values are little endian
+	static constexpr uint32 MAP_FILE_MAGIC = 'CLVL';
+	static constexpr uint16 MAP_FILE_VERSION = 1;
+
+	enum MapSectionType : uint32
+	{
+		MAP_SECTION_TILES = 1, // One tile id per cell in row order
+		MAP_SECTION_SPAWNS = 2, // MapPoint per spawn point
+		MAP_SECTION_COLLIDERS = 3, // MapRect per run of blocked tiles
+		MAP_SECTION_LAYERS = 4, // Optional, one grid of tile ids per layer drawn over the tiles
+		MAP_SECTION_OBJECTS = 5, // Optional, MapObject per placed object
+	};
+
+	enum MapObjectType : uint16
+	{
+		MAP_OBJECT_COLLIDER = 1,
+		MAP_OBJECT_SPAWN = 2,
+	};
+
+	struct MapFileHeader
+	{
+		uint32 magic_;
+		uint16 version_;
+		uint16 section_count_;
+		uint16 size_x_;
+		uint16 size_y_;
+		uint32 reserved_;
+		uint64 hash_; // CompiledMap::content_hash of the whole map
+	};
+
+	struct MapSection
+	{
+		uint32 type_;
+		uint32 count_;
+		uint32 offset_;
+		uint32 size_;
+	};
+
+	// Positions and sizes are in tiles
+	struct MapPoint
+	{
+		uint16 x_;
+		uint16 y_;
+	};
+
+	struct MapRect
+	{
+		uint16 x_;
+		uint16 y_;
+		uint16 w_;
+		uint16 h_;
+	};
+
+	// Position and size are in pixels, a spawn only uses the position
+	struct MapObject
+	{
+		uint16 x_;
+		uint16 y_;
+		uint16 w_;
+		uint16 h_;
+		uint16 type_;
+		uint16 reserved_;
+	};
+
+	// note: what goes into a map besides the tile grid, maps compiled
+	//       from text have neither layers nor objects
+	struct MapContent
+	{
+		MapContent();
+
+		DynamicArray<uint8> layers_; // layer_count_ grids in row order
+		int32 layer_count_;
+		DynamicArray<MapObject> objects_;
+	};
+
+	static_assert(sizeof(MapFileHeader) == 24, "map file header layout changed!");
+	static_assert(sizeof(MapSection) == 16, "map section layout changed!");
+
+	// note: compiled maps are streamed to clients run length coded in one
+	//       fragmented message behind a small header, see map_format.cpp,
+	//       compile refuses a map whose stream would not fit the message
+	//       and one coded byte never decodes to more than the ratio
+	static constexpr int32 MAP_STREAM_HEADER_SIZE = 16;
+	static constexpr uint32 RUN_LENGTH_MAX_RATIO = 65;
+
+	void run_length_encode(const uint8* data, int32 count, DynamicArray<uint8>& stream);
+	bool run_length_decode(const uint8* data, int32 length, uint8* output, int32 count);
+	bool fits_map_stream(const DynamicArray<uint8>& coded);
+
+	struct CompiledMap
+	{
+		static bool compile(const Leveldata& data, DynamicArray<uint8>& output);
+		static bool compile(const Leveldata& data, const MapContent& content, DynamicArray<uint8>& output);
+
+		CompiledMap();
+		bool open(const char* filename);
+		bool open_level(uint8 level_id);
+		bool view(const uint8* data, uint64 size);
+		void close();
+		const MapSection* find_section(uint32 type) const;
+
+		// Identifies a map by everything the game loads from it, see map_format.cpp
+		uint64 content_hash() const;
+
+		MappedFile file_;
+		const MapFileHeader* header_;
+		uint64 size_;
+		const uint8* tiles_;
+		const MapPoint* spawns_;
+		int32 spawn_count_;
+		const MapRect* colliders_;
+		int32 collider_count_;
+		const uint8* layers_;
+		int32 layer_count_;
+		const MapObject* objects_;
+		int32 object_count_;
+	};
+}
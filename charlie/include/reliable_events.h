@@ -1,7 +1,6 @@
 ﻿#pragma once
 #include "charlie.hpp"
 #include "player.hpp"
-#include "leveldata.h"
 
 namespace charlie
 {
@@ -16,7 +15,6 @@ namespace charlie
 		PLAYER_DISCONNECTED,
 		SPAWN_ENTITY,
 		SEND_LEVEL_INFO,
-		SEND_LEVEL_DATA,
 		COUNT,
 	};
 
@@ -30,7 +28,6 @@ namespace charlie
 		int32 send_to_;
 		Vector2 pos_;
 		float rot_;
-		Tile tile_;
 		uint8 level_id_;
 	};
 
@@ -73,7 +70,6 @@ namespace charlie
 		void clear();
 		Event get_event(int32 id);
 		void send_level_info(uint8 level, int32 send_to);
-		void send_level_data(Tile tile, int32 send_to);
 		DynamicArray<Event> events_;
 		int32 event_id_;
 		uint8 level_id_;
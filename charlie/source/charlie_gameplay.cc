@@ -155,31 +155,310 @@ namespace charlie {
 			return false;
 		}
 
-		ReliableMessageQueue::ReliableMessageQueue() : buffer_{}, index_(0)
+		EntitySnapshot::EntitySnapshot() : sequence_(0), valid_(false)
 		{
 		}
 
-		void ReliableMessageQueue::add_message(Message& msg)
+		void EntitySnapshot::add(const EntityState& state)
 		{
-			buffer_[index_ % buffer_size_] = msg;
-			index_ += 1;
+			auto it = entities_.begin();
+			while (it != entities_.end() && it->id_ < state.id_)
+			{
+				++it;
+			}
+
+			if (it != entities_.end() && it->id_ == state.id_)
+			{
+				*it = state;
+				return;
+			}
+
+			entities_.insert(it, state);
 		}
 
-		Message ReliableMessageQueue::get_message(int32 tick)
+		const EntityState* EntitySnapshot::find(const uint8 id) const
 		{
-			return buffer_[tick % buffer_size_];
+			for (const EntityState& state : entities_)
+			{
+				if (state.id_ == id)
+				{
+					return &state;
+				}
+			}
+			return nullptr;
 		}
 
-		void ReliableMessageQueue::mark_received(const int32 id)
+		namespace
 		{
-			for (auto& msg : buffer_)
+			void encode_field(network::NetworkMessageEntityDelta::Entry& entry, const uint8 field, int16& value, const int16 current, const int16* base)
 			{
-				if (msg.id_ == id)
+				value = current;
+				if (!base)
 				{
-					msg.received_ = true;
-					printf("RELIABLE MESSAGE: Received message with id %i \n", (int)msg.id_);
-					break;
+					entry.changed_ |= field;
+					return;
+				}
+
+				const int32 delta = int32(current) - int32(*base);
+				if (delta == 0)
+				{
+					return;
+				}
+
+				entry.changed_ |= field;
+				if (delta >= network::MESSAGE_DELTA_SMALL_MIN && delta <= network::MESSAGE_DELTA_SMALL_MAX)
+				{
+					entry.small_ |= field;
+					value = static_cast<int16>(delta);
+				}
+			}
+
+			void decode_field(const network::NetworkMessageEntityDelta::Entry& entry, const uint8 field, int16& value, const int16 received)
+			{
+				if (!(entry.changed_ & field))
+				{
+					return;
+				}
+
+				value = (entry.small_ & field) ? static_cast<int16>(value + received) : received;
+			}
+		} // !anon
+
+		void EntitySnapshot::encode(const EntitySnapshot* baseline, network::NetworkMessageEntityDelta& message) const
+		{
+			using Delta = network::NetworkMessageEntityDelta;
+
+			message.has_baseline_ = baseline != nullptr;
+			message.baseline_ = baseline ? baseline->sequence_ : 0;
+			message.entries_.clear();
+
+			for (const EntityState& state : entities_)
+			{
+				const EntityState* base = baseline ? baseline->find(state.id_) : nullptr;
+
+				Delta::Entry entry{};
+				entry.id_ = state.id_;
+				encode_field(entry, Delta::FIELD_X, entry.x_, state.x_, base ? &base->x_ : nullptr);
+				encode_field(entry, Delta::FIELD_Y, entry.y_, state.y_, base ? &base->y_ : nullptr);
+				encode_field(entry, Delta::FIELD_ROTATION, entry.rotation_, state.rotation_, base ? &base->rotation_ : nullptr);
+				encode_field(entry, Delta::FIELD_TURRET_ROTATION, entry.turret_rotation_, state.turret_rotation_, base ? &base->turret_rotation_ : nullptr);
+
+				// note: unchanged entities cost nothing
+				if (entry.changed_ != 0)
+				{
+					message.entries_.push_back(entry);
+				}
+			}
+
+			if (baseline)
+			{
+				for (const EntityState& state : baseline->entities_)
+				{
+					if (!find(state.id_))
+					{
+						Delta::Entry entry{};
+						entry.id_ = state.id_;
+						entry.changed_ = Delta::FIELD_REMOVED;
+						message.entries_.push_back(entry);
+					}
+				}
+			}
+
+			assert(message.entries_.size() <= Delta::MAX_ENTRY_COUNT);
+			message.count_ = static_cast<uint8>(message.entries_.size());
+		}
+
+		bool EntitySnapshot::decode(const EntitySnapshot* baseline, const network::NetworkMessageEntityDelta& message)
+		{
+			using Delta = network::NetworkMessageEntityDelta;
+
+			entities_.clear();
+			if (baseline)
+			{
+				entities_ = baseline->entities_;
+			}
+
+			for (const Delta::Entry& entry : message.entries_)
+			{
+				const EntityState* base = find(entry.id_);
+				if (entry.changed_ & Delta::FIELD_REMOVED)
+				{
+					if (base)
+					{
+						entities_.erase(entities_.begin() + (base - entities_.data()));
+					}
+					continue;
+				}
+
+				// note: a new entity must carry every field in full
+				if (!base && ((entry.changed_ & Delta::FIELD_ALL) != Delta::FIELD_ALL || entry.small_ != 0))
+				{
+					return false;
+				}
+
+				EntityState state = base ? *base : EntityState{};
+				state.id_ = entry.id_;
+				decode_field(entry, Delta::FIELD_X, state.x_, entry.x_);
+				decode_field(entry, Delta::FIELD_Y, state.y_, entry.y_);
+				decode_field(entry, Delta::FIELD_ROTATION, state.rotation_, entry.rotation_);
+				decode_field(entry, Delta::FIELD_TURRET_ROTATION, state.turret_rotation_, entry.turret_rotation_);
+				add(state);
+			}
+
+			return true;
+		}
+
+		EntitySnapshot& SnapshotRing::insert(const uint16 sequence)
+		{
+			EntitySnapshot& snapshot = snapshots_[sequence % SIZE];
+			snapshot.sequence_ = sequence;
+			snapshot.valid_ = true;
+			snapshot.entities_.clear();
+			return snapshot;
+		}
+
+		const EntitySnapshot* SnapshotRing::find(const uint16 sequence) const
+		{
+			const EntitySnapshot& snapshot = snapshots_[sequence % SIZE];
+			if (!snapshot.valid_ || snapshot.sequence_ != sequence)
+			{
+				return nullptr;
+			}
+			return &snapshot;
+		}
+
+		ClockSync::ClockSync()
+		{
+			reset();
+		}
+
+		void ClockSync::reset()
+		{
+			sample_count_ = 0;
+			history_count_ = 0;
+			reference_ = {};
+			offset_ = 0.0;
+			drift_ = 0.0;
+		}
+
+		void ClockSync::add_sample(const Time& server_time, const Time& local_time, const Time& round_trip)
+		{
+			Sample& sample = filter_[sample_count_ % FILTER_SIZE];
+			sample.local_ = local_time;
+			sample.offset_ = server_time + round_trip / 2 - local_time;
+			sample.round_trip_ = round_trip;
+			sample_count_++;
+
+			const int32 count = sample_count_ < FILTER_SIZE ? sample_count_ : FILTER_SIZE;
+			const Sample* best = &filter_[0];
+			for (int32 index = 1; index < count; index++)
+			{
+				if (filter_[index].round_trip_ < best->round_trip_)
+				{
+					best = &filter_[index];
+				}
+			}
+
+			// note: one sample per window goes into the history so the line
+			//       spans long enough to tell drift apart from noise, until
+			//       the first window closes the best so far is used as is
+			if (sample_count_ % FILTER_SIZE != 0)
+			{
+				if (history_count_ == 0)
+				{
+					reference_ = best->local_;
+					offset_ = static_cast<double>(best->offset_.as_ticks());
 				}
+				return;
+			}
+
+			history_[history_count_ % HISTORY_SIZE] = *best;
+			history_count_++;
+			fit();
+		}
+
+		void ClockSync::fit()
+		{
+			const int32 count = history_count_ < HISTORY_SIZE ? history_count_ : HISTORY_SIZE;
+			const Sample& latest = history_[(history_count_ - 1) % HISTORY_SIZE];
+			if (count < 4)
+			{
+				reference_ = latest.local_;
+				offset_ = static_cast<double>(latest.offset_.as_ticks());
+				drift_ = 0.0;
+				return;
+			}
+
+			// Relative to the latest sample so the sums stay small
+			double mean_x = 0.0;
+			double mean_y = 0.0;
+			for (int32 index = 0; index < count; index++)
+			{
+				mean_x += static_cast<double>((history_[index].local_ - latest.local_).as_ticks());
+				mean_y += static_cast<double>((history_[index].offset_ - latest.offset_).as_ticks());
+			}
+			mean_x /= count;
+			mean_y /= count;
+
+			double sxx = 0.0;
+			double sxy = 0.0;
+			for (int32 index = 0; index < count; index++)
+			{
+				const double x = static_cast<double>((history_[index].local_ - latest.local_).as_ticks()) - mean_x;
+				const double y = static_cast<double>((history_[index].offset_ - latest.offset_).as_ticks()) - mean_y;
+				sxx += x * x;
+				sxy += x * y;
+			}
+
+			double drift = sxx > 0.0 ? sxy / sxx : 0.0;
+			if (drift > MAX_DRIFT)
+			{
+				drift = MAX_DRIFT;
+			}
+			else if (drift < -MAX_DRIFT)
+			{
+				drift = -MAX_DRIFT;
+			}
+
+			reference_ = latest.local_ + Time(static_cast<int64>(mean_x));
+			offset_ = static_cast<double>(latest.offset_.as_ticks()) + mean_y;
+			drift_ = drift;
+		}
+
+		Time ClockSync::offset(const Time& local_time) const
+		{
+			const double elapsed = static_cast<double>((local_time - reference_).as_ticks());
+			return Time(static_cast<int64>(offset_ + drift_ * elapsed));
+		}
+
+		Time ClockSync::server_time(const Time& local_time) const
+		{
+			return local_time + offset(local_time);
+		}
+
+		// note: the tick runs up to MAX_SLEW faster or slower in proportion to
+		//       how far behind or ahead of the target it is
+		Time ClockSync::tick_interval(const Time& tickrate, const float tick_error)
+		{
+			float slew = tick_error * SLEW_GAIN;
+			if (slew > MAX_SLEW)
+			{
+				slew = MAX_SLEW;
+			}
+			else if (slew < -MAX_SLEW)
+			{
+				slew = -MAX_SLEW;
+			}
+
+			return Time(static_cast<int64>(static_cast<double>(tickrate.as_ticks()) * (1.0 - slew)));
+		}
+
+		void SnapshotRing::clear()
+		{
+			for (EntitySnapshot& snapshot : snapshots_)
+			{
+				snapshot.valid_ = false;
+				snapshot.entities_.clear();
 			}
 		}
 	} // !gameplay
@@ -31,6 +31,16 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		bool NetworkMessageServerTick::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessageServerTick::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		NetworkMessageEntityState::NetworkMessageEntityState()
 			: type_(NETWORK_MESSAGE_ENTITY_STATE)
 			, x_(0)
@@ -61,20 +71,34 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		bool NetworkMessageEntityState::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessageEntityState::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		NetworkMessageInputCommand::NetworkMessageInputCommand()
 			: type_(NETWORK_MESSAGE_INPUT_COMMAND)
 			, bits_(0)
 			, rot_(0)
 			, fire_(false)
+			, has_snapshot_(false)
+			, snapshot_(0)
 		{
 		}
 
-		NetworkMessageInputCommand::NetworkMessageInputCommand(uint8 bits, float rotation, bool fire, int32 tick)
+		NetworkMessageInputCommand::NetworkMessageInputCommand(uint8 bits, float rotation, bool fire, int32 tick, bool has_snapshot, uint16 snapshot)
 			: type_(NETWORK_MESSAGE_INPUT_COMMAND)
 			, bits_(bits)
 			, rot_((int16)rotation)
 			, fire_(fire)
 			, tick_(tick)
+			, has_snapshot_(has_snapshot)
+			, snapshot_(snapshot)
 		{
 		}
 
@@ -88,6 +112,44 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		bool NetworkMessageInputCommand::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessageInputCommand::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
+		NetworkMessageEntityDelta::NetworkMessageEntityDelta()
+			: type_(NETWORK_MESSAGE_ENTITY_DELTA)
+			, has_baseline_(false)
+			, baseline_(0)
+			, count_(0)
+		{
+		}
+
+		bool NetworkMessageEntityDelta::read(NetworkStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessageEntityDelta::write(NetworkStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
+		bool NetworkMessageEntityDelta::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessageEntityDelta::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		NetworkMessagePlayerState::NetworkMessagePlayerState()
 			: type_(NETWORK_MESSAGE_PLAYER_STATE)
 			, rotation_(0)
@@ -116,6 +178,16 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		bool NetworkMessagePlayerState::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessagePlayerState::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		NetworkMessagePlayerSpawn::NetworkMessagePlayerSpawn()
 			: type_(NETWORK_MESSAGE_PLAYER_SPAWN)
 			, entity_id_(0)
@@ -141,6 +213,16 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		bool NetworkMessagePlayerSpawn::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessagePlayerSpawn::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		NetworkMessageEntitySpawn::NetworkMessageEntitySpawn() : type_(NETWORK_MESSAGE_ENTITY_SPAWN), entity_id_(0), event_id_(0)
 		{
 		}
@@ -163,24 +245,12 @@ namespace charlie {
 			return serialize(writer);
 		}
 
-		NetworkMessageAck::NetworkMessageAck()
-			: type_(NETWORK_MESSAGE_ACK)
-			, event_id_(0)
-		{
-		}
-
-		NetworkMessageAck::NetworkMessageAck(const int32 id)
-			: type_(NETWORK_MESSAGE_ACK)
-			, event_id_(id)
-		{
-		}
-
-		bool NetworkMessageAck::read(NetworkStreamReader& reader)
+		bool NetworkMessageEntitySpawn::read(BitStreamReader& reader)
 		{
 			return serialize(reader);
 		}
 
-		bool NetworkMessageAck::write(NetworkStreamWriter& writer)
+		bool NetworkMessageEntitySpawn::write(BitStreamWriter& writer)
 		{
 			return serialize(writer);
 		}
@@ -214,6 +284,16 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		bool NetworkMessageProjectileSpawn::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessageProjectileSpawn::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		NetworkMessagePlayerDisconnected::NetworkMessagePlayerDisconnected()
 			: type_(NETWORK_MESSAGE_DISCONNECTED)
 			, entity_id_(0)
@@ -238,6 +318,16 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		bool NetworkMessagePlayerDisconnected::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessagePlayerDisconnected::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		NetworkMessageProjectileDestroy::NetworkMessageProjectileDestroy()
 			: type_(NETWORK_MESSAGE_PROJECTILE_DESTROYED)
 			, entity_id_(0)
@@ -262,6 +352,16 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		bool NetworkMessageProjectileDestroy::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessageProjectileDestroy::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		NetworkMessageEntityDestroy::NetworkMessageEntityDestroy()
 			: type_(NETWORK_MESSAGE_ENTITY_DESTROYED)
 			, entity_id_(0)
@@ -286,6 +386,16 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		bool NetworkMessageEntityDestroy::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessageEntityDestroy::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		NetworkMessagePlayerDestroy::NetworkMessagePlayerDestroy()
 			: type_(NETWORK_MESSAGE_PLAYER_DESTROYED)
 			, entity_id_(0)
@@ -310,16 +420,26 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		bool NetworkMessagePlayerDestroy::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessagePlayerDestroy::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		NetworkMessageLevelInfo::NetworkMessageLevelInfo() : type_(NETWORK_MESSAGE_LEVEL_INFO), level_id_(0),
 			size_x_(0),
-			size_y_(0), event_id_(0)
+			size_y_(0), hash_(0), event_id_(0)
 		{
 		}
 
-		NetworkMessageLevelInfo::NetworkMessageLevelInfo(uint8 level_id, uint8 size_x_, uint8 size_y_, int32 event_id)
+		NetworkMessageLevelInfo::NetworkMessageLevelInfo(uint8 level_id, uint8 size_x_, uint8 size_y_, uint64 hash, int32 event_id)
 			: type_(NETWORK_MESSAGE_LEVEL_INFO)
 			, level_id_(level_id)
-			, size_x_(size_x_), size_y_(size_y_), event_id_(event_id)
+			, size_x_(size_x_), size_y_(size_y_), hash_(hash), event_id_(event_id)
 		{
 		}
 
@@ -333,6 +453,16 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		bool NetworkMessageLevelInfo::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessageLevelInfo::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		NetworkMessageLevelDataRequest::NetworkMessageLevelDataRequest() : type_(NETWORK_MESSAGE_LEVEL_REQUEST),
 			event_id_(0)
 		{
@@ -352,18 +482,30 @@ namespace charlie {
 			return serialize(writer);
 		}
 
-		NetworkMessageLevelData::NetworkMessageLevelData() : type_(NETWORK_MESSAGE_LEVEL_DATA), level_tile_(0), x_(0),
-			y_(0),
-			event_id_(0)
+		bool NetworkMessageLevelDataRequest::read(BitStreamReader& reader)
 		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessageLevelDataRequest::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
 		}
 
-		NetworkMessageLevelData::NetworkMessageLevelData(Tile tile, int32 event_id)
+		NetworkMessageLevelData::NetworkMessageLevelData() : type_(NETWORK_MESSAGE_LEVEL_DATA), level_id_(0), size_x_(0),
+			size_y_(0),
+			length_(0),
+			size_(0)
+		{
+		}
+
+		NetworkMessageLevelData::NetworkMessageLevelData(uint8 level_id, uint8 size_x, uint8 size_y, uint32 length, uint32 size)
 			: type_(NETWORK_MESSAGE_LEVEL_DATA)
-			, level_tile_(tile.tile_id_)
-			, x_(tile.x_)
-			, y_(tile.y_)
-			, event_id_(event_id)
+			, level_id_(level_id)
+			, size_x_(size_x)
+			, size_y_(size_y)
+			, length_(length)
+			, size_(size)
 		{
 		}
 
@@ -377,6 +519,16 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		bool NetworkMessageLevelData::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessageLevelData::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		NetworkMessageMasterServer::NetworkMessageMasterServer() : type_(NETWORK_MESSAGE_MASTER_SERVER), a_(0), b_(0), c_(0), d_(0)
 		{
 		}
@@ -399,5 +551,15 @@ namespace charlie {
 		{
 			return serialize(writer);
 		}
+
+		bool NetworkMessageMasterServer::read(BitStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool NetworkMessageMasterServer::write(BitStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
 	} // !network
 } // !messages
@@ -0,0 +1,252 @@
+// charlie_metrics.cc
+
+#include "charlie_metrics.hpp"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <Windows.h>
+#endif
+#include <algorithm>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <fstream>
+
+namespace charlie {
+	namespace metrics {
+		namespace {
+			template <typename T>
+			void remove_metric(DynamicArray<T*>& metrics, const T* metric)
+			{
+				auto it = std::find(metrics.begin(), metrics.end(), metric);
+				if (it != metrics.end()) {
+					metrics.erase(it);
+				}
+			}
+
+			void write_header(std::string& output, const char* name, const char* help, const char* type)
+			{
+				output += "# HELP ";
+				output += name;
+				output += " ";
+				output += help;
+				output += "\n# TYPE ";
+				output += name;
+				output += " ";
+				output += type;
+				output += "\n";
+			}
+
+			void write_sample(std::string& output, const char* format, ...)
+			{
+				char line[256];
+				va_list args;
+				va_start(args, format);
+				const int length = vsnprintf(line, sizeof(line), format, args);
+				va_end(args);
+				if (length > 0) {
+					output.append(line, std::min(static_cast<size_t>(length), sizeof(line) - 1));
+				}
+			}
+		} // !anon
+
+		Counter::Counter(const char* name, const char* help)
+			: name_(name)
+			, help_(help)
+			, value_(0)
+		{
+			Registry::instance().add(this);
+		}
+
+		Counter::~Counter()
+		{
+			Registry::instance().remove(this);
+		}
+
+		uint64 Counter::value() const
+		{
+			return value_.load(std::memory_order_relaxed);
+		}
+
+		Gauge::Gauge(const char* name, const char* help)
+			: name_(name)
+			, help_(help)
+			, value_(0)
+		{
+			Registry::instance().add(this);
+		}
+
+		Gauge::~Gauge()
+		{
+			Registry::instance().remove(this);
+		}
+
+		int64 Gauge::value() const
+		{
+			return value_.load(std::memory_order_relaxed);
+		}
+
+		const int64 Histogram::TIME_BUCKETS[] = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000 };
+		const int32 Histogram::TIME_BUCKET_COUNT = sizeof(TIME_BUCKETS) / sizeof(TIME_BUCKETS[0]);
+
+		Histogram::Histogram(const char* name, const char* help)
+			: Histogram(name, help, TIME_BUCKETS, TIME_BUCKET_COUNT, 1.0 / 1000000.0)
+		{
+		}
+
+		Histogram::Histogram(const char* name, const char* help, const int64* limits, const int32 count, const double scale)
+			: name_(name)
+			, help_(help)
+			, scale_(scale)
+			, bucket_count_(count < MAX_BUCKET_COUNT ? count : MAX_BUCKET_COUNT)
+			, sum_(0)
+		{
+			assert(count <= MAX_BUCKET_COUNT);
+			for (int32 index = 0; index < MAX_BUCKET_COUNT; index++) {
+				limits_[index] = index < bucket_count_ ? limits[index] : 0;
+			}
+			for (auto& bucket : buckets_) {
+				bucket.store(0, std::memory_order_relaxed);
+			}
+
+			Registry::instance().add(this);
+		}
+
+		Histogram::~Histogram()
+		{
+			Registry::instance().remove(this);
+		}
+
+		// static
+		Registry& Registry::instance()
+		{
+			static Registry registry;
+			return registry;
+		}
+
+		void Registry::add(Counter* counter)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			counters_.push_back(counter);
+		}
+
+		void Registry::add(Gauge* gauge)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			gauges_.push_back(gauge);
+		}
+
+		void Registry::add(Histogram* histogram)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			histograms_.push_back(histogram);
+		}
+
+		void Registry::remove(const Counter* counter)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			remove_metric(counters_, counter);
+		}
+
+		void Registry::remove(const Gauge* gauge)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			remove_metric(gauges_, gauge);
+		}
+
+		void Registry::remove(const Histogram* histogram)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			remove_metric(histograms_, histogram);
+		}
+
+		void Registry::write(std::string& output) const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			for (const Counter* counter : counters_) {
+				write_header(output, counter->name_, counter->help_, "counter");
+				write_sample(output, "%s %" PRIu64 "\n", counter->name_, counter->value());
+			}
+
+			for (const Gauge* gauge : gauges_) {
+				write_header(output, gauge->name_, gauge->help_, "gauge");
+				write_sample(output, "%s %" PRId64 "\n", gauge->name_, gauge->value());
+			}
+
+			// note: buckets are read one by one while others may still be
+			//       counting, the count is summed from the same reads so the
+			//       exported buckets always agree with it
+			for (const Histogram* histogram : histograms_) {
+				write_header(output, histogram->name_, histogram->help_, "histogram");
+
+				uint64 count = 0;
+				for (int32 index = 0; index < histogram->bucket_count_; index++) {
+					count += histogram->buckets_[index].load(std::memory_order_relaxed);
+					write_sample(output, "%s_bucket{le=\"%g\"} %" PRIu64 "\n",
+						histogram->name_,
+						static_cast<double>(histogram->limits_[index]) * histogram->scale_,
+						count);
+				}
+				count += histogram->buckets_[histogram->bucket_count_].load(std::memory_order_relaxed);
+				write_sample(output, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", histogram->name_, count);
+				write_sample(output, "%s_sum %g\n",
+					histogram->name_,
+					static_cast<double>(histogram->sum_.load(std::memory_order_relaxed)) * histogram->scale_);
+				write_sample(output, "%s_count %" PRIu64 "\n", histogram->name_, count);
+			}
+		}
+
+		SnapshotFile::SnapshotFile()
+		{
+		}
+
+		void SnapshotFile::open(const char* filename, const Time& interval)
+		{
+			filename_ = filename;
+			interval_ = interval;
+			last_write_ = Time();
+		}
+
+		void SnapshotFile::close()
+		{
+			filename_.clear();
+			buffer_.clear();
+		}
+
+		bool SnapshotFile::update(const Time& time)
+		{
+			if (filename_.empty() || (time - last_write_) < interval_) {
+				return false;
+			}
+
+			last_write_ = time;
+			return write();
+		}
+
+		bool SnapshotFile::write()
+		{
+			if (filename_.empty()) {
+				return false;
+			}
+
+			// note: the buffer keeps its capacity, only the first write allocates
+			buffer_.clear();
+			Registry::instance().write(buffer_);
+
+			const std::string temporary = filename_ + ".tmp";
+			{
+				std::ofstream file(temporary.c_str(), std::ios::binary | std::ios::trunc);
+				if (!file.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()))) {
+					return false;
+				}
+			}
+
+#if defined(_WIN32)
+			return MoveFileExA(temporary.c_str(), filename_.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+			return std::rename(temporary.c_str(), filename_.c_str()) == 0;
+#endif
+		}
+	} // !metrics
+} // !charlie
@@ -3,13 +3,36 @@
 
 #include "charlie_network.hpp"
 #include "charlie_protocol.hpp"
+#include "charlie_uring.hpp"
+#include "charlie_metrics.hpp"
 
+#if defined(_WIN32)
 #include <WinSock2.h>
 #include <WS2tcpip.h>
 #include <iphlpapi.h>
+#include <mmsystem.h> // timeBeginPeriod
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netdb.h>
+#include <ifaddrs.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
 
 #include <cstdio>
 #include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <random>
 
 #include "config.h"
 
@@ -17,24 +40,64 @@ namespace charlie {
 	namespace network {
 		static Service* g_service = nullptr;
 
+#if !defined(_WIN32)
+		// note: posix sockets are plain file descriptors, map them onto
+		//       the winsock names so the socket code reads the same
+		typedef int SOCKET;
+		typedef addrinfo ADDRINFO;
+		static constexpr uint64 INVALID_SOCKET = ~0ull;
+		static constexpr int SOCKET_ERROR = -1;
+#endif
+
+#if defined(__linux__) && !defined(UDP_SEGMENT)
+		// note: older libc headers lack the udp gso socket option
+#define UDP_SEGMENT 103
+#endif
+
+		namespace {
+			inline SOCKET as_socket(const uint64 id)
+			{
+				return static_cast<SOCKET>(id);
+			}
+		} // !anon
+
 		// static 
 		int32 Error::get_last()
 		{
+#if defined(_WIN32)
 			return WSAGetLastError();
+#else
+			return errno;
+#endif
 		}
 
 		bool Error::is_critical(const int32 error)
 		{
+#if defined(_WIN32)
 			if (error == 0 ||
 				error == WSAEWOULDBLOCK ||
 				error == WSAECONNRESET)
 			{
 				return false;
 			}
+#else
+			// note: linux reports icmp port unreachable on a udp socket as
+			//       ECONNREFUSED, which is what winsock calls WSAECONNRESET
+			if (error == 0 ||
+				error == EAGAIN ||
+				error == EWOULDBLOCK ||
+				error == EINTR ||
+				error == ECONNRESET ||
+				error == ECONNREFUSED)
+			{
+				return false;
+			}
+#endif
 
 			return true;
 		}
 
+#if defined(_WIN32)
 		// static 
 		bool IPAddress::local_addresses(DynamicArray<IPAddress>& addresses)
 		{
@@ -72,6 +135,38 @@ namespace charlie {
 
 			return !addresses.empty();
 		}
+#else
+		// static 
+		bool IPAddress::local_addresses(DynamicArray<IPAddress>& addresses)
+		{
+			ifaddrs* interface_addresses = nullptr;
+			if (getifaddrs(&interface_addresses) != 0) {
+				return false;
+			}
+
+			for (ifaddrs* iter = interface_addresses; iter != nullptr; iter = iter->ifa_next) {
+				if (!iter->ifa_addr || iter->ifa_addr->sa_family != AF_INET) {
+					continue;
+				}
+
+				// note: same filter as the adapter scan on windows, only
+				//       interfaces that are up and not the loopback
+				if (!(iter->ifa_flags & IFF_UP) || (iter->ifa_flags & IFF_LOOPBACK)) {
+					continue;
+				}
+
+				sockaddr_in ai = *(sockaddr_in*)iter->ifa_addr;
+				IPAddress address;
+				address.host_ = ntohl(ai.sin_addr.s_addr);
+				address.port_ = ntohs(ai.sin_port);
+				addresses.push_back(address);
+			}
+
+			freeifaddrs(interface_addresses);
+
+			return !addresses.empty();
+		}
+#endif
 
 		bool IPAddress::dns_lookup(const char* dns, DynamicArray<IPAddress>& addresses)
 		{
@@ -137,7 +232,7 @@ namespace charlie {
 		const char* IPAddress::as_string() const
 		{
 			static char string[64] = {};
-			sprintf_s(string,
+			snprintf(string,
 				sizeof(string),
 				"%d.%d.%d.%d:%d",
 				(host_ >> 24) & 0xff,
@@ -156,8 +251,8 @@ namespace charlie {
 			}
 
 			sockaddr_in name = {};
-			int name_size = sizeof(name);
-			if (getsockname(socket.id_, (sockaddr*)&name, &name_size) < 0) {
+			socklen_t name_size = sizeof(name);
+			if (getsockname(as_socket(socket.id_), (sockaddr*)&name, &name_size) < 0) {
 				return false;
 			}
 
@@ -167,8 +262,22 @@ namespace charlie {
 			return true;
 		}
 
+		SendCounters::SendCounters()
+			: datagrams_(0)
+			, syscalls_(0)
+			, segmented_(0)
+		{
+		}
+
+		uint64 SendCounters::syscalls_saved() const
+		{
+			return datagrams_ > syscalls_ ? datagrams_ - syscalls_ : 0;
+		}
+
 		UDPSocket::UDPSocket()
 			: id_(INVALID_SOCKET)
+			, segmentation_(false)
+			, ring_(nullptr)
 		{
 		}
 
@@ -183,12 +292,17 @@ namespace charlie {
 		}
 
 		bool UDPSocket::open(const IPAddress& address)
+		{
+			return open(address, Backend::Socket);
+		}
+
+		bool UDPSocket::open(const IPAddress& address, const Backend backend)
 		{
 			if (is_valid()) {
 				close();
 			}
 
-			id_ = ::socket(AF_INET, SOCK_DGRAM, 0);
+			id_ = static_cast<uint64>(::socket(AF_INET, SOCK_DGRAM, 0));
 			if (id_ == INVALID_SOCKET) {
 				return false;
 			}
@@ -197,26 +311,63 @@ namespace charlie {
 			local.sin_family = AF_INET;
 			local.sin_port = htons(address.port_);
 			local.sin_addr.s_addr = htonl(address.host_);
-			if (bind(id_, (const sockaddr*)&local, sizeof(local)) == SOCKET_ERROR) {
+			if (bind(as_socket(id_), (const sockaddr*)&local, sizeof(local)) == SOCKET_ERROR) {
 				return false;
 			}
 
+#if defined(_WIN32)
 			u_long non_blocking = 1;
-			if (ioctlsocket(id_, FIONBIO, &non_blocking) == SOCKET_ERROR) {
+			if (ioctlsocket(as_socket(id_), FIONBIO, &non_blocking) == SOCKET_ERROR) {
+				return false;
+			}
+#else
+			const int flags = fcntl(as_socket(id_), F_GETFL, 0);
+			if (flags == SOCKET_ERROR || fcntl(as_socket(id_), F_SETFL, flags | O_NONBLOCK) == SOCKET_ERROR) {
 				return false;
 			}
+#endif
+
+#if defined(__linux__)
+			// note: kernels without udp segmentation offload reject the option
+			int segment_size = 0;
+			socklen_t option_length = sizeof(segment_size);
+			segmentation_ = getsockopt(as_socket(id_), IPPROTO_UDP, UDP_SEGMENT, &segment_size, &option_length) == 0;
+#endif
+
+			if (backend == Backend::IOUring) {
+				ring_ = new IORing;
+				if (!ring_->open(id_)) {
+					printf("NFO: io_uring not available, using socket backend\n");
+					delete ring_;
+					ring_ = nullptr;
+				}
+			}
 
 			return true;
 		}
 
 		void UDPSocket::close()
 		{
+			if (ring_) {
+				delete ring_;
+				ring_ = nullptr;
+			}
+
 			if (is_valid()) {
-				::closesocket(id_);
+#if defined(_WIN32)
+				::closesocket(as_socket(id_));
+#else
+				::close(as_socket(id_));
+#endif
 				id_ = INVALID_SOCKET;
 			}
 		}
 
+		UDPSocket::Backend UDPSocket::backend() const
+		{
+			return ring_ ? Backend::IOUring : Backend::Socket;
+		}
+
 		bool UDPSocket::send(const IPAddress& address, const uint8* data, const int32 length) const
 		{
 			if (!is_valid()) {
@@ -227,7 +378,7 @@ namespace charlie {
 			remote.sin_family = AF_INET;
 			remote.sin_port = htons(address.port_);
 			remote.sin_addr.s_addr = htonl(address.host_);
-			int s = ::sendto(id_, (const char*)data, length, 0, (const sockaddr*)&remote, sizeof(remote));
+			const auto s = ::sendto(as_socket(id_), (const char*)data, length, 0, (const sockaddr*)&remote, sizeof(remote));
 			if (s == SOCKET_ERROR) {
 				return false;
 			}
@@ -241,23 +392,381 @@ namespace charlie {
 				return false;
 			}
 
-			int remote_size = sizeof(sockaddr_in);
+			socklen_t remote_size = sizeof(sockaddr_in);
 			sockaddr_in remote = {};
-			int r = ::recvfrom(id_, (char*)data, length, 0, (sockaddr*)&remote, &remote_size);
+			const auto r = ::recvfrom(as_socket(id_), (char*)data, length, 0, (sockaddr*)&remote, &remote_size);
 			if (r == SOCKET_ERROR) {
 				return false;
 			}
 
-			length = r;
+			length = static_cast<int32>(r);
 			address.host_ = ntohl(remote.sin_addr.s_addr);
 			address.port_ = ntohs(remote.sin_port);
 
 			return true;
 		}
 
+		void UDPSocket::wait(const Time& timeout)
+		{
+			// note: io_uring only exists on linux where a short sleep is exact,
+			//       its posted receives would hide readiness from poll anyway
+			if (!is_valid() || ring_) {
+				Time::sleep(timeout);
+				return;
+			}
+
+			const int64 milliseconds = timeout.as_ticks() / 1000;
+			const int wait_time = milliseconds > 0 ? static_cast<int>(milliseconds) : 1;
+#if defined(_WIN32)
+			WSAPOLLFD descriptor = {};
+			descriptor.fd = as_socket(id_);
+			descriptor.events = POLLRDNORM;
+			WSAPoll(&descriptor, 1, wait_time);
+#else
+			pollfd descriptor = {};
+			descriptor.fd = as_socket(id_);
+			descriptor.events = POLLIN;
+			::poll(&descriptor, 1, wait_time);
+#endif
+		}
+
+		int32 UDPSocket::receive_batch(Datagram* datagrams, const int32 count)
+		{
+			if (!is_valid()) {
+				return -1;
+			}
+
+			if (ring_) {
+				return ring_->receive_batch(datagrams, count);
+			}
+
+#if defined(__linux__)
+			// note: one recvmmsg call fills the whole batch, the kernel returns
+			//       as soon as the receive queue is empty
+			mmsghdr messages[MAX_BATCH_SIZE] = {};
+			iovec vectors[MAX_BATCH_SIZE] = {};
+			sockaddr_in remotes[MAX_BATCH_SIZE] = {};
+
+			const int32 batch_size = count < MAX_BATCH_SIZE ? count : MAX_BATCH_SIZE;
+			for (int32 index = 0; index < batch_size; index++) {
+				assert(datagrams[index].packet_.is_valid());
+				vectors[index].iov_base = datagrams[index].packet_.data();
+				vectors[index].iov_len = static_cast<size_t>(datagrams[index].packet_.capacity());
+				messages[index].msg_hdr.msg_name = &remotes[index];
+				messages[index].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+				messages[index].msg_hdr.msg_iov = &vectors[index];
+				messages[index].msg_hdr.msg_iovlen = 1;
+			}
+
+			const int r = ::recvmmsg(as_socket(id_), messages, static_cast<unsigned int>(batch_size), MSG_DONTWAIT, nullptr);
+			if (r == SOCKET_ERROR) {
+				return -1;
+			}
+
+			for (int32 index = 0; index < r; index++) {
+				datagrams[index].packet_.set_length(static_cast<int32>(messages[index].msg_len));
+				datagrams[index].address_.host_ = ntohl(remotes[index].sin_addr.s_addr);
+				datagrams[index].address_.port_ = ntohs(remotes[index].sin_port);
+			}
+
+			return r;
+#else
+			int32 received = 0;
+			while (received < count) {
+				Datagram& datagram = datagrams[received];
+				assert(datagram.packet_.is_valid());
+				int32 length = datagram.packet_.capacity();
+				if (!receive(datagram.address_, datagram.packet_.data(), length)) {
+					break;
+				}
+				datagram.packet_.set_length(length);
+				received++;
+			}
+
+			return received > 0 ? received : -1;
+#endif
+		}
+
+		int32 UDPSocket::send_batch(const Datagram* datagrams, const int32 count, SendCounters& counters)
+		{
+			if (!is_valid()) {
+				return 0;
+			}
+
+			if (ring_) {
+				return ring_->send_batch(datagrams, count, counters);
+			}
+
+#if defined(__linux__)
+			mmsghdr messages[MAX_BATCH_SIZE] = {};
+			iovec vectors[MAX_BATCH_SIZE] = {};
+			sockaddr_in remotes[MAX_BATCH_SIZE] = {};
+			int32 segments[MAX_BATCH_SIZE] = {};
+			char controls[MAX_BATCH_SIZE][CMSG_SPACE(sizeof(uint16))] = {};
+
+			int32 sent = 0;
+			int32 failed = 0;
+			while (sent + failed < count) {
+				int32 message_count = 0;
+				int32 vector_count = 0;
+				int32 index = sent + failed;
+				while (index < count && message_count < MAX_BATCH_SIZE && vector_count < MAX_BATCH_SIZE) {
+					const Datagram& head = datagrams[index];
+					const int32 segment_size = head.packet_.length();
+
+					// note: gso splits one buffer into equal sized segments where
+					//       only the last one may be shorter, so a run of packets
+					//       to the same peer can share a single message
+					int32 segment_count = 1;
+					int32 total_size = segment_size;
+					if (segmentation_) {
+						while (index + segment_count < count &&
+							vector_count + segment_count < MAX_BATCH_SIZE &&
+							segment_count < MAX_SEGMENT_COUNT)
+						{
+							const Datagram& previous = datagrams[index + segment_count - 1];
+							const Datagram& next = datagrams[index + segment_count];
+							if (next.address_ != head.address_ ||
+								previous.packet_.length() != segment_size ||
+								next.packet_.length() > segment_size ||
+								total_size + next.packet_.length() > 0xffff - 64)
+							{
+								break;
+							}
+
+							total_size += next.packet_.length();
+							segment_count++;
+						}
+					}
+
+					for (int32 segment = 0; segment < segment_count; segment++) {
+						const Datagram& datagram = datagrams[index + segment];
+						vectors[vector_count + segment].iov_base = datagram.packet_.data();
+						vectors[vector_count + segment].iov_len = static_cast<size_t>(datagram.packet_.length());
+					}
+
+					sockaddr_in& remote = remotes[message_count];
+					remote = {};
+					remote.sin_family = AF_INET;
+					remote.sin_port = htons(head.address_.port_);
+					remote.sin_addr.s_addr = htonl(head.address_.host_);
+
+					msghdr& header = messages[message_count].msg_hdr;
+					header = {};
+					header.msg_name = &remote;
+					header.msg_namelen = sizeof(remote);
+					header.msg_iov = &vectors[vector_count];
+					header.msg_iovlen = static_cast<size_t>(segment_count);
+					if (segment_count > 1) {
+						header.msg_control = controls[message_count];
+						header.msg_controllen = sizeof(controls[message_count]);
+
+						cmsghdr* control = CMSG_FIRSTHDR(&header);
+						control->cmsg_level = IPPROTO_UDP;
+						control->cmsg_type = UDP_SEGMENT;
+						control->cmsg_len = CMSG_LEN(sizeof(uint16));
+						const uint16 size = static_cast<uint16>(segment_size);
+						memcpy(CMSG_DATA(control), &size, sizeof(size));
+					}
+
+					segments[message_count] = segment_count;
+					message_count++;
+					vector_count += segment_count;
+					index += segment_count;
+				}
+
+				const int r = ::sendmmsg(as_socket(id_), messages, static_cast<unsigned int>(message_count), 0);
+				counters.syscalls_++;
+				if (r == SOCKET_ERROR) {
+					// note: devices without checksum offload fail segmented sends
+					//       with EIO, fall back to one datagram per message
+					if (errno == EIO && segmentation_) {
+						segmentation_ = false;
+						continue;
+					}
+
+					// note: the first message failed, drop it and carry on
+					//       with the rest like individual sends would
+					failed += segments[0];
+					continue;
+				}
+
+				for (int32 message = 0; message < r; message++) {
+					if (segments[message] > 1) {
+						counters.segmented_ += static_cast<uint64>(segments[message]);
+					}
+					counters.datagrams_ += static_cast<uint64>(segments[message]);
+					sent += segments[message];
+				}
+			}
+
+			return sent;
+#else
+			int32 sent = 0;
+			for (int32 index = 0; index < count; index++) {
+				const Datagram& datagram = datagrams[index];
+				counters.syscalls_++;
+				if (send(datagram.address_, datagram.packet_.data(), datagram.packet_.length())) {
+					counters.datagrams_++;
+					sent++;
+				}
+			}
+
+			return sent;
+#endif
+		}
+
+		// static
+		PacketPool& PacketPool::get()
+		{
+			static PacketPool pool;
+			return pool;
+		}
+
+		PacketPool::PacketPool()
+			: free_(nullptr)
+			, allocated_(0)
+			, available_(0)
+		{
+		}
+
+		PacketPool::~PacketPool()
+		{
+			for (PacketBuffer* block : blocks_) {
+				delete[] block;
+			}
+		}
+
+		PacketBuffer* PacketPool::acquire()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!free_) {
+				// note: buffers are never zeroed, writers only touch what they fill
+				PacketBuffer* block = new PacketBuffer[BLOCK_SIZE];
+				blocks_.push_back(block);
+				for (int32 index = 0; index < BLOCK_SIZE; index++) {
+					block[index].next_ = free_;
+					free_ = &block[index];
+				}
+				allocated_ += BLOCK_SIZE;
+				available_ += BLOCK_SIZE;
+			}
+
+			PacketBuffer* buffer = free_;
+			free_ = buffer->next_;
+			available_--;
+
+			buffer->next_ = nullptr;
+			buffer->length_ = 0;
+			buffer->references_.store(1, std::memory_order_relaxed);
+			return buffer;
+		}
+
+		void PacketPool::release(PacketBuffer* buffer)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			buffer->next_ = free_;
+			free_ = buffer;
+			available_++;
+		}
+
+		// static
+		PacketHandle PacketHandle::acquire()
+		{
+			PacketHandle handle;
+			handle.buffer_ = PacketPool::get().acquire();
+			return handle;
+		}
+
+		PacketHandle::PacketHandle()
+			: buffer_(nullptr)
+		{
+		}
+
+		PacketHandle::PacketHandle(const PacketHandle& rhs)
+			: buffer_(rhs.buffer_)
+		{
+			if (buffer_) {
+				buffer_->references_.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		PacketHandle::PacketHandle(PacketHandle&& rhs)
+			: buffer_(rhs.buffer_)
+		{
+			rhs.buffer_ = nullptr;
+		}
+
+		PacketHandle::~PacketHandle()
+		{
+			reset();
+		}
+
+		PacketHandle& PacketHandle::operator=(const PacketHandle& rhs)
+		{
+			if (buffer_ != rhs.buffer_) {
+				reset();
+				buffer_ = rhs.buffer_;
+				if (buffer_) {
+					buffer_->references_.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+			return *this;
+		}
+
+		PacketHandle& PacketHandle::operator=(PacketHandle&& rhs)
+		{
+			if (this != &rhs) {
+				reset();
+				buffer_ = rhs.buffer_;
+				rhs.buffer_ = nullptr;
+			}
+			return *this;
+		}
+
+		bool PacketHandle::is_valid() const
+		{
+			return buffer_ != nullptr;
+		}
+
+		bool PacketHandle::is_unique() const
+		{
+			return buffer_ && buffer_->references_.load(std::memory_order_acquire) == 1;
+		}
+
+		uint8* PacketHandle::data() const
+		{
+			return buffer_->data_;
+		}
+
+		int32 PacketHandle::length() const
+		{
+			return buffer_->length_;
+		}
+
+		int32 PacketHandle::capacity() const
+		{
+			return PacketBuffer::CAPACITY;
+		}
+
+		void PacketHandle::set_length(const int32 length)
+		{
+			assert(length >= 0 && length <= PacketBuffer::CAPACITY);
+			buffer_->length_ = length;
+		}
+
+		void PacketHandle::reset()
+		{
+			if (buffer_) {
+				if (buffer_->references_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					PacketPool::get().release(buffer_);
+				}
+				buffer_ = nullptr;
+			}
+		}
+
 		NetworkStream::NetworkStream()
 			: length_(sizeof(buffer_))
-			, buffer_{}
 		{
 		}
 
@@ -267,36 +776,56 @@ namespace charlie {
 		}
 
 		NetworkStreamWriter::NetworkStreamWriter(NetworkStream& stream)
-			: stream_(stream)
+			: base_(stream.buffer_)
+			, end_(stream.buffer_ + sizeof(stream.buffer_))
+			, length_(&stream.length_)
 			, at_(stream.buffer_)
 		{
 		}
 
+		NetworkStreamWriter::NetworkStreamWriter(PacketHandle& packet)
+			: base_(packet.data())
+			, end_(packet.data() + packet.capacity())
+			, length_(&packet.buffer_->length_)
+			, at_(packet.data())
+		{
+		}
+
+		NetworkStreamWriter::NetworkStreamWriter(uint8* data, const int32 capacity)
+			: base_(data)
+			, end_(data + capacity)
+			, length_(nullptr)
+			, at_(data)
+		{
+		}
+
 		int32 NetworkStreamWriter::length() const
 		{
-			return static_cast<int32>(at_ - data());
+			return static_cast<int32>(at_ - base_);
 		}
 
 		uint8* NetworkStreamWriter::data() const
 		{
-			return stream_.buffer_;
+			return base_;
 		}
 
 		namespace {
 			template <typename T>
 			inline bool can_write(const NetworkStreamWriter& writer, const T& value)
 			{
-				return (writer.at_ - writer.data()) + sizeof(T) <= sizeof(writer.stream_.buffer_);
+				return static_cast<uint64>(writer.end_ - writer.at_) >= sizeof(T);
 			}
 
 			inline bool can_write_bytes(const NetworkStreamWriter& writer, const uint64 length)
 			{
-				return (writer.at_ - writer.data()) + length <= sizeof(writer.stream_.buffer_);
+				return static_cast<uint64>(writer.end_ - writer.at_) >= length;
 			}
 
 			inline void update_base_stream_length(NetworkStreamWriter& writer)
 			{
-				writer.stream_.length_ = writer.length();
+				if (writer.length_) {
+					*writer.length_ = writer.length();
+				}
 			}
 		} // !anon
 
@@ -441,12 +970,70 @@ namespace charlie {
 			return true;
 		}
 
+		namespace {
+			// note: float ranges are split into steps of the given precision,
+			//       values outside the range are clamped to its ends
+			uint32 quantize_steps(const float min, const float max, const float precision)
+			{
+				assert(min < max && precision > 0.0f);
+				return static_cast<uint32>((max - min) / precision + 0.5f);
+			}
+
+			uint32 quantize(const float value, const float min, const float max, const float precision)
+			{
+				const float clamped = value < min ? min : value > max ? max : value;
+				const uint32 steps = quantize_steps(min, max, precision);
+				const uint32 step = static_cast<uint32>((clamped - min) / precision + 0.5f);
+				return step > steps ? steps : step;
+			}
+
+			float dequantize(const uint32 step, const float min, const float max, const float precision)
+			{
+				const float value = min + static_cast<float>(step) * precision;
+				return value > max ? max : value;
+			}
+		} // !anon
+
+		bool NetworkStreamWriter::serialize_range(const uint32 value, const uint32 range)
+		{
+			assert(value <= range);
+			if (range <= 0xff) {
+				return serialize(static_cast<uint8>(value));
+			}
+			else if (range <= 0xffff) {
+				return serialize(static_cast<uint16>(value));
+			}
+
+			return serialize(value);
+		}
+
+		bool NetworkStreamWriter::serialize_float(const float& value, const float min, const float max, const float precision)
+		{
+			return serialize_range(quantize(value, min, max, precision), quantize_steps(min, max, precision));
+		}
+
 		NetworkStreamReader::NetworkStreamReader(const NetworkStream& stream)
-			: stream_(stream)
+			: base_(stream.buffer_)
+			, length_(stream.length_)
 			, at_(stream.buffer_)
 		{
 		}
 
+		NetworkStreamReader::NetworkStreamReader(const PacketHandle& packet)
+			: base_(packet.data())
+			, length_(packet.length())
+			, at_(packet.data())
+			, packet_(packet)
+		{
+		}
+
+		NetworkStreamReader::NetworkStreamReader(const uint8* data, const int32 length)
+			: base_(data)
+			, length_(length)
+			, at_(data)
+		{
+		}
+
 		uint8 NetworkStreamReader::peek() const
 		{
 			return at_[0];
@@ -454,7 +1041,7 @@ namespace charlie {
 
 		int32 NetworkStreamReader::length() const
 		{
-			return static_cast<int32>(stream_.length_);
+			return length_;
 		}
 
 		int32 NetworkStreamReader::position() const
@@ -464,19 +1051,24 @@ namespace charlie {
 
 		const uint8* NetworkStreamReader::data() const
 		{
-			return stream_.buffer_;
+			return base_;
+		}
+
+		const PacketHandle& NetworkStreamReader::packet() const
+		{
+			return packet_;
 		}
 
 		namespace {
 			template <typename T>
 			inline bool can_read(const NetworkStreamReader& reader, const T& value)
 			{
-				return (reader.at_ - reader.data()) + sizeof(T) <= reader.stream_.length_;
+				return (reader.at_ - reader.data()) + sizeof(T) <= static_cast<uint64>(reader.length_);
 			}
 
 			inline bool can_read_bytes(const NetworkStreamReader& reader, const uint64 length)
 			{
-				return (reader.at_ - reader.data()) + length <= reader.stream_.length_;
+				return (reader.at_ - reader.data()) + length <= static_cast<uint64>(reader.length_);
 			}
 		} // !anon
 
@@ -623,460 +1215,2555 @@ namespace charlie {
 			return true;
 		}
 
-		Connection::Connection()
-			: state_(State::Invalid)
-			, key_(0)
-			, challenge_(0)
-			, sequence_(0)
-			, acknowledge_(0)
-			, acknowledge_bits_(0)
-			, rejection_reason_(RejectedReason::REJECT_REASON_UNKNOWN)
-			, disconnect_counter_(0)
-			, listener_(nullptr)
+		bool NetworkStreamReader::serialize_range(uint32& value, const uint32 range)
 		{
+			if (range <= 0xff) {
+				uint8 narrow = 0;
+				if (!serialize(narrow)) {
+					return false;
+				}
+				value = narrow;
+			}
+			else if (range <= 0xffff) {
+				uint16 narrow = 0;
+				if (!serialize(narrow)) {
+					return false;
+				}
+				value = narrow;
+			}
+			else if (!serialize(value)) {
+				return false;
+			}
+
+			return value <= range;
 		}
 
-		bool Connection::is_valid() const
+		bool NetworkStreamReader::serialize_float(float& value, const float min, const float max, const float precision)
 		{
-			return state_ != State::Invalid;
+			uint32 step = 0;
+			if (!serialize_range(step, quantize_steps(min, max, precision))) {
+				return false;
+			}
+
+			value = dequantize(step, min, max, precision);
+			return true;
 		}
 
-		bool Connection::is_endpoint(const IPAddress& address) const
+		BitStreamWriter::BitStreamWriter(NetworkStreamWriter& writer)
+			: writer_(writer)
+			, base_(writer.at_)
+			, bytes_(0)
+			, scratch_(0)
+			, scratch_bits_(0)
+			, bits_(0)
 		{
-			return address_ == address;
 		}
 
-		bool Connection::is_connected() const
+		int32 BitStreamWriter::bits() const
 		{
-			return state_ == State::Connected;
+			return bits_;
 		}
 
-		bool Connection::is_disconnected() const
+		int32 BitStreamWriter::length() const
 		{
-			return state_ == State::Disconnected;
+			return static_cast<int32>(base_ - writer_.base_) + bytes_ + (scratch_bits_ > 0 ? 1 : 0);
 		}
 
-		bool Connection::is_requesting() const
+		bool BitStreamWriter::flush()
 		{
-			return state_ == State::SendingRequest;
+			if (scratch_bits_ > 0) {
+				if (base_ + bytes_ >= writer_.end_) {
+					return false;
+				}
+
+				base_[bytes_++] = static_cast<uint8>(scratch_ << (8 - scratch_bits_));
+				scratch_ = 0;
+				scratch_bits_ = 0;
+			}
+
+			writer_.at_ = base_ + bytes_;
+			update_base_stream_length(writer_);
+
+			base_ = writer_.at_;
+			bytes_ = 0;
+			return true;
 		}
 
-		bool Connection::is_responding() const
+		bool BitStreamWriter::serialize_bits(const uint32 value, const int32 count)
 		{
-			return state_ == State::SendingResponse;
+			assert(count >= 0 && count <= 32);
+			assert(count == 32 || (value >> count) == 0);
+
+			// note: whole bytes must fit before anything is committed
+			if (base_ + bytes_ + (scratch_bits_ + count) / 8 > writer_.end_) {
+				return false;
+			}
+
+			scratch_ = (scratch_ << count) | value;
+			scratch_bits_ += count;
+			bits_ += count;
+			while (scratch_bits_ >= 8) {
+				scratch_bits_ -= 8;
+				base_[bytes_++] = static_cast<uint8>(scratch_ >> scratch_bits_);
+			}
+			scratch_ &= (1ull << scratch_bits_) - 1;
+
+			return true;
 		}
 
-		bool Connection::is_challenging() const
+		bool BitStreamWriter::serialize_range(const uint32 value, const uint32 range)
 		{
-			return state_ == State::SendingChallenge;
+			assert(value <= range);
+			return serialize_bits(value, bits_required(range));
 		}
 
-		bool Connection::is_disconnecting() const
+		bool BitStreamWriter::serialize_float(const float& value, const float min, const float max, const float precision)
 		{
-			return state_ == State::Disconnecting;
+			return serialize_range(quantize(value, min, max, precision), quantize_steps(min, max, precision));
 		}
 
-		bool Connection::has_timedout(const Time& time) const
+		bool BitStreamWriter::serialize(const float& value)
 		{
-			// todo: replace hard coded timeout limit
-			return (time - last_received_time_) >= Time(300.0);
+			union {
+				float  f_;
+				uint32 u_;
+			} data = { value };
+			return serialize_bits(data.u_, 32);
 		}
 
-		Time Connection::latency() const
+		bool BitStreamWriter::serialize(const double& value)
 		{
-			return round_trip_time_ / 2;
+			union {
+				double f_;
+				uint64 u_;
+			} data = { value };
+			return serialize(data.u_);
+		}
+
+		bool BitStreamWriter::serialize(const uint8& value)
+		{
+			return serialize_bits(value, 8);
+		}
+
+		bool BitStreamWriter::serialize(const int8& value)
+		{
+			return serialize_bits(static_cast<uint8>(value), 8);
+		}
+
+		bool BitStreamWriter::serialize(const uint16& value)
+		{
+			return serialize_bits(value, 16);
+		}
+
+		bool BitStreamWriter::serialize(const int16& value)
+		{
+			return serialize_bits(static_cast<uint16>(value), 16);
+		}
+
+		bool BitStreamWriter::serialize(const uint32& value)
+		{
+			return serialize_bits(value, 32);
+		}
+
+		bool BitStreamWriter::serialize(const int32& value)
+		{
+			return serialize_bits(static_cast<uint32>(value), 32);
+		}
+
+		bool BitStreamWriter::serialize(const uint64& value)
+		{
+			bool result = true;
+			result &= serialize_bits(static_cast<uint32>(value >> 32), 32);
+			result &= serialize_bits(static_cast<uint32>(value), 32);
+			return result;
+		}
+
+		bool BitStreamWriter::serialize(const int64& value)
+		{
+			return serialize(static_cast<uint64>(value));
+		}
+
+		bool BitStreamWriter::serialize(const uint64 length, const uint8* values)
+		{
+			for (uint64 index = 0; index < length; index++) {
+				if (!serialize_bits(values[index], 8)) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		bool BitStreamWriter::serialize(const uint64 length, const char* values)
+		{
+			return serialize(length, reinterpret_cast<const uint8*>(values));
+		}
+
+		bool BitStreamWriter::serialize(const bool& value)
+		{
+			return serialize_bits(value ? 1 : 0, 1);
+		}
+
+		BitStreamReader::BitStreamReader(const NetworkStreamReader& reader)
+			: base_(reader.at_)
+			, length_(reader.length() - reader.position())
+			, at_(0)
+		{
+		}
+
+		BitStreamReader::BitStreamReader(const uint8* data, const int32 length)
+			: base_(data)
+			, length_(length)
+			, at_(0)
+		{
+		}
+
+		uint8 BitStreamReader::peek() const
+		{
+			BitStreamReader reader(*this);
+			uint32 value = 0;
+			reader.serialize_bits(value, 8);
+			return static_cast<uint8>(value);
+		}
+
+		int32 BitStreamReader::bits_remaining() const
+		{
+			return length_ * 8 - at_;
+		}
+
+		bool BitStreamReader::serialize_bits(uint32& value, const int32 count)
+		{
+			assert(count >= 0 && count <= 32);
+			if (count > bits_remaining()) {
+				return false;
+			}
+
+			uint32 result = 0;
+			int32 remaining = count;
+			while (remaining > 0) {
+				const int32 available = 8 - (at_ & 7);
+				const int32 take = remaining < available ? remaining : available;
+				const uint32 byte = base_[at_ >> 3];
+				result = (result << take) | ((byte >> (available - take)) & ((1u << take) - 1));
+				at_ += take;
+				remaining -= take;
+			}
+
+			value = result;
+			return true;
+		}
+
+		bool BitStreamReader::serialize_range(uint32& value, const uint32 range)
+		{
+			if (!serialize_bits(value, bits_required(range))) {
+				return false;
+			}
+
+			return value <= range;
+		}
+
+		bool BitStreamReader::serialize_float(float& value, const float min, const float max, const float precision)
+		{
+			uint32 step = 0;
+			if (!serialize_range(step, quantize_steps(min, max, precision))) {
+				return false;
+			}
+
+			value = dequantize(step, min, max, precision);
+			return true;
+		}
+
+		bool BitStreamReader::serialize(float& value)
+		{
+			union {
+				float  f_;
+				uint32 u_;
+			} data = {};
+
+			if (!serialize_bits(data.u_, 32)) {
+				return false;
+			}
+
+			value = data.f_;
+			return true;
+		}
+
+		bool BitStreamReader::serialize(double& value)
+		{
+			union {
+				double f_;
+				uint64 u_;
+			} data = {};
+
+			if (!serialize(data.u_)) {
+				return false;
+			}
+
+			value = data.f_;
+			return true;
+		}
+
+		bool BitStreamReader::serialize(uint8& value)
+		{
+			uint32 bits = 0;
+			if (!serialize_bits(bits, 8)) { return false; }
+			value = static_cast<uint8>(bits);
+			return true;
+		}
+
+		bool BitStreamReader::serialize(int8& value)
+		{
+			uint32 bits = 0;
+			if (!serialize_bits(bits, 8)) { return false; }
+			value = static_cast<int8>(bits);
+			return true;
+		}
+
+		bool BitStreamReader::serialize(uint16& value)
+		{
+			uint32 bits = 0;
+			if (!serialize_bits(bits, 16)) { return false; }
+			value = static_cast<uint16>(bits);
+			return true;
+		}
+
+		bool BitStreamReader::serialize(int16& value)
+		{
+			uint32 bits = 0;
+			if (!serialize_bits(bits, 16)) { return false; }
+			value = static_cast<int16>(bits);
+			return true;
+		}
+
+		bool BitStreamReader::serialize(uint32& value)
+		{
+			return serialize_bits(value, 32);
+		}
+
+		bool BitStreamReader::serialize(int32& value)
+		{
+			uint32 bits = 0;
+			if (!serialize_bits(bits, 32)) { return false; }
+			value = static_cast<int32>(bits);
+			return true;
+		}
+
+		bool BitStreamReader::serialize(uint64& value)
+		{
+			uint32 high = 0;
+			uint32 low = 0;
+			if (!serialize_bits(high, 32) || !serialize_bits(low, 32)) {
+				return false;
+			}
+
+			value = (static_cast<uint64>(high) << 32) | low;
+			return true;
+		}
+
+		bool BitStreamReader::serialize(int64& value)
+		{
+			uint64 bits = 0;
+			if (!serialize(bits)) { return false; }
+			value = static_cast<int64>(bits);
+			return true;
+		}
+
+		bool BitStreamReader::serialize(const uint64 length, uint8* values)
+		{
+			if (length * 8 > static_cast<uint64>(bits_remaining())) {
+				return false;
+			}
+
+			for (uint64 index = 0; index < length; index++) {
+				uint32 bits = 0;
+				serialize_bits(bits, 8);
+				values[index] = static_cast<uint8>(bits);
+			}
+
+			return true;
+		}
+
+		bool BitStreamReader::serialize(const uint64 length, char* values)
+		{
+			return serialize(length, reinterpret_cast<uint8*>(values));
+		}
+
+		bool BitStreamReader::serialize(bool& value)
+		{
+			uint32 bits = 0;
+			if (!serialize_bits(bits, 1)) { return false; }
+			value = bits != 0;
+			return true;
+		}
+
+		// static
+		int32 ConnectionStats::round_trip_bucket(const Time& round_trip)
+		{
+			static const int64 limits[ROUND_TRIP_BUCKET_COUNT - 1] = { 25000, 50000, 100000, 150000, 200000, 300000, 500000 };
+
+			int32 bucket = 0;
+			while (bucket < ROUND_TRIP_BUCKET_COUNT - 1 && round_trip.as_ticks() >= limits[bucket]) {
+				bucket++;
+			}
+
+			return bucket;
+		}
+
+		ConnectionStats::ConnectionStats()
+		{
+			reset();
+		}
+
+		void ConnectionStats::reset()
+		{
+			packets_sent_ = 0;
+			packets_received_ = 0;
+			bytes_sent_ = 0;
+			bytes_received_ = 0;
+			packets_acked_ = 0;
+			packets_lost_ = 0;
+			messages_resent_ = 0;
+			fragments_resent_ = 0;
+			loss_ = 0.0f;
+			round_trip_samples_ = 0;
+			for (uint32& count : round_trip_histogram_) {
+				count = 0;
+			}
+		}
+
+		void ConnectionStats::add_round_trip_sample(const Time& round_trip)
+		{
+			// note: halving every bucket once a window is full keeps the shape
+			//       of the recent samples without a ring of them
+			if (round_trip_samples_ >= ROUND_TRIP_WINDOW) {
+				round_trip_samples_ = 0;
+				for (uint32& count : round_trip_histogram_) {
+					count /= 2;
+					round_trip_samples_ += count;
+				}
+			}
+
+			round_trip_histogram_[round_trip_bucket(round_trip)]++;
+			round_trip_samples_++;
+		}
+
+		void ConnectionStats::add_delivery(const bool lost)
+		{
+			if (lost) {
+				packets_lost_++;
+			}
+			else {
+				packets_acked_++;
+			}
+
+			loss_ += ((lost ? 1.0f : 0.0f) - loss_) * LOSS_WEIGHT;
+		}
+
+		ConnectionInfo::ConnectionInfo()
+			: id_(0)
+			, payload_budget_(0)
+			, reliable_queue_(0)
+			, pending_messages_(0)
+		{
+		}
+
+		const int32 Connection::MAX_MESSAGE_SIZE = FRAGMENT_SIZE * MAX_FRAGMENT_COUNT;
+
+		Connection::Connection()
+			: service_(nullptr)
+			, timer_epoch_(0)
+			, in_pending_list_(false)
+			, in_established_list_(false)
+			, state_(State::Invalid)
+			, id_(0)
+			, key_(0)
+			, challenge_(0)
+			, sequence_(0)
+			, acknowledge_(0)
+			, acknowledge_bits_(0)
+			, has_received_(false)
+			, sent_packets_{}
+			, rejection_reason_(RejectedReason::REJECT_REASON_UNKNOWN)
+			, disconnect_counter_(0)
+			, has_round_trip_sample_(false)
+			, round_trip_sequence_(0)
+			, listener_(nullptr)
+			, next_message_id_(0)
+			, incoming_message_{}
+			, has_completed_message_(false)
+			, completed_message_id_(0)
+			, fragment_ack_pending_(false)
+			, fragment_ack_message_(0)
+			, fragment_ack_received_{}
+			, fragment_credit_(0)
+		{
+			for (int32 index = 0; index < CHANNEL_COUNT; index++) {
+				channels_[index].channel_ = static_cast<Channel>(index);
+			}
+		}
+
+		bool Connection::is_valid() const
+		{
+			return state_ != State::Invalid;
+		}
+
+		bool Connection::is_endpoint(const IPAddress& address) const
+		{
+			return address_ == address;
+		}
+
+		bool Connection::is_connected() const
+		{
+			return state_ == State::Connected;
+		}
+
+		bool Connection::is_disconnected() const
+		{
+			return state_ == State::Disconnected;
+		}
+
+		bool Connection::is_requesting() const
+		{
+			return state_ == State::SendingRequest;
+		}
+
+		bool Connection::is_responding() const
+		{
+			return state_ == State::SendingResponse;
+		}
+
+		bool Connection::is_challenging() const
+		{
+			return state_ == State::SendingChallenge;
+		}
+
+		bool Connection::is_disconnecting() const
+		{
+			return state_ == State::Disconnecting;
+		}
+
+		bool Connection::has_timedout(const Time& time, const Time& timeout) const
+		{
+			return (time - last_received_time_) >= timeout;
+		}
+
+		Time Connection::latency() const
+		{
+			return smoothed_round_trip_time_ / 2;
+		}
+
+		Time Connection::round_trip_time() const
+		{
+			return round_trip_time_;
+		}
+
+		// note: true when the last received packet measured round_trip_time,
+		//       otherwise it belongs to an older packet
+		bool Connection::has_round_trip_sample() const
+		{
+			return has_round_trip_sample_ && has_received_ && round_trip_sequence_ == acknowledge_;
+		}
+
+		Time Connection::smoothed_round_trip_time() const
+		{
+			return smoothed_round_trip_time_;
+		}
+
+		Time Connection::round_trip_variance() const
+		{
+			return round_trip_variance_;
+		}
+
+		void Connection::connect(const IPAddress& address)
+		{
+			assert(g_service);
+			connect(*g_service, address);
+		}
+
+		void Connection::connect(Service& service, const IPAddress& address)
+		{
+			set_state(State::SendingRequest);
+			set_address(address);
+			set_received_time(Time::now());
+			service.add_pending_connection(this);
+		}
+
+		void Connection::disconnect()
+		{
+			set_state(State::Disconnecting);
+			disconnect_counter_ = 5;
+		}
+
+		void Connection::on_rejected(const uint8 reason)
+		{
+			set_state(State::Disconnected);
+			rejection_reason_ = reason;
+		}
+
+		void Connection::on_timedout()
+		{
+			set_state(State::Timedout);
+		}
+
+		void Connection::on_established()
+		{
+			set_state(State::Connected);
+		}
+
+		void Connection::on_disconnected()
+		{
+			set_state(State::Disconnected);
+		}
+
+		void Connection::invalidate()
+		{
+			service_ = nullptr;
+			address_ = {};
+			state_ = State::Invalid;
+			id_ = 0;
+			key_ = 0;
+			challenge_ = 0;
+			sequence_ = 0;
+			acknowledge_ = 0;
+			acknowledge_bits_ = 0;
+			has_received_ = false;
+			for (SentPacket& packet : sent_packets_) {
+				packet.pending_ = false;
+				packet.messages_.clear();
+			}
+			for (MessageChannel& channel : channels_) {
+				channel.reset();
+			}
+			rejection_reason_ = 0;
+			disconnect_counter_ = 5;
+			last_sent_time_ = {};
+			last_received_time_ = {};
+			connection_established_time_ = {};
+			round_trip_time_ = {};
+			has_round_trip_sample_ = false;
+			round_trip_sequence_ = 0;
+			smoothed_round_trip_time_ = {};
+			round_trip_variance_ = {};
+			congestion_.reset();
+			stats_.reset();
+			listener_ = nullptr;
+			outgoing_messages_ = {};
+			next_message_id_ = 0;
+			incoming_message_.active_ = false;
+			incoming_message_.received_[0] = 0;
+			incoming_message_.received_[1] = 0;
+			has_completed_message_ = false;
+			completed_message_id_ = 0;
+			fragment_ack_pending_ = false;
+			fragment_credit_ = 0;
+			fragment_credit_time_ = {};
+		}
+
+		void Connection::set_state(const State state)
+		{
+			// todo: from state
+			switch (state_) {
+			case State::Invalid: break;
+			default: break;
+			}
+
+			// todo: to state
+			switch (state) {
+			case State::Invalid: break;
+			default: break;
+			}
+
+			state_ = state;
+		}
+
+		void Connection::set_id(const uint16 id)
+		{
+			id_ = id;
+		}
+
+		void Connection::set_address(const IPAddress& address)
+		{
+			address_ = address;
+		}
+
+		void Connection::set_key(const uint64 key)
+		{
+			key_ = key;
+		}
+
+		void Connection::set_challenge(const uint64 challenge)
+		{
+			challenge_ = challenge;
+		}
+
+		void Connection::set_sent_time(const Time& time)
+		{
+			last_sent_time_ = time;
+		}
+
+		void Connection::set_received_time(const Time& time)
+		{
+			last_received_time_ = time;
+		}
+
+		void Connection::set_connected_time(const Time& time)
+		{
+			connection_established_time_ = time;
+		}
+
+		void Connection::set_listener(IConnectionListener* listener)
+		{
+			listener_ = listener;
+		}
+
+		namespace {
+			bool is_sequence_newer(const uint16 a, const uint16 b) {
+				return ((a > b) && ((a - b) <= 0x8000)) ||
+					((a < b) && ((b - a) > 0x8000));
+			}
+
+			bool is_sequence_older(const uint16 a, const uint16 b) {
+				return !is_sequence_newer(b, a);
+			}
+
+			int32 sequence_difference(const uint16 a, const uint16 b)
+			{
+				int32 x = a;
+				int32 y = b;
+				if (abs(x - y) >= 0x8000) {
+					if (x > y) {
+						y += 0x8000;
+					}
+					else {
+						x += 0x8000;
+					}
+				}
+
+				return x - y;
+			}
+		} // !anon
+
+		void Connection::receive(NetworkStreamReader& reader)
+		{
+			stats_.packets_received_++;
+			stats_.bytes_received_ += static_cast<uint64>(reader.length());
+
+			ProtocolDataPacket packet;
+			if (!packet.read(reader)) {
+				assert(!"data packet read failed!");
+				return;
+			}
+
+			// note: ignore old data packets
+			if (has_received_ && is_sequence_older(acknowledge_, packet.sequence_)) {
+				printf("WRN: old sequence - ack: %d seq: %d\n", acknowledge_, packet.sequence_);
+				return;
+			}
+
+			// note: bit 31 is the latest sequence, bit 31 - n is n before it
+			int32 distance = sequence_difference(packet.sequence_, acknowledge_);
+			acknowledge_ = packet.sequence_;
+			if (!has_received_ || distance >= 32) {
+				acknowledge_bits_ = 0;
+			}
+			else {
+				acknowledge_bits_ >>= distance;
+			}
+			acknowledge_bits_ |= (1u << 31);
+			has_received_ = true;
+
+			// note: the peer only acknowledges once it has received something and
+			//       a send time older than the buffer has already been overwritten
+			const uint16 behind = static_cast<uint16>(sequence_ - packet.acknowledge_);
+			if ((packet.ack_bits_ & (1u << 31)) && behind > 0 && behind <= 64) {
+				const Time timestamp = round_trip_buffer_[packet.acknowledge_ % 64];
+				const Time ticks(int64(packet.ticks_));
+				const Time sample = last_received_time_ - timestamp - ticks;
+				if (sample >= Time(int64(0))) {
+					add_round_trip_sample(sample);
+				}
+			}
+
+			//printf("NFO: seq: %d ack: %d (%08X) rtt: %3.3fms [%d,%u]\n",
+			//       sequence_,
+			//       acknowledge_,
+			//       acknowledge_bits_,
+			//       round_trip_time_.as_milliseconds(),
+			//       packet.acknowledge_,
+			//       packet.ticks_);
+
+			process_acknowledges(packet.acknowledge_, packet.ack_bits_);
+
+			if (!read_channels(reader)) {
+				printf("WRN: malformed channel messages - seq: %d\n", packet.sequence_);
+				return;
+			}
+
+			// note: listener read the data
+			if (listener_) {
+				listener_->on_receive(this, reader);
+			}
+		}
+
+		void Connection::send()
+		{
+			const Time now = Time::now();
+			round_trip_buffer_[sequence_ % 64] = now;
+
+			// note: a slot still pending this far back never got an answer
+			SentPacket& sent = sent_packets_[sequence_ % SENT_PACKET_COUNT];
+			if (sent.pending_) {
+				sent.pending_ = false;
+				stats_.add_delivery(true);
+				if (listener_) {
+					listener_->on_lost(this, sent.sequence_);
+				}
+			}
+			sent.pending_ = true;
+			sent.sequence_ = sequence_;
+			sent.messages_.clear();
+			congestion_.sent_count_++;
+
+			PacketHandle stream = PacketHandle::acquire();
+			NetworkStreamWriter writer(stream);
+
+			uint32 ticks = static_cast<uint32>((now - last_received_time_).as_ticks());
+			ProtocolDataPacket packet(id_,
+				sequence_,
+				acknowledge_,
+				acknowledge_bits_,
+				ticks);
+			packet.tag_ = data_tag(sequence_, acknowledge_, acknowledge_bits_, ticks);
+			if (!packet.write(writer)) {
+				assert(!"data packet write failed!");
+			}
+
+			write_channels(writer, sent, now);
+
+			// note: listener pack data
+			if (listener_) {
+				listener_->on_send(this, sequence_, writer);
+			}
+			sequence_++;
+			stats_.packets_sent_++;
+			stats_.bytes_sent_ += static_cast<uint64>(writer.length());
+
+			assert(service_);
+			service_->send_packet(this, stream);
+		}
+
+		void Connection::process_acknowledges(const uint16 acknowledge, const uint32 acknowledge_bits)
+		{
+			// note: the top bits of the window that cover packets we actually
+			//       sent give the loss sample, missing ones never arrived
+			const uint32 behind = static_cast<uint16>(sequence_ - acknowledge);
+			if (behind > 0 && behind <= congestion_.sent_count_) {
+				const uint32 sent_count = congestion_.sent_count_ - behind + 1;
+				const int32 window = sent_count < 32 ? static_cast<int32>(sent_count) : 32;
+				int32 lost = 0;
+				for (int32 bit = 32 - window; bit < 32; bit++) {
+					if (!(acknowledge_bits & (1u << bit))) {
+						lost++;
+					}
+				}
+				congestion_.add_loss_sample(lost, window);
+			}
+
+			// note: oldest first so listeners see sequences in order
+			for (int32 bit = 0; bit < 32; bit++) {
+				if (!(acknowledge_bits & (1u << bit))) {
+					continue;
+				}
+
+				const uint16 sequence = static_cast<uint16>(acknowledge - (31 - bit));
+				SentPacket& sent = sent_packets_[sequence % SENT_PACKET_COUNT];
+				if (!sent.pending_ || sent.sequence_ != sequence) {
+					continue;
+				}
+
+				sent.pending_ = false;
+				stats_.add_delivery(false);
+				for (const SentPacket::Message& message : sent.messages_) {
+					channels_[message.channel_].acknowledge(message.id_);
+				}
+				sent.messages_.clear();
+
+				if (listener_) {
+					listener_->on_acknowledge(this, sequence);
+				}
+			}
+
+			// note: anything still pending behind the ack window is lost,
+			//       its reliable messages go out again after resend_time()
+			for (SentPacket& sent : sent_packets_) {
+				if (!sent.pending_) {
+					continue;
+				}
+
+				if (is_sequence_newer(sent.sequence_, acknowledge) || sequence_difference(acknowledge, sent.sequence_) < 32) {
+					continue;
+				}
+
+				sent.pending_ = false;
+				sent.messages_.clear();
+				stats_.add_delivery(true);
+				if (listener_) {
+					listener_->on_lost(this, sent.sequence_);
+				}
+			}
+		}
+
+		Time Connection::send_interval() const
+		{
+			return congestion_.send_interval();
+		}
+
+		int32 Connection::payload_budget() const
+		{
+			return congestion_.payload_budget();
+		}
+
+		// note: srtt and rttvar as in rfc 6298, the first sample seeds the
+		//       average and half of it the variance, later ones move them by
+		//       1/8 and 1/4 of the difference
+		void Connection::add_round_trip_sample(const Time& sample)
+		{
+			// note: only called while receiving, acknowledge_ is that packet
+			round_trip_time_ = sample;
+			has_round_trip_sample_ = true;
+			round_trip_sequence_ = acknowledge_;
+			congestion_.add_round_trip_sample(sample);
+			stats_.add_round_trip_sample(sample);
+
+			if (smoothed_round_trip_time_ == Time(int64(0))) {
+				smoothed_round_trip_time_ = sample;
+				round_trip_variance_ = sample / 2;
+				return;
+			}
+
+			const int64 difference = smoothed_round_trip_time_.as_ticks() - sample.as_ticks();
+			const int64 deviation = difference < 0 ? -difference : difference;
+			round_trip_variance_ = Time(round_trip_variance_.as_ticks() + (deviation - round_trip_variance_.as_ticks()) / 4);
+			smoothed_round_trip_time_ = Time(smoothed_round_trip_time_.as_ticks() + (sample.as_ticks() - smoothed_round_trip_time_.as_ticks()) / 8);
+		}
+
+		void Connection::fill_info(ConnectionInfo& info, const Time& time) const
+		{
+			info.id_ = id_;
+			info.address_ = address_;
+			info.connected_time_ = time - connection_established_time_;
+			info.round_trip_time_ = round_trip_time_;
+			info.smoothed_round_trip_time_ = smoothed_round_trip_time_;
+			info.round_trip_variance_ = round_trip_variance_;
+			info.send_interval_ = send_interval();
+			info.payload_budget_ = payload_budget();
+			info.reliable_queue_ = 0;
+			for (const MessageChannel& channel : channels_) {
+				if (channel.is_reliable()) {
+					info.reliable_queue_ += static_cast<uint16>(channel.send_id_ - channel.send_base_);
+				}
+			}
+			info.pending_messages_ = static_cast<int32>(outgoing_messages_.size());
+			info.stats_ = stats_;
+		}
+
+		// note: four deviations above the average, but never less than a
+		//       quarter of it since a steady link drives the variance to zero
+		Time Connection::resend_time() const
+		{
+			const Time margin = Time(round_trip_variance_.as_ticks() * 4);
+			const Time floor = smoothed_round_trip_time_ / 4;
+			const Time resend = smoothed_round_trip_time_ + (margin > floor ? margin : floor);
+			if (resend < Time(MIN_RESEND_TIME)) {
+				return Time(MIN_RESEND_TIME);
+			}
+
+			return resend;
+		}
+
+		CongestionControl::CongestionControl()
+			: min_interval_(1.0 / 10)
+			, max_interval_(1.0 / 10)
+			, min_budget_(PacketBuffer::CAPACITY)
+			, max_budget_(PacketBuffer::CAPACITY)
+			, sent_count_(0)
+			, level_(0.5f)
+			, loss_(0.0f)
+			, round_trip_(0.0f)
+			, base_round_trip_(0.0f)
+			, window_round_trip_(0.0f)
+		{
+		}
+
+		void CongestionControl::reset()
+		{
+			sent_count_ = 0;
+			level_ = 0.5f;
+			loss_ = 0.0f;
+			round_trip_ = 0.0f;
+			base_round_trip_ = 0.0f;
+			window_round_trip_ = 0.0f;
+			last_update_time_ = {};
+			base_time_ = {};
+		}
+
+		void CongestionControl::set_bounds(const Time& min_interval, const Time& max_interval, const int32 min_budget, const int32 max_budget)
+		{
+			assert(min_interval <= max_interval);
+			assert(min_budget <= max_budget && max_budget <= PacketBuffer::CAPACITY);
+			min_interval_ = min_interval;
+			max_interval_ = max_interval;
+			min_budget_ = min_budget;
+			max_budget_ = max_budget;
+		}
+
+		void CongestionControl::add_loss_sample(const int32 lost, const int32 count)
+		{
+			const float sample = static_cast<float>(lost) / static_cast<float>(count);
+			loss_ += (sample - loss_) * 0.125f;
+		}
+
+		void CongestionControl::add_round_trip_sample(const Time& round_trip)
+		{
+			// note: skip samples before the peer acknowledged anything real
+			const float sample = round_trip.as_milliseconds();
+			if (sample <= 0.0f || sample > 5000.0f) {
+				return;
+			}
+
+			if (round_trip_ <= 0.0f) {
+				round_trip_ = sample;
+			}
+			else {
+				round_trip_ += (sample - round_trip_) * 0.125f;
+			}
+
+			if (base_round_trip_ <= 0.0f || sample < base_round_trip_) {
+				base_round_trip_ = sample;
+			}
+			if (window_round_trip_ <= 0.0f || sample < window_round_trip_) {
+				window_round_trip_ = sample;
+			}
+		}
+
+		void CongestionControl::update(const Time& time)
+		{
+			if ((time - last_update_time_) < Time(UPDATE_TIME)) {
+				return;
+			}
+			last_update_time_ = time;
+
+			if (is_congested()) {
+				level_ += (1.0f - level_) * 0.5f;
+			}
+			else {
+				level_ -= RECOVERY_STEP;
+				if (level_ < 0.0f) {
+					level_ = 0.0f;
+				}
+			}
+
+			// note: the base round trip follows route changes, so it is
+			//       restarted from the lowest sample of the last period
+			if ((time - base_time_) >= Time(BASELINE_TIME)) {
+				base_time_ = time;
+				base_round_trip_ = window_round_trip_;
+				window_round_trip_ = 0.0f;
+			}
+		}
+
+		bool CongestionControl::is_congested() const
+		{
+			if (loss_ > LOSS_THRESHOLD) {
+				return true;
+			}
+
+			if (base_round_trip_ <= 0.0f) {
+				return false;
+			}
+
+			return round_trip_ > base_round_trip_ * ROUND_TRIP_GROWTH + ROUND_TRIP_SLACK;
+		}
+
+		Time CongestionControl::send_interval() const
+		{
+			const float range = (max_interval_ - min_interval_).as_seconds();
+			return min_interval_ + Time(static_cast<double>(range * level_));
+		}
+
+		int32 CongestionControl::payload_budget() const
+		{
+			const float range = static_cast<float>(max_budget_ - min_budget_);
+			return max_budget_ - static_cast<int32>(range * level_);
+		}
+
+		MessageChannel::MessageChannel()
+			: channel_(CHANNEL_UNRELIABLE)
+			, send_id_(0)
+			, send_base_(0)
+			, receive_base_(0)
+		{
+		}
+
+		bool MessageChannel::is_reliable() const
+		{
+			return channel_ != CHANNEL_UNRELIABLE;
+		}
+
+		void MessageChannel::reset()
+		{
+			send_id_ = 0;
+			send_base_ = 0;
+			receive_base_ = 0;
+			send_entries_.clear();
+			receive_entries_.clear();
+			unreliable_.clear();
+		}
+
+		bool MessageChannel::queue(const uint8* data, const int32 length)
+		{
+			if (length <= 0 || length > MAX_MESSAGE_SIZE) {
+				printf("WRN: channel message of %d bytes is too large!\n", length);
+				return false;
+			}
+
+			// note: unreliable data goes stale, when the budget cannot keep up
+			//       the oldest message makes room for the newest one
+			if (!is_reliable()) {
+				if (unreliable_.size() >= static_cast<size_t>(WINDOW_SIZE)) {
+					unreliable_.erase(unreliable_.begin());
+				}
+				unreliable_.emplace_back(data, data + length);
+				return true;
+			}
+
+			if (static_cast<uint16>(send_id_ - send_base_) >= WINDOW_SIZE) {
+				printf("WRN: channel %d send window is full!\n", channel_);
+				return false;
+			}
+
+			if (send_entries_.empty()) {
+				send_entries_.resize(WINDOW_SIZE);
+			}
+
+			Entry& entry = send_entries_[send_id_ % WINDOW_SIZE];
+			entry.valid_ = true;
+			entry.sent_ = false;
+			entry.id_ = send_id_;
+			entry.sent_time_ = {};
+			entry.data_.assign(data, data + length);
+			send_id_++;
+
+			return true;
+		}
+
+		void MessageChannel::acknowledge(const uint16 id)
+		{
+			if (send_entries_.empty()) {
+				return;
+			}
+
+			Entry& entry = send_entries_[id % WINDOW_SIZE];
+			if (!entry.valid_ || entry.id_ != id) {
+				return;
+			}
+
+			entry.valid_ = false;
+			entry.data_.clear();
+			while (send_base_ != send_id_ && !send_entries_[send_base_ % WINDOW_SIZE].valid_) {
+				send_base_++;
+			}
+		}
+
+		bool Connection::queue_message(const Channel channel, const uint8* data, const int32 length)
+		{
+			assert(channel >= 0 && channel < CHANNEL_COUNT);
+			return channels_[channel].queue(data, length);
+		}
+
+		void Connection::write_channels(NetworkStreamWriter& writer, SentPacket& packet, const Time& time)
+		{
+			struct Pick {
+				MessageChannel* channel_;
+				MessageChannel::Entry* entry_;
+				const DynamicArray<uint8>* data_;
+			};
+
+			// note: pick what fits the budget first, the count goes ahead of it
+			Pick picks[255];
+			int32 pick_count = 0;
+			int32 budget = CHANNEL_PACKET_BUDGET;
+			const int32 remaining = payload_budget() - writer.length() - 1;
+			if (remaining < budget) {
+				budget = remaining;
+			}
+			const int32 header_size = 5;
+			const Time resend = resend_time();
+			for (MessageChannel& channel : channels_) {
+				if (!channel.is_reliable()) {
+					for (const DynamicArray<uint8>& data : channel.unreliable_) {
+						const int32 size = header_size + static_cast<int32>(data.size());
+						if (pick_count == 255 || size > budget) {
+							break;
+						}
+
+						picks[pick_count++] = { &channel, nullptr, &data };
+						budget -= size;
+					}
+					continue;
+				}
+
+				for (uint16 id = channel.send_base_; id != channel.send_id_; id++) {
+					MessageChannel::Entry& entry = channel.send_entries_[id % MessageChannel::WINDOW_SIZE];
+					if (!entry.valid_ || (entry.sent_ && (time - entry.sent_time_) < resend)) {
+						continue;
+					}
+
+					const int32 size = header_size + static_cast<int32>(entry.data_.size());
+					if (pick_count == 255 || size > budget) {
+						break;
+					}
+
+					picks[pick_count++] = { &channel, &entry, &entry.data_ };
+					budget -= size;
+				}
+			}
+
+			bool result = writer.serialize(static_cast<uint8>(pick_count));
+			int32 unreliable_sent = 0;
+			for (int32 index = 0; index < pick_count; index++) {
+				const Pick& pick = picks[index];
+				const uint16 id = pick.entry_ ? pick.entry_->id_ : 0;
+				ProtocolChannelMessage header(static_cast<uint8>(pick.channel_->channel_),
+					id,
+					static_cast<uint16>(pick.data_->size()));
+				result &= header.write(writer);
+				result &= writer.serialize(static_cast<uint64>(pick.data_->size()), pick.data_->data());
+
+				if (pick.entry_) {
+					if (pick.entry_->sent_) {
+						stats_.messages_resent_++;
+					}
+					pick.entry_->sent_ = true;
+					pick.entry_->sent_time_ = time;
+					packet.messages_.push_back({ static_cast<uint8>(pick.channel_->channel_), id });
+				}
+				else {
+					unreliable_sent++;
+				}
+			}
+
+			if (!result) {
+				assert(!"channel messages write failed!");
+			}
+
+			// note: unreliable messages get one chance, only ones that did not
+			//       fit wait for the next packet
+			DynamicArray<DynamicArray<uint8>>& unreliable = channels_[CHANNEL_UNRELIABLE].unreliable_;
+			unreliable.erase(unreliable.begin(), unreliable.begin() + unreliable_sent);
+		}
+
+		bool Connection::read_channels(NetworkStreamReader& reader)
+		{
+			uint8 count = 0;
+			if (!reader.serialize(count)) {
+				return false;
+			}
+
+			for (int32 index = 0; index < count; index++) {
+				ProtocolChannelMessage header;
+				if (!header.read(reader)) {
+					return false;
+				}
+
+				if (header.channel_ >= CHANNEL_COUNT ||
+					header.length_ > MessageChannel::MAX_MESSAGE_SIZE ||
+					reader.length() - reader.position() < header.length_)
+				{
+					return false;
+				}
+
+				const uint8* data = reader.at_;
+				reader.at_ += header.length_;
+
+				MessageChannel& channel = channels_[header.channel_];
+				if (!channel.is_reliable()) {
+					deliver_message(channel.channel_, data, header.length_);
+					continue;
+				}
+
+				// note: behind the window was delivered already, beyond it
+				//       can not be sent by a well behaved peer
+				const uint16 offset = static_cast<uint16>(header.id_ - channel.receive_base_);
+				if (offset >= MessageChannel::WINDOW_SIZE) {
+					continue;
+				}
+
+				if (channel.receive_entries_.empty()) {
+					channel.receive_entries_.resize(MessageChannel::WINDOW_SIZE);
+				}
+
+				MessageChannel::Entry& entry = channel.receive_entries_[header.id_ % MessageChannel::WINDOW_SIZE];
+				if (entry.valid_ && entry.id_ == header.id_) {
+					continue;
+				}
+
+				entry.valid_ = true;
+				entry.id_ = header.id_;
+				if (channel.channel_ == CHANNEL_RELIABLE_ORDERED) {
+					entry.data_.assign(data, data + header.length_);
+				}
+				else {
+					deliver_message(channel.channel_, data, header.length_);
+				}
+
+				while (true) {
+					MessageChannel::Entry& next = channel.receive_entries_[channel.receive_base_ % MessageChannel::WINDOW_SIZE];
+					if (!next.valid_ || next.id_ != channel.receive_base_) {
+						break;
+					}
+
+					if (channel.channel_ == CHANNEL_RELIABLE_ORDERED) {
+						deliver_message(channel.channel_, next.data_.data(), static_cast<int32>(next.data_.size()));
+					}
+
+					next.valid_ = false;
+					next.data_.clear();
+					channel.receive_base_++;
+				}
+			}
+
+			return true;
+		}
+
+		void Connection::deliver_message(const Channel channel, const uint8* data, const int32 length)
+		{
+			if (listener_) {
+				NetworkStreamReader reader(data, length);
+				listener_->on_channel_message(this, channel, reader);
+			}
+		}
+
+		namespace {
+			static_assert(MAX_FRAGMENT_COUNT <= 128, "fragment masks hold 128 bits");
+
+			bool is_bit_set(const uint64* mask, const int32 index)
+			{
+				return (mask[index >> 6] & (1ull << (index & 63))) != 0;
+			}
+
+			void set_bit(uint64* mask, const int32 index)
+			{
+				mask[index >> 6] |= (1ull << (index & 63));
+			}
+
+			void fill_bits(uint64* mask, const int32 count)
+			{
+				mask[0] = count >= 64 ? ~0ull : ((1ull << count) - 1);
+				mask[1] = count >= 128 ? ~0ull : count > 64 ? ((1ull << (count - 64)) - 1) : 0;
+			}
+		} // !anon
+
+		bool Connection::send_message(const uint8* data, const int32 length)
+		{
+			if (length <= 0 || length > MAX_MESSAGE_SIZE) {
+				printf("WRN: message of %d bytes can not be fragmented!\n", length);
+				return false;
+			}
+
+			if (static_cast<int32>(outgoing_messages_.size()) >= MAX_PENDING_MESSAGES) {
+				printf("WRN: too many pending messages!\n");
+				return false;
+			}
+
+			OutgoingMessage message;
+			message.id_ = next_message_id_++;
+			message.count_ = (length + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE;
+			message.sent_[0] = message.sent_[1] = 0;
+			message.acked_[0] = message.acked_[1] = 0;
+			message.sent_time_.resize(message.count_);
+			message.data_.assign(data, data + length);
+			outgoing_messages_.push(std::move(message));
+
+			return true;
+		}
+
+		bool Connection::has_pending_messages() const
+		{
+			return !outgoing_messages_.empty();
+		}
+
+		void Connection::receive_fragment(NetworkStreamReader& reader)
+		{
+			stats_.packets_received_++;
+			stats_.bytes_received_ += static_cast<uint64>(reader.length());
+
+			ProtocolFragmentPacket packet;
+			if (!packet.read(reader)) {
+				assert(!"fragment packet read failed!");
+				return;
+			}
+
+			const int32 count = packet.count_;
+			const int32 index = packet.index_;
+			const int32 length = packet.length_;
+			if (count == 0 || count > MAX_FRAGMENT_COUNT || index >= count ||
+				length == 0 || length > FRAGMENT_SIZE ||
+				(index < count - 1 && length != FRAGMENT_SIZE) ||
+				reader.length() - reader.position() < length)
+			{
+				printf("WRN: malformed fragment - msg: %d idx: %d/%d len: %d\n",
+					packet.message_, index, count, length);
+				return;
+			}
+
+			// note: the sender lost our ack for a message we already delivered
+			if (has_completed_message_ && packet.message_ == completed_message_id_) {
+				fragment_ack_pending_ = true;
+				fragment_ack_message_ = completed_message_id_;
+				fill_bits(fragment_ack_received_, count);
+				return;
+			}
+
+			IncomingMessage& message = incoming_message_;
+			if (!message.active_ || packet.message_ != message.id_) {
+				const uint16 latest = message.active_ ? message.id_ : completed_message_id_;
+				if ((message.active_ || has_completed_message_) &&
+					!is_sequence_newer(packet.message_, latest))
+				{
+					return;
+				}
+
+				message.active_ = true;
+				message.id_ = packet.message_;
+				message.count_ = count;
+				message.length_ = 0;
+				message.received_[0] = message.received_[1] = 0;
+				message.data_.resize(FRAGMENT_SIZE * MAX_FRAGMENT_COUNT);
+			}
+
+			if (count != message.count_) {
+				printf("WRN: fragment count mismatch - msg: %d\n", packet.message_);
+				return;
+			}
+
+			if (!is_bit_set(message.received_, index)) {
+				if (!reader.serialize(length, message.data_.data() + index * FRAGMENT_SIZE)) {
+					assert(!"fragment payload read failed!");
+					return;
+				}
+
+				set_bit(message.received_, index);
+				message.length_ += length;
+			}
+
+			fragment_ack_pending_ = true;
+			fragment_ack_message_ = message.id_;
+			fragment_ack_received_[0] = message.received_[0];
+			fragment_ack_received_[1] = message.received_[1];
+
+			uint64 complete[2];
+			fill_bits(complete, message.count_);
+			if (message.received_[0] != complete[0] || message.received_[1] != complete[1]) {
+				return;
+			}
+
+			message.active_ = false;
+			has_completed_message_ = true;
+			completed_message_id_ = message.id_;
+
+			// note: listener read the reassembled message
+			if (listener_) {
+				NetworkStreamReader message_reader(message.data_.data(), message.length_);
+				listener_->on_receive_message(this, message_reader);
+			}
+		}
+
+		void Connection::receive_fragment_ack(NetworkStreamReader& reader)
+		{
+			stats_.packets_received_++;
+			stats_.bytes_received_ += static_cast<uint64>(reader.length());
+
+			ProtocolFragmentAckPacket packet;
+			if (!packet.read(reader)) {
+				assert(!"fragment ack packet read failed!");
+				return;
+			}
+
+			if (outgoing_messages_.empty()) {
+				return;
+			}
+
+			OutgoingMessage& message = outgoing_messages_.front();
+			if (message.id_ != packet.message_) {
+				return;
+			}
+
+			message.acked_[0] |= packet.received_[0];
+			message.acked_[1] |= packet.received_[1];
+
+			uint64 complete[2];
+			fill_bits(complete, message.count_);
+			if ((message.acked_[0] & complete[0]) == complete[0] &&
+				(message.acked_[1] & complete[1]) == complete[1])
+			{
+				outgoing_messages_.pop();
+			}
+		}
+
+		void Connection::update_fragments(const Time& time)
+		{
+			// note: fragments go straight to the address so they do not push
+			//       back the regular data packet that carries the acks
+			assert(service_);
+
+			if (fragment_ack_pending_) {
+				fragment_ack_pending_ = false;
+
+				PacketHandle stream = PacketHandle::acquire();
+				NetworkStreamWriter writer(stream);
+				ProtocolFragmentAckPacket packet(id_,
+					fragment_ack_message_,
+					fragment_ack_received_[0],
+					fragment_ack_received_[1]);
+				if (!packet.write(writer)) {
+					assert(!"fragment ack packet write failed!");
+				}
+
+				stats_.packets_sent_++;
+				stats_.bytes_sent_ += static_cast<uint64>(writer.length());
+				service_->send_packet(address_, stream);
+			}
+
+			if (outgoing_messages_.empty()) {
+				return;
+			}
+
+			// note: fragments are paced like data packets, every send interval
+			//       adds one payload budget of credit, a fragment may overdraw
+			//       it so budgets below the fragment size still make progress
+			//       and the deficit is paid back by the following intervals
+			if ((time - fragment_credit_time_) >= send_interval()) {
+				fragment_credit_time_ = time;
+				fragment_credit_ = std::min(fragment_credit_ + payload_budget(), payload_budget());
+			}
+
+			// note: only the front message is in flight, unsent fragments go
+			//       first and unacknowledged ones are resent after resend_time()
+			const Time resend = resend_time();
+
+			OutgoingMessage& message = outgoing_messages_.front();
+			const int32 length = static_cast<int32>(message.data_.size());
+			int32 budget = FRAGMENTS_PER_UPDATE;
+			for (int32 pass = 0; pass < 2 && budget > 0 && fragment_credit_ > 0; pass++) {
+				for (int32 index = 0; index < message.count_ && budget > 0 && fragment_credit_ > 0; index++) {
+					if (is_bit_set(message.acked_, index)) {
+						continue;
+					}
+
+					const bool sent = is_bit_set(message.sent_, index);
+					if (pass == 0 ? sent : (!sent || (time - message.sent_time_[index]) < resend)) {
+						continue;
+					}
+
+					const int32 offset = index * FRAGMENT_SIZE;
+					const int32 fragment_length = length - offset < FRAGMENT_SIZE ? length - offset : FRAGMENT_SIZE;
+
+					PacketHandle stream = PacketHandle::acquire();
+					NetworkStreamWriter writer(stream);
+					ProtocolFragmentPacket packet(id_,
+						message.id_,
+						static_cast<uint8>(index),
+						static_cast<uint8>(message.count_),
+						static_cast<uint16>(fragment_length));
+					if (!packet.write(writer) ||
+						!writer.serialize(static_cast<uint64>(fragment_length), message.data_.data() + offset))
+					{
+						assert(!"fragment packet write failed!");
+					}
+
+					if (sent) {
+						stats_.fragments_resent_++;
+					}
+					stats_.packets_sent_++;
+					stats_.bytes_sent_ += static_cast<uint64>(writer.length());
+
+					fragment_credit_ -= writer.length();
+					service_->send_packet(address_, stream);
+					set_bit(message.sent_, index);
+					message.sent_time_[index] = time;
+					budget--;
+				}
+			}
+		}
+
+		// static
+		int32 ConnectionPool::index_of(const uint16 id)
+		{
+			return id & INDEX_MASK;
+		}
+
+		ConnectionPool::ConnectionPool(const int32 capacity)
+			: capacity_(capacity)
+			, connection_count_(0)
+			, connections_(new Connection[capacity])
+			, generations_(capacity, 1)
+		{
+			assert(capacity <= INDEX_MASK + 1);
+		}
+
+		ConnectionPool::~ConnectionPool()
+		{
+			delete[] connections_;
+		}
+
+		void ConnectionPool::resize(const int32 capacity)
+		{
+			if (capacity_ < capacity) {
+				assert(capacity <= INDEX_MASK + 1);
+				delete[] connections_;
+				capacity_ = capacity;
+				connection_count_ = 0;
+				connections_ = new Connection[capacity];
+				generations_.assign(capacity, 1);
+			}
 		}
 
-		Time Connection::round_trip_time() const
+		Connection* ConnectionPool::create()
 		{
-			return round_trip_time_;
+			assert(connection_count_ < capacity_);
+			connection_count_++;
+
+			for (int32 index = 0; index < capacity_; index++) {
+				if (!connections_[index].is_valid()) {
+					const uint16 generation = generations_[index];
+					connections_[index].set_state(Connection::State::Disconnected);
+					connections_[index].set_id(static_cast<uint16>((generation << INDEX_BITS) | index));
+					return &connections_[index];
+				}
+			}
+
+			return nullptr;
 		}
 
-		void Connection::connect(const IPAddress& address)
+		Connection* ConnectionPool::find(const uint16 id) const
 		{
-			set_state(State::SendingRequest);
-			set_address(address);
+			const int32 index = index_of(id);
+			if (index >= capacity_) {
+				return nullptr;
+			}
 
-			assert(g_service);
-			g_service->add_pending_connection(this);
+			Connection* connection = &connections_[index];
+			if (!connection->is_valid() || connection->id_ != id) {
+				return nullptr;
+			}
+
+			return connection;
 		}
 
-		void Connection::disconnect()
+		void ConnectionPool::release(Connection* connection)
 		{
-			set_state(State::Disconnecting);
-			disconnect_counter_ = 5;
+			assert(connection >= connections_ && connection <= (connections_ + capacity_));
+			connection->invalidate();
+
+			// note: stale ids of the previous owner no longer match the slot
+			const int32 index = static_cast<int32>(connection - connections_);
+			generations_[index] = static_cast<uint16>(generations_[index] % (GENERATION_COUNT - 1) + 1);
+
+			assert(connection_count_ > 0);
+			connection_count_--;
 		}
 
-		void Connection::on_rejected(const uint8 reason)
+		TimerWheel::TimerWheel()
+			: resolution_(TIMER_RESOLUTION)
+			, current_(0)
+			, count_(0)
 		{
-			set_state(State::Disconnected);
-			rejection_reason_ = reason;
 		}
 
-		void Connection::on_timedout()
+		void TimerWheel::reset(const Time& time, const Time& resolution)
 		{
-			set_state(State::Timedout);
+			for (auto& level : slots_) {
+				for (auto& slot : level) {
+					slot.clear();
+				}
+			}
+
+			resolution_ = resolution;
+			current_ = time.as_ticks() / resolution_.as_ticks();
+			count_ = 0;
 		}
 
-		void Connection::on_established()
+		void TimerWheel::schedule(Connection* connection, const Kind kind, const Time& time)
 		{
-			set_state(State::Connected);
+			// note: the slot for the current tick is already collected
+			Timer timer = { time.as_ticks() / resolution_.as_ticks(), connection, connection->timer_epoch_, kind };
+			if (timer.expires_ <= current_) {
+				timer.expires_ = current_ + 1;
+			}
+
+			insert(timer);
+			count_++;
 		}
 
-		void Connection::on_disconnected()
+		void TimerWheel::advance(const Time& time, DynamicArray<Timer>& expired)
 		{
-			set_state(State::Disconnected);
+			const int64 target = time.as_ticks() / resolution_.as_ticks();
+			while (current_ < target) {
+				current_++;
+
+				// note: higher levels first, they may cascade into a slot of
+				//       a lower level that is due at this very tick
+				int32 top = 0;
+				while (top + 1 < LEVEL_COUNT && (current_ & ((int64(1) << (SLOT_BITS * (top + 1))) - 1)) == 0) {
+					top++;
+				}
+				for (int32 level = top; level > 0; level--) {
+					cascade(level);
+				}
+
+				DynamicArray<Timer>& slot = slots_[0][current_ & (SLOT_COUNT - 1)];
+				expired.insert(expired.end(), slot.begin(), slot.end());
+				count_ -= static_cast<int32>(slot.size());
+				slot.clear();
+			}
 		}
 
-		void Connection::invalidate()
+		void TimerWheel::insert(Timer timer)
 		{
-			address_ = {};
-			state_ = State::Invalid;
-			key_ = 0;
-			challenge_ = 0;
-			sequence_ = 0;
-			acknowledge_ = 0;
-			acknowledge_bits_ = 0;
-			rejection_reason_ = 0;
-			disconnect_counter_ = 5;
-			last_sent_time_ = {};
-			last_received_time_ = {};
-			connection_established_time_ = {};
-			round_trip_time_ = {};
-			listener_ = nullptr;
+			// note: anything beyond the top level waits in its last slot and
+			//       is placed again once it cascades
+			const int64 range = int64(1) << (SLOT_BITS * LEVEL_COUNT);
+			if (timer.expires_ < current_) {
+				timer.expires_ = current_;
+			}
+			if (timer.expires_ - current_ >= range) {
+				timer.expires_ = current_ + range - 1;
+			}
+
+			const int64 delta = timer.expires_ - current_;
+			int32 level = 0;
+			while (level + 1 < LEVEL_COUNT && delta >= (int64(1) << (SLOT_BITS * (level + 1)))) {
+				level++;
+			}
+
+			const int64 slot = (timer.expires_ >> (SLOT_BITS * level)) & (SLOT_COUNT - 1);
+			slots_[level][slot].push_back(timer);
 		}
 
-		void Connection::set_state(const State state)
+		void TimerWheel::cascade(const int32 level)
 		{
-			// todo: from state
-			switch (state_) {
-			case State::Invalid: break;
-			default: break;
+			const int64 slot = (current_ >> (SLOT_BITS * level)) & (SLOT_COUNT - 1);
+			DynamicArray<Timer> timers;
+			timers.swap(slots_[level][slot]);
+			for (const Timer& timer : timers) {
+				insert(timer);
 			}
+		}
 
-			// todo: to state
-			switch (state) {
-			case State::Invalid: break;
-			default: break;
+		int32 TimerWheel::count() const
+		{
+			return count_;
+		}
+
+		namespace {
+			uint64 rotl(const uint64 value, const int32 bits)
+			{
+				return (value << bits) | (value >> (64 - bits));
 			}
 
-			state_ = state;
+			void sip_round(uint64& v0, uint64& v1, uint64& v2, uint64& v3)
+			{
+				v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+				v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+				v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+				v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+			}
+
+			uint64 read_le64(const uint8* data, const int32 length)
+			{
+				uint64 value = 0;
+				for (int32 index = 0; index < length; index++) {
+					value |= static_cast<uint64>(data[index]) << (index * 8);
+				}
+				return value;
+			}
+
+			void write_le(uint8*& dst, const uint64 value, const int32 length)
+			{
+				for (int32 index = 0; index < length; index++) {
+					*dst++ = static_cast<uint8>(value >> (index * 8));
+				}
+			}
+		} // !anon
+
+		uint64 HandshakeCookie::siphash(const uint64 k0, const uint64 k1, const uint8* data, const int32 length)
+		{
+			uint64 v0 = k0 ^ 0x736f6d6570736575ull;
+			uint64 v1 = k1 ^ 0x646f72616e646f6dull;
+			uint64 v2 = k0 ^ 0x6c7967656e657261ull;
+			uint64 v3 = k1 ^ 0x7465646279746573ull;
+
+			const int32 tail = length & 7;
+			const uint8* end = data + (length - tail);
+			for (const uint8* at = data; at != end; at += 8) {
+				const uint64 m = read_le64(at, 8);
+				v3 ^= m;
+				sip_round(v0, v1, v2, v3);
+				sip_round(v0, v1, v2, v3);
+				v0 ^= m;
+			}
+
+			const uint64 b = (static_cast<uint64>(length) << 56) | read_le64(end, tail);
+			v3 ^= b;
+			sip_round(v0, v1, v2, v3);
+			sip_round(v0, v1, v2, v3);
+			v0 ^= b;
+
+			v2 ^= 0xff;
+			sip_round(v0, v1, v2, v3);
+			sip_round(v0, v1, v2, v3);
+			sip_round(v0, v1, v2, v3);
+			sip_round(v0, v1, v2, v3);
+			return v0 ^ v1 ^ v2 ^ v3;
 		}
 
-		void Connection::set_address(const IPAddress& address)
+		HandshakeCookie::HandshakeCookie()
+			: k0_(0)
+			, k1_(0)
 		{
-			address_ = address;
 		}
 
-		void Connection::set_key(const uint64 key)
+		void HandshakeCookie::reset(const uint64 k0, const uint64 k1)
 		{
-			key_ = key;
+			k0_ = k0;
+			k1_ = k1;
 		}
 
-		void Connection::set_challenge(const uint64 challenge)
+		uint64 HandshakeCookie::generate(const IPAddress& address, const uint64 key, const int64 bucket) const
 		{
-			challenge_ = challenge;
+			uint8 data[22] = {};
+			uint8* dst = data;
+			write_le(dst, address.host_, 4);
+			write_le(dst, address.port_, 2);
+			write_le(dst, key, 8);
+			write_le(dst, static_cast<uint64>(bucket), 8);
+			return siphash(k0_, k1_, data, sizeof(data));
 		}
 
-		void Connection::set_sent_time(const Time& time)
+		bool HandshakeCookie::verify(const IPAddress& address, const uint64 key, const uint64 cookie, const int64 bucket) const
 		{
-			last_sent_time_ = time;
+			// note: a cookie from the previous bucket is still good, so a
+			//       handshake is never cut short by a bucket boundary
+			return cookie == generate(address, key, bucket) ||
+				cookie == generate(address, key, bucket - 1);
 		}
 
-		void Connection::set_received_time(const Time& time)
+		// note: both ends know the key and the challenge from the handshake
+		//       while someone else on the same host only sees the id, so the
+		//       tag is what lets a session follow its peer to a new address
+		uint32 Connection::data_tag(const uint16 sequence, const uint16 acknowledge, const uint32 acknowledge_bits, const uint32 ticks) const
 		{
-			last_received_time_ = time;
+			uint8 data[15] = {};
+			uint8* dst = data;
+			write_le(dst, PROTOCOL_PACKET_DATA, 1);
+			write_le(dst, id_, 2);
+			write_le(dst, sequence, 2);
+			write_le(dst, acknowledge, 2);
+			write_le(dst, acknowledge_bits, 4);
+			write_le(dst, ticks, 4);
+			return static_cast<uint32>(HandshakeCookie::siphash(key_, challenge_, data, sizeof(data)));
 		}
 
-		void Connection::set_connected_time(const Time& time)
+		uint32 Connection::disconnect_tag() const
 		{
-			connection_established_time_ = time;
+			uint8 data[3] = {};
+			uint8* dst = data;
+			write_le(dst, PROTOCOL_PACKET_DISCONNECT, 1);
+			write_le(dst, id_, 2);
+			return static_cast<uint32>(HandshakeCookie::siphash(key_, challenge_, data, sizeof(data)));
 		}
 
-		void Connection::set_listener(IConnectionListener* listener)
+		AdmissionFilter::AdmissionFilter()
+			: rate_(static_cast<float>(ADMISSION_RATE))
+			, burst_(static_cast<float>(ADMISSION_BURST))
+			, idle_time_(ADMISSION_IDLE_TIME)
+			, salt_(0)
+			, admitted_(0)
+			, dropped_(0)
+			, shared_(0)
+			, slots_(SLOT_COUNT)
 		{
-			listener_ = listener;
 		}
 
-		namespace {
-			bool is_sequence_newer(const uint16 a, const uint16 b) {
-				return ((a > b) && ((a - b) <= 0x8000)) ||
-					((a < b) && ((b - a) > 0x8000));
+		void AdmissionFilter::configure(const float rate, const float burst, const Time& idle_time)
+		{
+			rate_ = rate;
+			burst_ = burst;
+			idle_time_ = idle_time;
+		}
+
+		void AdmissionFilter::reset(const uint64 salt)
+		{
+			salt_ = salt;
+			slots_.assign(SLOT_COUNT, Slot{});
+		}
+
+		bool AdmissionFilter::is_enabled() const
+		{
+			return rate_ > 0.0f;
+		}
+
+		bool AdmissionFilter::admit(const IPAddress& address, const Time& time)
+		{
+			if (!is_enabled()) {
+				return true;
 			}
 
-			bool is_sequence_older(const uint16 a, const uint16 b) {
-				return !is_sequence_newer(b, a);
+			// note: the top bit keeps a key from ever looking like an empty
+			//       slot, the salt keeps sources from picking their slots
+			const uint64 key = (1ull << 63) | (static_cast<uint64>(address.host_) << 16) | address.port_;
+			uint64 hash = (key ^ salt_) * 0x9e3779b97f4a7c15ull;
+			hash ^= hash >> 32;
+
+			Slot* slot = nullptr;
+			Slot* stalest = nullptr;
+			for (int32 probe = 0; probe < PROBE_COUNT; probe++) {
+				Slot& candidate = slots_[(hash + probe) & (SLOT_COUNT - 1)];
+				if (candidate.key_ == key) {
+					slot = &candidate;
+					break;
+				}
+
+				// note: slots are never emptied, so nothing lies past an empty one
+				if (candidate.key_ == 0) {
+					stalest = &candidate;
+					break;
+				}
+
+				if (!stalest || candidate.last_ < stalest->last_) {
+					stalest = &candidate;
+				}
 			}
 
-			int32 sequence_difference(const uint16 a, const uint16 b)
+			if (!slot && (stalest->key_ == 0 || (time - stalest->last_) >= idle_time_)) {
+				// note: a new source, or one whose slot went idle, starts with
+				//       a full bucket
+				slot = stalest;
+				slot->key_ = key;
+				slot->last_ = time;
+				slot->tokens_ = burst_;
+			}
+			else {
+				// note: with every probed slot busy a source gets no bucket of
+				//       its own, it draws from the stalest one so pushing a
+				//       flooding source out never hands it a fresh burst
+				if (!slot) {
+					slot = stalest;
+					shared_++;
+				}
+
+				const float refill = (time - slot->last_).as_seconds() * rate_;
+				slot->tokens_ = refill + slot->tokens_ < burst_ ? refill + slot->tokens_ : burst_;
+				slot->last_ = time;
+			}
+
+			if (slot->tokens_ < 1.0f) {
+				dropped_++;
+				return false;
+			}
+
+			slot->tokens_ -= 1.0f;
+			admitted_++;
+			return true;
+		}
+
+		namespace {
+			uint64 loopback_key(const IPAddress& address)
 			{
-				int32 x = a;
-				int32 y = b;
-				if (abs(x - y) >= 0x8000) {
-					if (x > y) {
-						y += 0x8000;
-					}
-					else {
-						x += 0x8000;
-					}
+				return (static_cast<uint64>(address.host_) << 16) | address.port_;
+			}
+		} // !anon
+
+		LoopbackHub::LoopbackHub()
+			: routed_(0)
+			, unroutable_(0)
+		{
+		}
+
+		void LoopbackHub::set_delay(const Time& delay)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			delay_ = delay;
+		}
+
+		bool LoopbackHub::attach(LoopbackTransport* transport)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			const uint64 key = loopback_key(transport->address_);
+			if (transports_.find(key) != transports_.end()) {
+				return false;
+			}
+
+			transports_[key] = transport;
+			return true;
+		}
+
+		void LoopbackHub::detach(LoopbackTransport* transport)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			auto it = transports_.find(loopback_key(transport->address_));
+			if (it != transports_.end() && it->second == transport) {
+				transports_.erase(it);
+			}
+			transport->inbox_ = {};
+		}
+
+		bool LoopbackHub::route(const IPAddress& from, const IPAddress& to, const PacketHandle& packet, const Time& time)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			auto it = transports_.find(loopback_key(to));
+			if (it == transports_.end()) {
+				unroutable_++;
+				return false;
+			}
+
+			// note: the receiver shares the buffer, nothing is copied
+			it->second->inbox_.push({ time + delay_, from, packet });
+			routed_++;
+			return true;
+		}
+
+		int32 LoopbackHub::collect(LoopbackTransport* transport, Datagram* datagrams, const int32 count, const Time& time)
+		{
+			// note: one fixed delay keeps every inbox in delivery order
+			std::lock_guard<std::mutex> lock(mutex_);
+			int32 collected = 0;
+			while (collected < count && !transport->inbox_.empty()) {
+				LoopbackTransport::Entry& entry = transport->inbox_.front();
+				if (entry.time_ > time) {
+					break;
+				}
+
+				Datagram& datagram = datagrams[collected++];
+				datagram.address_ = entry.address_;
+				datagram.packet_ = std::move(entry.packet_);
+				transport->inbox_.pop();
+			}
+
+			return collected;
+		}
+
+		LoopbackTransport::LoopbackTransport()
+			: hub_(nullptr)
+		{
+		}
+
+		LoopbackTransport::~LoopbackTransport()
+		{
+			close();
+		}
+
+		bool LoopbackTransport::open(LoopbackHub& hub, const IPAddress& address)
+		{
+			close();
+
+			address_ = address;
+			if (!hub.attach(this)) {
+				printf("WRN: loopback address %s is already taken\n", address.as_string());
+				return false;
+			}
+
+			hub_ = &hub;
+			return true;
+		}
+
+		bool LoopbackTransport::is_valid() const
+		{
+			return hub_ != nullptr;
+		}
+
+		void LoopbackTransport::close()
+		{
+			if (hub_) {
+				hub_->detach(this);
+				hub_ = nullptr;
+			}
+		}
+
+		void LoopbackTransport::wait(const Time& timeout)
+		{
+			Time::sleep(timeout);
+		}
+
+		int32 LoopbackTransport::receive_batch(Datagram* datagrams, const int32 count)
+		{
+			if (!is_valid()) {
+				return -1;
+			}
+
+			return hub_->collect(this, datagrams, count, Time::now());
+		}
+
+		int32 LoopbackTransport::send_batch(const Datagram* datagrams, const int32 count, SendCounters& counters)
+		{
+			if (!is_valid()) {
+				return -1;
+			}
+
+			const Time now = Time::now();
+			for (int32 index = 0; index < count; index++) {
+				hub_->route(address_, datagrams[index].address_, datagrams[index].packet_, now);
+			}
+
+			counters.datagrams_ += static_cast<uint64>(count);
+			return count;
+		}
+
+		// static
+		ConditionerProfile ConditionerProfile::from_preset(const Preset preset)
+		{
+			ConditionerProfile profile;
+			switch (preset) {
+			case Preset::None:
+				break;
+			case Preset::Broadband:
+				profile.latency_ = Time(0.020);
+				profile.jitter_ = Time(0.002);
+				profile.loss_ = 0.001f;
+				break;
+			case Preset::Wifi:
+				profile.latency_ = Time(0.040);
+				profile.jitter_ = Time(0.010);
+				profile.loss_ = 0.01f;
+				profile.burst_enter_ = 0.002f;
+				profile.burst_exit_ = 0.3f;
+				profile.duplicate_ = 0.001f;
+				profile.reorder_ = 0.005f;
+				profile.reorder_delay_ = Time(0.010);
+				break;
+			case Preset::Mobile:
+				profile.latency_ = Time(0.080);
+				profile.jitter_ = Time(0.025);
+				profile.loss_ = 0.02f;
+				profile.burst_enter_ = 0.005f;
+				profile.burst_exit_ = 0.2f;
+				profile.duplicate_ = 0.005f;
+				profile.reorder_ = 0.02f;
+				profile.reorder_delay_ = Time(0.030);
+				profile.bandwidth_ = 64 * 1024;
+				break;
+			case Preset::Congested:
+				profile.latency_ = Time(0.150);
+				profile.jitter_ = Time(0.050);
+				profile.loss_ = 0.05f;
+				profile.burst_enter_ = 0.02f;
+				profile.burst_exit_ = 0.1f;
+				profile.duplicate_ = 0.01f;
+				profile.reorder_ = 0.05f;
+				profile.reorder_delay_ = Time(0.050);
+				profile.bandwidth_ = 16 * 1024;
+				break;
+			}
+
+			return profile;
+		}
+
+		// static
+		bool ConditionerProfile::from_name(const char* name, ConditionerProfile& profile)
+		{
+			static const struct {
+				const char* name_;
+				Preset preset_;
+			} presets[] = {
+				{ "none", Preset::None },
+				{ "broadband", Preset::Broadband },
+				{ "wifi", Preset::Wifi },
+				{ "mobile", Preset::Mobile },
+				{ "congested", Preset::Congested },
+			};
+
+			for (const auto& preset : presets) {
+				if (strcmp(preset.name_, name) == 0) {
+					profile = from_preset(preset.preset_);
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		ConditionerProfile::ConditionerProfile()
+			: loss_(0.0f)
+			, burst_enter_(0.0f)
+			, burst_exit_(0.0f)
+			, duplicate_(0.0f)
+			, reorder_(0.0f)
+			, bandwidth_(0)
+		{
+		}
+
+		bool ConditionerProfile::is_enabled() const
+		{
+			return latency_ > Time() ||
+				jitter_ > Time() ||
+				loss_ > 0.0f ||
+				burst_enter_ > 0.0f ||
+				duplicate_ > 0.0f ||
+				reorder_ > 0.0f ||
+				bandwidth_ > 0;
+		}
+
+		ConditionerCounters::ConditionerCounters()
+			: submitted_(0)
+			, delivered_(0)
+			, dropped_(0)
+			, burst_dropped_(0)
+			, throttled_(0)
+			, duplicated_(0)
+			, reordered_(0)
+			, bytes_(0)
+		{
+		}
+
+		namespace {
+			// note: earliest delivery on top of the heap, ties in submit order
+			bool is_later_entry(const NetworkConditioner::Entry& lhs, const NetworkConditioner::Entry& rhs)
+			{
+				if (lhs.time_ != rhs.time_) {
+					return lhs.time_ > rhs.time_;
 				}
 
-				return x - y;
+				return lhs.order_ > rhs.order_;
 			}
 		} // !anon
 
-		void Connection::receive(NetworkStreamReader& reader)
+		NetworkConditioner::NetworkConditioner()
+			: burst_(false)
+			, order_(0)
 		{
-			set_received_time(Time::now());
+		}
 
-			ProtocolDataPacket packet;
-			if (!packet.read(reader)) {
-				assert(!"data packet read failed!");
-				return;
-			}
+		bool NetworkConditioner::is_enabled() const
+		{
+			// note: a disabled profile still drains what it is holding
+			return profile_.is_enabled() || !entries_.empty();
+		}
 
-			// note: ignore old data packets
-			if (is_sequence_older(acknowledge_, packet.sequence_)) {
-				printf("WRN: old sequence - ack: %d seq: %d\n", acknowledge_, packet.sequence_);
+		void NetworkConditioner::set_profile(const ConditionerProfile& profile, const uint64 seed)
+		{
+			profile_ = profile;
+			counters_ = {};
+			random_ = Random(seed);
+			burst_ = false;
+			order_ = 0;
+			last_time_ = {};
+			link_free_time_ = {};
+		}
+
+		void NetworkConditioner::clear()
+		{
+			entries_.clear();
+		}
+
+		void NetworkConditioner::submit(const Time& time, const IPAddress& address, const PacketHandle& packet)
+		{
+			counters_.submitted_++;
+
+			// note: a burst drops everything until it ends
+			if (burst_) {
+				if (random_unit() < profile_.burst_exit_) {
+					burst_ = false;
+				}
+				else {
+					counters_.burst_dropped_++;
+					return;
+				}
+			}
+			else if (random_unit() < profile_.burst_enter_) {
+				burst_ = true;
+				counters_.burst_dropped_++;
 				return;
 			}
 
-			int32 distance = sequence_difference(packet.sequence_, acknowledge_);
-			acknowledge_ = packet.sequence_;
-			if (distance >= 32) {
-				acknowledge_bits_ = 0;
-			}
-			else {
-				acknowledge_bits_ >>= distance;
-				acknowledge_bits_ |= (1 << 31);
+			if (random_unit() < profile_.loss_) {
+				counters_.dropped_++;
+				return;
 			}
 
-			const Time timestamp = round_trip_buffer_[packet.acknowledge_ % 64];
-			const Time ticks(int64(packet.ticks_));
-			round_trip_time_ = last_received_time_ - timestamp - ticks;
+			// note: a capped link sends one datagram after the other, what
+			//       would sit in its queue for too long is dropped instead
+			Time departure = time;
+			if (profile_.bandwidth_ > 0) {
+				if (link_free_time_ < time) {
+					link_free_time_ = time;
+				}
 
-			//printf("NFO: seq: %d ack: %d (%08X) rtt: %3.3fms [%d,%u]\n",
-			//       sequence_,
-			//       acknowledge_,
-			//       acknowledge_bits_,
-			//       round_trip_time_.as_milliseconds(),
-			//       packet.acknowledge_,
-			//       packet.ticks_);
+				if ((link_free_time_ - time) >= Time(MAX_QUEUE_DELAY)) {
+					counters_.throttled_++;
+					return;
+				}
 
-			if (listener_) {
-				listener_->on_acknowledge(this, packet.acknowledge_);
-				// todo: parse bits and let listener know
+				link_free_time_ += Time(static_cast<double>(packet.length()) / profile_.bandwidth_);
+				departure = link_free_time_;
 			}
 
-			// note: listener read the data
-			if (listener_) {
-				listener_->on_receive(this, reader);
+			schedule(departure, address, packet);
+			if (random_unit() < profile_.duplicate_) {
+				counters_.duplicated_++;
+				schedule(departure, address, packet);
 			}
 		}
 
-		void Connection::send()
+		bool NetworkConditioner::poll(const Time& time, IPAddress& address, PacketHandle& packet)
 		{
-			const Time now = Time::now();
-			round_trip_buffer_[sequence_ % 64] = now;
-
-			NetworkStream stream;
-			NetworkStreamWriter writer(stream);
-
-			uint32 ticks = static_cast<uint32>((now - last_received_time_).as_ticks());
-			ProtocolDataPacket packet(sequence_,
-				acknowledge_,
-				acknowledge_bits_,
-				ticks);
-			if (!packet.write(writer)) {
-				assert(!"data packet write failed!");
+			if (entries_.empty() || entries_.front().time_ > time) {
+				return false;
 			}
 
-			// note: listener pack data
-			if (listener_) {
-				listener_->on_send(this, sequence_, writer);
-			}
-			sequence_++;
+			std::pop_heap(entries_.begin(), entries_.end(), is_later_entry);
+			Entry& entry = entries_.back();
+			address = entry.address_;
+			packet = std::move(entry.packet_);
+			entries_.pop_back();
 
-			assert(g_service);
-			g_service->send_stream(this, stream);
-		}
+			counters_.delivered_++;
+			counters_.bytes_ += static_cast<uint64>(packet.length());
 
-		ConnectionPool::ConnectionPool(const int32 capacity)
-			: capacity_(capacity)
-			, connection_count_(0)
-			, connections_(new Connection[capacity])
-		{
+			return true;
 		}
 
-		ConnectionPool::~ConnectionPool()
+		float NetworkConditioner::random_unit()
 		{
-			delete[] connections_;
+			return static_cast<float>(random_() >> 40) / static_cast<float>(1 << 24);
 		}
 
-		void ConnectionPool::resize(const int32 capacity)
+		void NetworkConditioner::schedule(const Time& time, const IPAddress& address, const PacketHandle& packet)
 		{
-			if (capacity_ < capacity) {
-				delete[] connections_;
-				capacity_ = capacity;
-				connection_count_ = 0;
-				connections_ = new Connection[capacity];
+			Time delay = profile_.latency_;
+			if (profile_.jitter_ > Time()) {
+				const float offset = random_unit() * 2.0f - 1.0f;
+				delay += Time(static_cast<double>(profile_.jitter_.as_seconds() * offset));
+				if (delay < Time()) {
+					delay = Time();
+				}
 			}
-		}
 
-		Connection* ConnectionPool::create()
-		{
-			assert(connection_count_ < capacity_);
-			connection_count_++;
-
-			for (int32 index = 0; index < capacity_; index++) {
-				if (!connections_[index].is_valid()) {
-					connections_[index].set_state(Connection::State::Disconnected);
-					return &connections_[index];
+			// note: jitter alone keeps the order, only reordered datagrams
+			//       are held back long enough to be overtaken
+			Time delivery = time + delay;
+			if (random_unit() < profile_.reorder_) {
+				counters_.reordered_++;
+				delivery += profile_.reorder_delay_;
+			}
+			else {
+				if (delivery < last_time_) {
+					delivery = last_time_;
 				}
+				last_time_ = delivery;
 			}
 
-			return nullptr;
+			entries_.push_back({ delivery, order_++, address, packet });
+			std::push_heap(entries_.begin(), entries_.end(), is_later_entry);
 		}
 
-		void ConnectionPool::release(Connection* connection)
-		{
-			assert(connection >= connections_ && connection <= (connections_ + capacity_));
-			connection->invalidate();
+		namespace {
+			// note: every slot needs a buffer nobody else holds before the
+			//       socket may write into it
+			void prepare_receive_batch(Datagram* datagrams, const int32 count)
+			{
+				for (int32 index = 0; index < count; index++) {
+					if (!datagrams[index].packet_.is_unique()) {
+						datagrams[index].packet_ = PacketHandle::acquire();
+					}
+				}
+			}
 
-			assert(connection_count_ > 0);
-			connection_count_--;
-		}
+			bool is_known_packet(const Datagram& datagram)
+			{
+				if (datagram.packet_.length() <= 0) {
+					return false;
+				}
+
+				const uint8 type = datagram.packet_.data()[0];
+				return type < PROTOCOL_PACKET_COUNT || type == PROTOCOL_PACKET_MASTER_SERVER;
+			}
+
+			metrics::Histogram update_duration("charlie_service_update_seconds", "Time spent in one service update");
+			metrics::Counter datagrams_received("charlie_service_datagrams_received_total", "Datagrams processed by service updates");
+			metrics::Counter datagrams_sent("charlie_service_datagrams_sent_total", "Datagrams flushed by service updates");
+			metrics::Counter connects("charlie_service_connects_total", "Connections established");
+			metrics::Counter disconnects("charlie_service_disconnects_total", "Connections closed by either side");
+			metrics::Counter timeouts("charlie_service_timeouts_total", "Connections that timed out");
+			// note: the gauges are shared by every service in the process, each
+			//       one adds and removes its own connections as the lists change
+			metrics::Gauge established_connections("charlie_service_established_connections", "Established connections over every service");
+			metrics::Gauge pending_connections("charlie_service_pending_connections", "Connections still in the handshake over every service");
+		} // !anon
 
 		Service::Service()
-			: initialized_(false)
-			, send_rate_(1.0 / 10)
+			: transport_(nullptr)
+			, initialized_(false)
+			, min_send_rate_(1.0 / 10)
+			, max_send_rate_(1.0 / 10)
+			, min_payload_budget_(PacketBuffer::CAPACITY)
+			, max_payload_budget_(PacketBuffer::CAPACITY)
+			, receive_budget_(0.002)
+			, handshake_resend_time_(HANDSHAKE_RESEND_TIME)
+			, keepalive_time_(KEEPALIVE_TIME)
+			, connection_timeout_(CONNECTION_TIMEOUT)
 			, allow_connections_(false)
 			, connection_limit_(8)
 			, connection_pool_(connection_limit_)
+			, receive_batch_(32)
+			, send_queue_(32)
+			, send_queue_count_(0)
+			, threaded_(false)
+			, running_(false)
 		{
-			assert(!g_service);
-			g_service = this;
+			timers_.reset(Time::now(), Time(TIMER_RESOLUTION));
+
+			// note: the cookie secret never leaves the process, a fresh one
+			//       per run invalidates cookies handed out by an earlier run
+			std::random_device device;
+			cookie_.reset((static_cast<uint64>(device()) << 32) | device(),
+				(static_cast<uint64>(device()) << 32) | device());
+			admission_.reset((static_cast<uint64>(device()) << 32) | device());
+
+			// note: the first service is the default for Connection::connect,
+			//       any further ones are reached through their connections
+			if (!g_service) {
+				g_service = this;
+			}
 
+#if defined(_WIN32)
 			WSADATA data = {};
 			WSAStartup(MAKEWORD(2, 2), &data);
+#endif
 		}
 
 		Service::~Service()
 		{
+			if (network_thread_.joinable()) {
+				running_.store(false, std::memory_order_release);
+				network_thread_.join();
+			}
+
+			if (g_service == this) {
+				g_service = nullptr;
+			}
+
+			established_connections.add(-static_cast<int64>(established_connections_.size()));
+			pending_connections.add(-static_cast<int64>(pending_connections_.size()));
+
+#if defined(_WIN32)
 			WSACleanup();
+#endif
 		}
 
-		bool Service::initialize(const IPAddress& address)
+		bool Service::initialize(const IPAddress& address, const UDPSocket::Backend backend)
 		{
-			if (!socket_.open(address)) {
+			if (!socket_.open(address, backend)) {
 				int error_code = Error::get_last();
 				return false;
 			}
 
+			return initialize(&socket_, address);
+		}
+
+		bool Service::initialize(ITransport* transport, const IPAddress& address)
+		{
+			assert(transport && transport->is_valid());
+			transport_ = transport;
 			initialized_ = true;
 			myaddress_ = address;
 
+			if (threaded_) {
+				// note: from here on only the network thread touches the socket
+				inbound_.resize(NETWORK_THREAD_QUEUE_SIZE);
+				outbound_.resize(NETWORK_THREAD_QUEUE_SIZE);
+				received_time_ = Time::now();
+				running_.store(true, std::memory_order_release);
+				network_thread_ = std::thread(&Service::run_network_thread, this);
+			}
+
 			return true;
 		}
 
 		void Service::shutdown()
 		{
-			if (socket_.is_valid()) {
-				socket_.close();
+			flush();
+			if (network_thread_.joinable()) {
+				running_.store(false, std::memory_order_release);
+				network_thread_.join();
+			}
+
+			if (transport_ && transport_->is_valid()) {
+				transport_->close();
 			}
+			transport_ = nullptr;
 			initialized_ = false;
 		}
 
 		void Service::update()
 		{
-			// note: deducted using hard science!
-			int32 receive_limiter = 20;
-
-			IPAddress address;
-			NetworkStream stream;
-			while (receive_limiter >= 0 && socket_.receive(address, stream.buffer_, stream.length_)) {
-				NetworkStreamReader reader(stream);
-				// note: allow_connections_ == true indicates 'server' mode
-				if (allow_connections_) {
-					switch (reader.peek()) {
-					case PROTOCOL_PACKET_REQUEST:
-						handle_connection_request(address, reader);
-						break;
-					case PROTOCOL_PACKET_CHALLENGE:
-						handle_connection_challenge(address, reader);
-						break;
-					case PROTOCOL_PACKET_RESPONSE:
-						handle_connection_response(address, reader);
-						break;
-					case PROTOCOL_PACKET_REJECTED:
-						handle_connection_rejected(address, reader);
-						break;
-					case PROTOCOL_PACKET_DATA:
-						handle_connection_payload(address, reader);
-						break;
-					case PROTOCOL_PACKET_DISCONNECT:
-						handle_connection_disconnect(address, reader);
-						break;
-					case PROTOCOL_PACKET_MASTER_SERVER:
-						handle_master_server_package(address, reader);
-						break;
-					default:
-						assert(!"invalid packet received!");
-						break;
-					}
+			const Time update_start = Time::now();
+			uint64 received_count = 0;
+
+			if (threaded_) {
+				// note: the network thread already received and timestamped
+				//       these, read them in place and hand the slot back
+				while (ReceivedDatagram* datagram = inbound_.front()) {
+					received_time_ = datagram->time_;
+					process_datagram(datagram->address_, datagram->packet_);
+					inbound_.release();
+					received_count++;
 				}
-				else {
-					switch (reader.peek()) {
-					case PROTOCOL_PACKET_CHALLENGE:
-						handle_connection_challenge(address, reader);
-						break;
-					case PROTOCOL_PACKET_REJECTED:
-						handle_connection_rejected(address, reader);
-						break;
-					case PROTOCOL_PACKET_DATA:
-						handle_connection_payload(address, reader);
-						break;
-					case PROTOCOL_PACKET_DISCONNECT:
-						handle_connection_disconnect(address, reader);
-						break;
-					default:
-						assert(!"invalid packet received!");
+			}
+			else {
+				// note: drain the socket in batches until it is empty or the
+				//       receive budget for this update is spent
+				const int32 batch_size = static_cast<int32>(receive_batch_.size());
+				const Time receive_start = Time::now();
+				while (true) {
+					prepare_receive_batch(receive_batch_.data(), batch_size);
+					const int32 received = transport_->receive_batch(receive_batch_.data(), batch_size);
+					if (received < 0) {
+						const int error_code = Error::get_last();
+						if (Error::is_critical(error_code)) {
+							assert(!"network critical error!");
+						}
 						break;
 					}
-				}
 
-				receive_limiter--;
-				stream.reset();
-			}
-
-			const int error_code = Error::get_last();
-			if (Error::is_critical(error_code)) {
-				assert(!"network critical error!");
-			}
+					received_time_ = Time::now();
+					for (int32 index = 0; index < received; index++) {
+						Datagram& datagram = receive_batch_[index];
+						process_datagram(datagram.address_, datagram.packet_);
+					}
+					received_count += static_cast<uint64>(received);
 
-			const Time time = Time::now();
-			for (auto& connection : pending_connections_) {
-				if (allow_connections_) {
-					if ((time - connection->last_sent_time_) >= Time(0.2)) {
-						if (connection->is_challenging()) {
-							send_connection_challenge(connection);
-						}
+					if (received < batch_size) {
+						break;
 					}
-				}
-				else {
-					if ((time - connection->last_sent_time_) >= Time(0.2)) {
-						if (connection->is_requesting()) {
-							send_connection_request(connection);
-						}
-						else if (connection->is_responding()) {
-							send_connection_response(connection);
-						}
+
+					if ((Time::now() - receive_start) >= receive_budget_) {
+						break;
 					}
 				}
 			}
 
+			const Time time = Time::now();
+			release_conditioned(time);
+			process_timers(time);
+
 			for (auto& connection : established_connections_) {
-				if ((time - connection->last_sent_time_) >= send_rate_) {
+				if (connection->is_connected()) {
+					connection->update_fragments(time);
+				}
+
+				connection->congestion_.update(time);
+				if ((time - connection->last_sent_time_) >= connection->send_interval()) {
 					if (connection->is_connected()) {
 						connection->send();
 					}
@@ -1084,6 +3771,7 @@ namespace charlie {
 						if (connection->disconnect_counter_ == 0) {
 							printf("NFO: disconnect counter reached.\n");
 							connection->set_state(Connection::State::Disconnected);
+							timers_.schedule(connection, TimerWheel::Kind::Timeout, time);
 						}
 						else {
 							connection->disconnect_counter_--;
@@ -1093,12 +3781,46 @@ namespace charlie {
 				}
 			}
 
-			perform_periodic_timeout_check(Time::now());
+			release_conditioned(Time::now());
+			flush();
+
+			// note: one atomic add per metric and update, not per datagram
+			datagrams_received.add(received_count);
+			update_duration.observe(Time::now() - update_start);
 		}
 
 		void Service::set_send_rate(const Time& rate)
 		{
-			send_rate_ = rate;
+			set_send_rate(rate, rate);
+		}
+
+		void Service::set_send_rate(const Time& min_rate, const Time& max_rate)
+		{
+			min_send_rate_ = min_rate;
+			max_send_rate_ = max_rate;
+			for (auto& connection : established_connections_) {
+				connection->congestion_.set_bounds(min_send_rate_, max_send_rate_, min_payload_budget_, max_payload_budget_);
+			}
+		}
+
+		void Service::set_payload_budget(const int32 min_budget, const int32 max_budget)
+		{
+			min_payload_budget_ = min_budget;
+			max_payload_budget_ = max_budget;
+			for (auto& connection : established_connections_) {
+				connection->congestion_.set_bounds(min_send_rate_, max_send_rate_, min_payload_budget_, max_payload_budget_);
+			}
+		}
+
+		void Service::set_network_thread(const bool enabled)
+		{
+			assert(!initialized_);
+			threaded_ = enabled;
+		}
+
+		void Service::set_receive_budget(const Time& budget)
+		{
+			receive_budget_ = budget;
 		}
 
 		void Service::set_allow_connections(const bool allow_connections)
@@ -1113,6 +3835,48 @@ namespace charlie {
 			connection_pool_.resize(connection_limit);
 		}
 
+		void Service::set_handshake_resend_time(const Time& time)
+		{
+			handshake_resend_time_ = time;
+		}
+
+		void Service::set_keepalive_time(const Time& time)
+		{
+			keepalive_time_ = time;
+		}
+
+		void Service::set_connection_timeout(const Time& time)
+		{
+			connection_timeout_ = time;
+		}
+
+		void Service::set_cookie_secret(const uint64 k0, const uint64 k1)
+		{
+			cookie_.reset(k0, k1);
+		}
+
+		void Service::set_admission_rate(const float rate, const float burst)
+		{
+			// note: a rate of zero turns the filter off
+			admission_.configure(rate, burst, Time(ADMISSION_IDLE_TIME));
+		}
+
+		void Service::set_conditioner(const ConditionerProfile& profile, const uint64 seed)
+		{
+			set_send_conditioner(profile, seed);
+			set_receive_conditioner(profile, seed + 1);
+		}
+
+		void Service::set_send_conditioner(const ConditionerProfile& profile, const uint64 seed)
+		{
+			send_conditioner_.set_profile(profile, seed);
+		}
+
+		void Service::set_receive_conditioner(const ConditionerProfile& profile, const uint64 seed)
+		{
+			receive_conditioner_.set_profile(profile, seed);
+		}
+
 		void Service::add_service_listener(IServiceListener* listener)
 		{
 			connection_listeners_.push_back(listener);
@@ -1132,6 +3896,20 @@ namespace charlie {
 
 		void Service::notify_service_listeners(const Event event, Connection* connection)
 		{
+			switch (event) {
+			case Event::Timeout:
+				timeouts.add();
+				break;
+			case Event::Connect:
+				connects.add();
+				break;
+			case Event::Disconnect:
+				disconnects.add();
+				break;
+			default:
+				break;
+			}
+
 			for (auto& listener : connection_listeners_) {
 				switch (event) {
 				case Event::Timeout:
@@ -1149,8 +3927,17 @@ namespace charlie {
 
 		void Service::add_pending_connection(Connection* connection)
 		{
+			connection->service_ = this;
 			connection->set_key(random_());
 			pending_connections_.push_back(connection);
+			pending_connections.add(1);
+
+			// note: a new epoch silences timers left from an earlier attempt
+			const Time now = Time::now();
+			connection->in_pending_list_ = true;
+			connection->timer_epoch_++;
+			timers_.schedule(connection, TimerWheel::Kind::Handshake, now);
+			timers_.schedule(connection, TimerWheel::Kind::Timeout, now + connection_timeout_);
 			printf("Pending connection added \n");
 		}
 
@@ -1159,7 +3946,9 @@ namespace charlie {
 			auto it = pending_connections_.begin();
 			while (it != pending_connections_.end()) {
 				if ((*it) == connection) {
+					connection->in_pending_list_ = false;
 					pending_connections_.erase(it);
+					pending_connections.add(-1);
 					printf("Pending connection removed \n");
 					return;
 				}
@@ -1188,7 +3977,11 @@ namespace charlie {
 		void Service::add_established_connection(Connection* connection)
 		{
 			printf("Connection established \n");
+			connection->congestion_.set_bounds(min_send_rate_, max_send_rate_, min_payload_budget_, max_payload_budget_);
 			established_connections_.push_back(connection);
+			established_connections.add(1);
+			connection->in_established_list_ = true;
+			timers_.schedule(connection, TimerWheel::Kind::Keepalive, Time::now() + keepalive_time_);
 		}
 
 		void Service::remove_established_connection(Connection* connection)
@@ -1196,7 +3989,9 @@ namespace charlie {
 			auto it = established_connections_.begin();
 			while (it != established_connections_.end()) {
 				if ((*it) == connection) {
+					connection->in_established_list_ = false;
 					established_connections_.erase(it);
+					established_connections.add(-1);
 					printf("Established connection removed \n");
 					return;
 				}
@@ -1213,21 +4008,116 @@ namespace charlie {
 					return connection;
 				}
 			}
-			return nullptr;
+			return nullptr;
+		}
+
+		int32 Service::established_connection_count() const
+		{
+			return static_cast<int32>(established_connections_.size());
+		}
+
+		// note: fills one entry per established connection, the array keeps
+		//       its storage between calls so polling does not allocate
+		void Service::collect_connection_info(DynamicArray<ConnectionInfo>& infos) const
+		{
+			const Time now = Time::now();
+			infos.resize(established_connections_.size());
+			for (size_t index = 0; index < established_connections_.size(); index++) {
+				established_connections_[index]->fill_info(infos[index], now);
+			}
+		}
+
+		Connection* Service::find_established_connection(const uint16 id, const IPAddress& address) const
+		{
+			Connection* connection = connection_pool_.find(id);
+			if (!connection || !connection->is_endpoint(address)) {
+				return nullptr;
+			}
+
+			return connection;
+		}
+
+		void Service::handle_datagram(const IPAddress& address, NetworkStreamReader& reader)
+		{
+			// note: over rate sources are dropped before anything is parsed
+			if (!admission_.admit(address, received_time_)) {
+				return;
+			}
+
+			// note: allow_connections_ == true indicates 'server' mode
+			if (allow_connections_) {
+				switch (reader.peek()) {
+				case PROTOCOL_PACKET_REQUEST:
+					handle_connection_request(address, reader);
+					break;
+				case PROTOCOL_PACKET_CHALLENGE:
+					handle_connection_challenge(address, reader);
+					break;
+				case PROTOCOL_PACKET_RESPONSE:
+					handle_connection_response(address, reader);
+					break;
+				case PROTOCOL_PACKET_REJECTED:
+					handle_connection_rejected(address, reader);
+					break;
+				case PROTOCOL_PACKET_DATA:
+					handle_connection_payload(address, reader);
+					break;
+				case PROTOCOL_PACKET_FRAGMENT:
+					handle_connection_fragment(address, reader);
+					break;
+				case PROTOCOL_PACKET_FRAGMENT_ACK:
+					handle_connection_fragment_ack(address, reader);
+					break;
+				case PROTOCOL_PACKET_DISCONNECT:
+					handle_connection_disconnect(address, reader);
+					break;
+				case PROTOCOL_PACKET_MASTER_SERVER:
+					handle_master_server_package(address, reader);
+					break;
+				default:
+					assert(!"invalid packet received!");
+					break;
+				}
+			}
+			else {
+				switch (reader.peek()) {
+				case PROTOCOL_PACKET_CHALLENGE:
+					handle_connection_challenge(address, reader);
+					break;
+				case PROTOCOL_PACKET_REJECTED:
+					handle_connection_rejected(address, reader);
+					break;
+				case PROTOCOL_PACKET_DATA:
+					handle_connection_payload(address, reader);
+					break;
+				case PROTOCOL_PACKET_FRAGMENT:
+					handle_connection_fragment(address, reader);
+					break;
+				case PROTOCOL_PACKET_FRAGMENT_ACK:
+					handle_connection_fragment_ack(address, reader);
+					break;
+				case PROTOCOL_PACKET_DISCONNECT:
+					handle_connection_disconnect(address, reader);
+					break;
+				default:
+					assert(!"invalid packet received!");
+					break;
+				}
+			}
 		}
 
 		void Service::handle_connection_request(const IPAddress& address, NetworkStreamReader& reader)
 		{
-			printf("NFO: + handle_connection_request from %s\n", address.as_string());
+			//printf("NFO: + handle_connection_request from %s\n", address.as_string());
 
 			if (established_connections_.size() >= connection_limit_) {
 				printf("NFO: server connection limit reached (%d).\n", connection_limit_);
 
-				NetworkStream stream;
+				PacketHandle stream = PacketHandle::acquire();
 				NetworkStreamWriter writer(stream);
 				ProtocolRejectedPacket rejected(REJECT_REASON_SERVER_FULL);
 				if (rejected.write(writer)) {
-					send_stream(address, stream);
+					send_packet(address, stream);
 				}
 				return;
 			}
@@ -1240,53 +4130,34 @@ namespace charlie {
 			if (packet.protocol_ != PROTOCOL_ID) {
 				printf("NFO: invalid protocol - %u != %u", PROTOCOL_ID, packet.protocol_);
 
-				NetworkStream stream;
+				PacketHandle stream = PacketHandle::acquire();
 				NetworkStreamWriter writer(stream);
 				ProtocolRejectedPacket rejected(REJECT_REASON_PROTOCOL);
 				if (rejected.write(writer)) {
-					send_stream(address, stream);
+					send_packet(address, stream);
 				}
 				return;
 			}
 			else if (packet.version_ != PROTOCOL_VERSION) {
 				printf("NFO: invalid version - %u != %u", PROTOCOL_VERSION, packet.version_);
 
-				NetworkStream stream;
+				PacketHandle stream = PacketHandle::acquire();
 				NetworkStreamWriter writer(stream);
 				ProtocolRejectedPacket rejected(REJECT_REASON_VERSION);
 				if (rejected.write(writer)) {
-					send_stream(address, stream);
+					send_packet(address, stream);
 				}
 				return;
 			}
 
-			Connection* connection = find_pending_connection(address);
-			if (!connection) {
-				printf("NFO: no matching pending connection found.\n");
-				if (find_established_connection(address)) {
-					printf("NFO: found established connection with address.\n");
-					return;
-				}
-
-				connection = connection_pool_.create();
-				if (!connection) {
-					printf("WRN: no more connections in connection pool!\n");
-					return;
-				}
-
-				printf("NFO: new pending connection created.\n");
-				connection->set_address(address);
-				connection->set_received_time(Time::now());
-				add_pending_connection(connection);
+			if (find_established_connection(address)) {
+				printf("NFO: found established connection with address.\n");
+				return;
 			}
 
-			if (connection->is_disconnected()) {
-				printf("NFO: setting key and generating challenge.\n");
-				connection->set_key(packet.key_);
-				connection->set_challenge(random_());
-				connection->set_received_time(Time::now());
-				connection->set_state(Connection::State::SendingChallenge);
-			}
+			// note: nothing is allocated until the cookie comes back in a
+			//       valid response, a request flood only costs a hash each
+			send_connection_challenge(address, cookie_.generate(address, packet.key_, cookie_bucket(Time::now())));
 		}
 
 		void Service::handle_connection_challenge(const IPAddress& address, NetworkStreamReader& reader) const
@@ -1314,44 +4185,62 @@ namespace charlie {
 		void Service::handle_connection_response(const IPAddress& address, NetworkStreamReader& reader)
 		{
 			printf("NFO: + handle_connection_response from %s\n", address.as_string());
-			Connection* connection = find_pending_connection(address);
-			if (!connection) {
-				printf("WRN: no matching pending connection found!\n");
-				return;
-			}
-
 			ProtocolResponsePacket packet;
 			if (!packet.read(reader)) {
 				assert(!"handle_connection_response: could not read packet!");
 			}
 
-			if (connection->is_challenging()) {
-				const uint64 correct = connection->key_ ^ connection->challenge_;
-				if (packet.response_ != correct) {
-					printf("NFO: invalid challenge - %llu <- %llu", packet.response_, correct);
+			// note: the client resends its response until our first data
+			//       packet arrives, the duplicates land here
+			if (find_established_connection(address)) {
+				return;
+			}
 
-					NetworkStream stream;
-					NetworkStreamWriter writer(stream);
-					ProtocolRejectedPacket rejected(REJECT_REASON_CHALLENGE);
-					if (rejected.write(writer)) {
-						send_stream(address, stream);
-					}
+			const uint64 cookie = packet.response_ ^ packet.key_;
+			if (!cookie_.verify(address, packet.key_, cookie, cookie_bucket(Time::now()))) {
+				//printf("NFO: invalid challenge from %s\n", address.as_string());
 
-					// todo: ...
-					//connection->set_state(Connection::State::Rejected);
-					return;
+				PacketHandle stream = PacketHandle::acquire();
+				NetworkStreamWriter writer(stream);
+				ProtocolRejectedPacket rejected(REJECT_REASON_CHALLENGE);
+				if (rejected.write(writer)) {
+					send_packet(address, stream);
 				}
+				return;
+			}
 
-				printf("NFO: challenge accepted, connection established.\n");
-				remove_pending_connection(connection);
-				add_established_connection(connection);
+			if (established_connection_count() >= connection_limit_) {
+				printf("NFO: server connection limit reached (%d).\n", connection_limit_);
 
-				const Time now = Time::now();
-				connection->set_received_time(now);
-				connection->set_connected_time(now);
-				connection->on_established();
-				notify_service_listeners(Event::Connect, connection);
+				PacketHandle stream = PacketHandle::acquire();
+				NetworkStreamWriter writer(stream);
+				ProtocolRejectedPacket rejected(REJECT_REASON_SERVER_FULL);
+				if (rejected.write(writer)) {
+					send_packet(address, stream);
+				}
+				return;
+			}
+
+			Connection* connection = connection_pool_.create();
+			if (!connection) {
+				printf("WRN: no more connections in connection pool!\n");
+				return;
 			}
+
+			printf("NFO: challenge accepted, connection established.\n");
+			const Time now = Time::now();
+			connection->service_ = this;
+			connection->set_address(address);
+			connection->set_key(packet.key_);
+			connection->set_challenge(cookie);
+			connection->set_received_time(now);
+			connection->set_connected_time(now);
+			connection->timer_epoch_++;
+			add_established_connection(connection);
+			timers_.schedule(connection, TimerWheel::Kind::Timeout, now + connection_timeout_);
+
+			connection->on_established();
+			notify_service_listeners(Event::Connect, connection);
 		}
 
 		void Service::handle_connection_rejected(const IPAddress& address, NetworkStreamReader& reader)
@@ -1378,13 +4267,45 @@ namespace charlie {
 		void Service::handle_connection_payload(const IPAddress& address, NetworkStreamReader& reader)
 		{
 			//printf("NFO: + handle_connection_payload from %s\n", address.as_string());
-			Connection* connection = find_established_connection(address);
-			if (!connection) {
-				printf("WRN: no matching established connection found!\n");
-				if (allow_connections_) {
+
+			// note: peek the header on a copy, the connection reads the whole packet
+			NetworkStreamReader header_reader(reader);
+			ProtocolDataPacket header;
+			if (!header.read(header_reader)) {
+				printf("WRN: could not read data packet header!\n");
+				return;
+			}
+
+			Connection* connection = nullptr;
+			if (allow_connections_) {
+				connection = connection_pool_.find(header.connection_);
+				if (connection && !connection->is_endpoint(address)) {
+					// note: same host on a new port is a nat rebinding, the session
+					//       follows the client only for a packet that carries its
+					//       tag and is newer than anything received, so neither a
+					//       guessed id nor a late packet from the old port moves it
+					const bool rebind = connection->is_connected() &&
+						connection->address_.host_ == address.host_ &&
+						header.tag_ == connection->data_tag(header.sequence_, header.acknowledge_, header.ack_bits_, header.ticks_) &&
+						(!connection->has_received_ || is_sequence_newer(header.sequence_, connection->acknowledge_));
+					if (rebind) {
+						printf("NFO: connection %u rebound to %s\n", connection->id_, address.as_string());
+						connection->set_address(address);
+					}
+					else {
+						connection = nullptr;
+					}
+				}
+
+				if (!connection) {
+					printf("WRN: no matching established connection found!\n");
 					return;
 				}
-				else {
+			}
+			else {
+				connection = find_established_connection(address);
+				if (!connection) {
+					printf("WRN: no matching established connection found!\n");
 					printf("NFO: trying to find a pending connection.\n");
 					connection = find_pending_connection(address);
 					if (!connection) {
@@ -1398,6 +4319,9 @@ namespace charlie {
 				printf("NFO: challenge accepted, connection established!\n");
 				add_established_connection(connection);
 
+				// note: the server assigns our id, echo it in every data packet
+				connection->set_id(header.connection_);
+
 				const Time now = Time::now();
 				connection->set_received_time(now);
 				connection->set_connected_time(now);
@@ -1406,18 +4330,89 @@ namespace charlie {
 			}
 
 			if (connection->is_connected()) {
-				connection->set_received_time(Time::now());
+				connection->set_received_time(received_time_);
 				connection->receive(reader);
-				if (allow_connections_) {
+			}
+		}
 
+		namespace {
+			template <typename Packet>
+			bool peek_connection_id(const NetworkStreamReader& reader, uint16& id)
+			{
+				NetworkStreamReader header_reader(reader);
+				Packet header;
+				if (!header.read(header_reader)) {
+					return false;
 				}
+
+				id = header.connection_;
+				return true;
+			}
+		} // !anon
+
+		void Service::handle_connection_fragment(const IPAddress& address, NetworkStreamReader& reader)
+		{
+			uint16 id = 0;
+			if (!peek_connection_id<ProtocolFragmentPacket>(reader, id)) {
+				printf("WRN: could not read fragment packet header!\n");
+				return;
 			}
+
+			Connection* connection = allow_connections_ ?
+				find_established_connection(id, address) :
+				find_established_connection(address);
+			if (!connection || !connection->is_connected()) {
+				return;
+			}
+
+			connection->set_received_time(received_time_);
+			connection->receive_fragment(reader);
+		}
+
+		void Service::handle_connection_fragment_ack(const IPAddress& address, NetworkStreamReader& reader)
+		{
+			uint16 id = 0;
+			if (!peek_connection_id<ProtocolFragmentAckPacket>(reader, id)) {
+				printf("WRN: could not read fragment ack packet header!\n");
+				return;
+			}
+
+			Connection* connection = allow_connections_ ?
+				find_established_connection(id, address) :
+				find_established_connection(address);
+			if (!connection || !connection->is_connected()) {
+				return;
+			}
+
+			connection->set_received_time(received_time_);
+			connection->receive_fragment_ack(reader);
 		}
 
 		void Service::handle_connection_disconnect(const IPAddress& address, NetworkStreamReader& reader)
 		{
 			printf("NFO: + handle_connection_disconnect from %s\n", address.as_string());
-			Connection* connection = find_established_connection(address);
+
+			ProtocolDisconnectPacket packet;
+			if (!packet.read(reader)) {
+				printf("WRN: could not read disconnect packet!\n");
+				return;
+			}
+
+			// note: a client that has moved to a new port is found by its id,
+			//       the tag keeps anyone else on the host from hanging it up
+			Connection* connection = nullptr;
+			if (allow_connections_) {
+				connection = connection_pool_.find(packet.connection_);
+				if (connection && !connection->is_endpoint(address) &&
+					(connection->address_.host_ != address.host_ || packet.tag_ != connection->disconnect_tag()))
+				{
+					connection = nullptr;
+				}
+			}
+			else {
+				connection = find_established_connection(address);
+			}
+
 			if (!connection) {
 				printf("WRN: no matching established connection found!\n");
 				printf("     might already be disconnected?\n");
@@ -1446,14 +4441,14 @@ namespace charlie {
 				return;
 			}
 
-			NetworkStream stream;
+			PacketHandle stream = PacketHandle::acquire();
 			NetworkStreamWriter writer(stream);
 			ProtocolRequestPacket packet(connection->key_);
 			if (!packet.write(writer)) {
 				assert(!"could not write request packet");
 			}
 
-			send_stream(connection, stream);
+			send_packet(connection, stream);
 		}
 
 		void Service::send_connection_response(Connection* connection)
@@ -1462,55 +4457,71 @@ namespace charlie {
 				return;
 			}
 
-			NetworkStream stream;
+			PacketHandle stream = PacketHandle::acquire();
 			NetworkStreamWriter writer(stream);
-			ProtocolResponsePacket packet(connection->key_ ^ connection->challenge_);
+			ProtocolResponsePacket packet(connection->key_, connection->key_ ^ connection->challenge_);
 			if (!packet.write(writer)) {
 				assert(!"could not write response packet");
 			}
 
-			send_stream(connection, stream);
+			send_packet(connection, stream);
 		}
 
-		void Service::send_connection_challenge(Connection* connection)
+		void Service::send_connection_challenge(const IPAddress& address, const uint64 challenge)
 		{
-			NetworkStream stream;
+			PacketHandle stream = PacketHandle::acquire();
 			NetworkStreamWriter writer(stream);
-			ProtocolChallengePacket packet(connection->challenge_);
+			ProtocolChallengePacket packet(challenge);
 			if (!packet.write(writer)) {
 				assert(!"could not write challenge packet");
 			}
 
-			send_stream(connection, stream);
+			send_packet(address, stream);
 		}
 
 		void Service::send_connection_rejected(Connection* connection, const uint8 reason)
 		{
-			NetworkStream stream;
+			PacketHandle stream = PacketHandle::acquire();
 			NetworkStreamWriter writer(stream);
 			ProtocolRejectedPacket packet(reason);
 			if (!packet.write(writer)) {
 				assert(!"could not write rejected packet");
 			}
 
-			send_stream(connection, stream);
+			send_packet(connection, stream);
 		}
 
 		void Service::send_connection_disconnect(Connection* connection)
 		{
-			NetworkStream stream;
+			PacketHandle stream = PacketHandle::acquire();
 			NetworkStreamWriter writer(stream);
-			ProtocolDisconnectPacket packet;
+			ProtocolDisconnectPacket packet(connection->id_, connection->disconnect_tag());
 			if (!packet.write(writer)) {
 				assert(!"could not write disconnect packet");
 			}
 
-			send_stream(connection, stream);
+			send_packet(connection, stream);
 		}
 
 		void Service::send_stream(Connection* connection, const NetworkStream& stream)
 		{
-			if (!socket_.is_valid()) {
+			PacketHandle packet = PacketHandle::acquire();
+			memcpy(packet.data(), stream.buffer_, static_cast<size_t>(stream.length_));
+			packet.set_length(stream.length_);
+			send_packet(connection, packet);
+		}
+
+		void Service::send_stream(const IPAddress& address, const NetworkStream& stream)
+		{
+			PacketHandle packet = PacketHandle::acquire();
+			memcpy(packet.data(), stream.buffer_, static_cast<size_t>(stream.length_));
+			packet.set_length(stream.length_);
+			send_packet(address, packet);
+		}
+
+		void Service::send_packet(Connection* connection, const PacketHandle& packet)
+		{
+			if (!transport_ || !transport_->is_valid()) {
 				return;
 			}
 
@@ -1519,85 +4530,329 @@ namespace charlie {
 			}
 
 			connection->set_sent_time(Time::now());
-			if (!socket_.send(connection->address_, stream.buffer_, stream.length_)) {
-				const int32 error_code = Error::get_last();
-				if (Error::is_critical(error_code)) {
-					// todo: handle socket error
-					assert(false);
-				}
+			queue_datagram(connection->address_, packet);
+		}
+
+		void Service::send_packet(const IPAddress& address, const PacketHandle& packet)
+		{
+			if (!transport_ || !transport_->is_valid()) {
+				return;
+			}
+
+			queue_datagram(address, packet);
+		}
 
+		void Service::queue_datagram(const IPAddress& address, const PacketHandle& packet)
+		{
+			if (send_conditioner_.is_enabled()) {
+				send_conditioner_.submit(Time::now(), address, packet);
 				return;
 			}
+
+			append_datagram(address, packet);
 		}
 
-		void Service::send_stream(const IPAddress& address, const NetworkStream& stream)
+		void Service::append_datagram(const IPAddress& address, const PacketHandle& packet)
 		{
-			if (!socket_.is_valid()) {
+			if (send_queue_count_ == static_cast<int32>(send_queue_.size())) {
+				send_queue_.resize(send_queue_.size() * 2);
+			}
+
+			// note: the queue shares the buffer, nothing is copied until the kernel
+			Datagram& datagram = send_queue_[send_queue_count_++];
+			datagram.address_ = address;
+			datagram.packet_ = packet;
+		}
+
+		void Service::process_datagram(const IPAddress& address, const PacketHandle& packet)
+		{
+			if (receive_conditioner_.is_enabled()) {
+				receive_conditioner_.submit(received_time_, address, packet);
+				return;
+			}
+
+			NetworkStreamReader reader(packet);
+			handle_datagram(address, reader);
+		}
+
+		void Service::release_conditioned(const Time& time)
+		{
+			// note: conditioned datagrams arrive when their delay is over,
+			//       which is also what round trip times get to see
+			IPAddress address;
+			PacketHandle packet;
+			while (receive_conditioner_.poll(time, address, packet)) {
+				received_time_ = time;
+				NetworkStreamReader reader(packet);
+				handle_datagram(address, reader);
+			}
+
+			while (send_conditioner_.poll(time, address, packet)) {
+				append_datagram(address, packet);
+			}
+		}
+
+		void Service::flush()
+		{
+			if (send_queue_count_ == 0) {
+				return;
+			}
+
+			datagrams_sent.add(static_cast<uint64>(send_queue_count_));
+
+			if (threaded_) {
+				// note: the network thread owns the socket, hand the datagrams
+				//       over and wait for room if it falls behind
+				for (int32 index = 0; index < send_queue_count_; index++) {
+					Datagram& datagram = send_queue_[index];
+					Datagram* entry = outbound_.acquire();
+					while (!entry && running_.load(std::memory_order_acquire)) {
+						std::this_thread::yield();
+						entry = outbound_.acquire();
+					}
+
+					if (!entry) {
+						break;
+					}
+
+					entry->address_ = datagram.address_;
+					entry->packet_ = std::move(datagram.packet_);
+					outbound_.commit();
+				}
+
+				release_send_queue();
 				return;
 			}
 
-			if (!socket_.send(address, stream.buffer_, stream.length_)) {
+			// note: everything produced during this update goes out in as few
+			//       syscalls as the platform allows
+			const int32 sent = transport_->send_batch(send_queue_.data(), send_queue_count_, send_counters_);
+			if (sent < send_queue_count_) {
 				const int32 error_code = Error::get_last();
 				if (Error::is_critical(error_code)) {
 					// todo: handle socket error
 					assert(false);
 				}
 			}
+
+			release_send_queue();
 		}
 
-		void Service::perform_periodic_timeout_check(const Time& time)
+		void Service::release_send_queue()
 		{
-			if ((time - last_timeout_check_) >= Time(0.1)) {
-				last_timeout_check_ = time;
+			for (int32 index = 0; index < send_queue_count_; index++) {
+				send_queue_[index].packet_.reset();
+			}
+			send_queue_count_ = 0;
+		}
 
-				for (auto it = pending_connections_.begin();
-					it != pending_connections_.end();
-					)
-				{
-					if ((*it)->has_timedout(time)) {
-						printf("NFO: pending connection timeout from %s\n", (*it)->address_.as_string());
-						(*it)->on_timedout();
-						it = pending_connections_.erase(it);
-					}
-					else {
-						++it;
+		void Service::run_network_thread()
+		{
+			DynamicArray<Datagram> receive_batch(receive_batch_.size());
+			DynamicArray<Datagram> send_batch(receive_batch_.size());
+			const int32 batch_size = static_cast<int32>(receive_batch.size());
+
+#if defined(_WIN32)
+			// note: the default timer period turns a 1 ms wait into 15.6 ms,
+			//       late enough to skew arrival times and hold back sends
+			timeBeginPeriod(1);
+#endif
+
+			while (true) {
+				const bool running = running_.load(std::memory_order_acquire);
+
+				prepare_receive_batch(receive_batch.data(), batch_size);
+				int32 received = transport_->receive_batch(receive_batch.data(), batch_size);
+				if (received < 0) {
+					const int32 error_code = Error::get_last();
+					if (Error::is_critical(error_code)) {
+						printf("WRN: network thread receive error %d\n", error_code);
 					}
+					received = 0;
 				}
 
-				for (auto it = established_connections_.begin();
-					it != established_connections_.end();
-					)
-				{
-					Connection* connection = (*it);
-					if (!connection->is_valid()) {
-						it = established_connections_.erase(it);
-						if (allow_connections_) {
-							connection_pool_.release(connection);
-						}
+				// note: timestamp on arrival and drop garbage before it
+				//       reaches the game thread
+				const Time now = Time::now();
+				for (int32 index = 0; index < received; index++) {
+					Datagram& datagram = receive_batch[index];
+					if (!is_known_packet(datagram)) {
+						continue;
 					}
-					else if (connection->has_timedout(time)) {
-						printf("NFO: established connection timeout from %s\n", connection->address_.as_string());
-						notify_service_listeners(Event::Timeout, connection);
-						connection->on_timedout();
-						connection->invalidate();
-						it = established_connections_.erase(it);
-						if (allow_connections_) {
-							connection_pool_.release(connection);
-						}
+
+					// note: a stalled game thread drops datagrams just like
+					//       a full socket receive buffer would
+					ReceivedDatagram* entry = inbound_.acquire();
+					if (!entry) {
+						break;
 					}
-					else if (connection->is_disconnected()) {
-						notify_service_listeners(Event::Disconnect, connection);
-						connection->invalidate();
-						it = established_connections_.erase(it);
-						if (allow_connections_) {
-							connection_pool_.release(connection);
-						}
+
+					// note: the buffer moves into the queue, the slot keeps the
+					//       previous one which prepare_receive_batch recycles
+					entry->time_ = now;
+					entry->address_ = datagram.address_;
+					std::swap(entry->packet_, datagram.packet_);
+					inbound_.commit();
+				}
+
+				int32 count = 0;
+				while (count < batch_size) {
+					Datagram* entry = outbound_.front();
+					if (!entry) {
+						break;
 					}
-					else {
-						++it;
+
+					Datagram& datagram = send_batch[count++];
+					datagram.address_ = entry->address_;
+					datagram.packet_ = std::move(entry->packet_);
+					outbound_.release();
+				}
+
+				if (count > 0) {
+					transport_->send_batch(send_batch.data(), count, send_counters_);
+					for (int32 index = 0; index < count; index++) {
+						send_batch[index].packet_.reset();
 					}
 				}
+
+				// note: keep going after shutdown until the outbound queue is empty
+				if (!running && count == 0) {
+					break;
+				}
+
+				// note: wake on the next datagram, outbound ones wait at most
+				//       the timeout for the ring to be drained
+				if (received == 0 && count == 0) {
+					transport_->wait(Time(0.001));
+				}
+			}
+
+#if defined(_WIN32)
+			timeEndPeriod(1);
+#endif
+		}
+
+		int64 Service::cookie_bucket(const Time& time) const
+		{
+			return time.as_ticks() / Time(COOKIE_BUCKET_TIME).as_ticks();
+		}
+
+		void Service::process_timers(const Time& time)
+		{
+			expired_timers_.clear();
+			timers_.advance(time, expired_timers_);
+
+			for (const TimerWheel::Timer& timer : expired_timers_) {
+				Connection* connection = timer.connection_;
+				if (connection->timer_epoch_ != timer.epoch_) {
+					continue;
+				}
+
+				switch (timer.kind_) {
+				case TimerWheel::Kind::Handshake:
+					on_handshake_timer(connection, time);
+					break;
+				case TimerWheel::Kind::Keepalive:
+					on_keepalive_timer(connection, time);
+					break;
+				case TimerWheel::Kind::Timeout:
+					on_timeout_timer(connection, time);
+					break;
+				}
+			}
+		}
+
+		void Service::on_handshake_timer(Connection* connection, const Time& time)
+		{
+			if (!connection->in_pending_list_) {
+				return;
+			}
+
+			if (connection->is_requesting()) {
+				send_connection_request(connection);
+			}
+			else if (connection->is_responding()) {
+				send_connection_response(connection);
+			}
+			else {
+				return;
+			}
+
+			timers_.schedule(connection, TimerWheel::Kind::Handshake, time + handshake_resend_time_);
+		}
+
+		void Service::on_keepalive_timer(Connection* connection, const Time& time)
+		{
+			if (!connection->in_established_list_ || reap_established_connection(connection)) {
+				return;
+			}
+
+			// note: a quiet connection still sends now and then so the other
+			//       side keeps seeing acks and does not time out
+			if (connection->is_connected() && (time - connection->last_sent_time_) >= keepalive_time_) {
+				connection->send();
+			}
+
+			timers_.schedule(connection, TimerWheel::Kind::Keepalive, time + keepalive_time_);
+		}
+
+		void Service::on_timeout_timer(Connection* connection, const Time& time)
+		{
+			if (connection->in_pending_list_) {
+				if (!connection->has_timedout(time, connection_timeout_)) {
+					timers_.schedule(connection, TimerWheel::Kind::Timeout, connection->last_received_time_ + connection_timeout_);
+					return;
+				}
+
+				printf("NFO: pending connection timeout from %s\n", connection->address_.as_string());
+				remove_pending_connection(connection);
+				connection->on_timedout();
+				if (allow_connections_) {
+					connection_pool_.release(connection);
+				}
+				return;
+			}
+
+			if (!connection->in_established_list_ || reap_established_connection(connection)) {
+				return;
+			}
+
+			// note: receiving never touches the wheel, the timer just moves
+			//       itself to the new deadline when it finds one
+			if (!connection->has_timedout(time, connection_timeout_)) {
+				timers_.schedule(connection, TimerWheel::Kind::Timeout, connection->last_received_time_ + connection_timeout_);
+				return;
+			}
+
+			printf("NFO: established connection timeout from %s\n", connection->address_.as_string());
+			remove_established_connection(connection);
+			notify_service_listeners(Event::Timeout, connection);
+			connection->on_timedout();
+			connection->invalidate();
+			if (allow_connections_) {
+				connection_pool_.release(connection);
 			}
 		}
+
+		bool Service::reap_established_connection(Connection* connection)
+		{
+			if (!connection->is_valid()) {
+				remove_established_connection(connection);
+			}
+			else if (connection->is_disconnected()) {
+				remove_established_connection(connection);
+				notify_service_listeners(Event::Disconnect, connection);
+				connection->invalidate();
+			}
+			else {
+				return false;
+			}
+
+			if (allow_connections_) {
+				connection_pool_.release(connection);
+			}
+
+			return true;
+		}
 	} // !network
 } // !charlie
@@ -55,12 +55,14 @@ namespace charlie {
 
 		ProtocolResponsePacket::ProtocolResponsePacket()
 			: type_(PROTOCOL_PACKET_RESPONSE)
+			, key_(0)
 			, response_(0)
 		{
 		}
 
-		ProtocolResponsePacket::ProtocolResponsePacket(const uint64 response)
+		ProtocolResponsePacket::ProtocolResponsePacket(const uint64 key, const uint64 response)
 			: type_(PROTOCOL_PACKET_RESPONSE)
+			, key_(key)
 			, response_(response)
 		{
 		}
@@ -99,22 +101,27 @@ namespace charlie {
 
 		ProtocolDataPacket::ProtocolDataPacket()
 			: type_(PROTOCOL_PACKET_DATA)
+			, connection_(0)
 			, sequence_(0)
 			, acknowledge_(0)
 			, ack_bits_(0)
 			, ticks_(0)
+			, tag_(0)
 		{
 		}
 
-		ProtocolDataPacket::ProtocolDataPacket(const uint16 sequence,
+		ProtocolDataPacket::ProtocolDataPacket(const uint16 connection,
+			const uint16 sequence,
 			const uint16 acknowledge,
 			const uint32 ack_bits,
 			const uint32 ticks)
 			: type_(PROTOCOL_PACKET_DATA)
+			, connection_(connection)
 			, sequence_(sequence)
 			, acknowledge_(acknowledge)
 			, ack_bits_(ack_bits)
 			, ticks_(ticks)
+			, tag_(0)
 		{
 		}
 
@@ -128,8 +135,106 @@ namespace charlie {
 			return serialize(writer);
 		}
 
+		ProtocolChannelMessage::ProtocolChannelMessage()
+			: channel_(0)
+			, id_(0)
+			, length_(0)
+		{
+		}
+
+		ProtocolChannelMessage::ProtocolChannelMessage(const uint8 channel,
+			const uint16 id,
+			const uint16 length)
+			: channel_(channel)
+			, id_(id)
+			, length_(length)
+		{
+		}
+
+		bool ProtocolChannelMessage::read(NetworkStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool ProtocolChannelMessage::write(NetworkStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
+		ProtocolFragmentPacket::ProtocolFragmentPacket()
+			: type_(PROTOCOL_PACKET_FRAGMENT)
+			, connection_(0)
+			, message_(0)
+			, index_(0)
+			, count_(0)
+			, length_(0)
+		{
+		}
+
+		ProtocolFragmentPacket::ProtocolFragmentPacket(const uint16 connection,
+			const uint16 message,
+			const uint8 index,
+			const uint8 count,
+			const uint16 length)
+			: type_(PROTOCOL_PACKET_FRAGMENT)
+			, connection_(connection)
+			, message_(message)
+			, index_(index)
+			, count_(count)
+			, length_(length)
+		{
+		}
+
+		bool ProtocolFragmentPacket::read(NetworkStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool ProtocolFragmentPacket::write(NetworkStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
+		ProtocolFragmentAckPacket::ProtocolFragmentAckPacket()
+			: type_(PROTOCOL_PACKET_FRAGMENT_ACK)
+			, connection_(0)
+			, message_(0)
+			, received_{}
+		{
+		}
+
+		ProtocolFragmentAckPacket::ProtocolFragmentAckPacket(const uint16 connection,
+			const uint16 message,
+			const uint64 received_low,
+			const uint64 received_high)
+			: type_(PROTOCOL_PACKET_FRAGMENT_ACK)
+			, connection_(connection)
+			, message_(message)
+			, received_{ received_low, received_high }
+		{
+		}
+
+		bool ProtocolFragmentAckPacket::read(NetworkStreamReader& reader)
+		{
+			return serialize(reader);
+		}
+
+		bool ProtocolFragmentAckPacket::write(NetworkStreamWriter& writer)
+		{
+			return serialize(writer);
+		}
+
 		ProtocolDisconnectPacket::ProtocolDisconnectPacket()
 			: type_(PROTOCOL_PACKET_DISCONNECT)
+			, connection_(0)
+			, tag_(0)
+		{
+		}
+
+		ProtocolDisconnectPacket::ProtocolDisconnectPacket(const uint16 connection, const uint32 tag)
+			: type_(PROTOCOL_PACKET_DISCONNECT)
+			, connection_(connection)
+			, tag_(tag)
 		{
 		}
 
@@ -11,11 +11,42 @@ namespace charlie {
 		struct NetworkStreamWriter;
 
 		static constexpr uint32 PROTOCOL_ID = 'CHRL';
-		static constexpr uint32 PROTOCOL_VERSION = 'v.01';
+		static constexpr uint32 PROTOCOL_VERSION = 'v.10';
 
 		static constexpr double CONNECTION_SEND_RATE = 1.0 / 5.0;
 		static constexpr double CONNECTION_TIMEOUT_LIMIT = 5.0;
 
+		// note: fragments fit one datagram together with their header,
+		//       a message is at most MAX_FRAGMENT_COUNT fragments long
+		static constexpr int32 FRAGMENT_SIZE = 1000;
+		static constexpr int32 MAX_FRAGMENT_COUNT = 128;
+		static constexpr int32 MAX_PENDING_MESSAGES = 8;
+		static constexpr int32 FRAGMENTS_PER_UPDATE = 16;
+
+		// note: fragments and reliable channel messages are resent after a
+		//       little over one round trip, but never sooner than this
+		static constexpr double MIN_RESEND_TIME = 0.1;
+
+		// note: service timer defaults, all of them can be changed per service
+		static constexpr double TIMER_RESOLUTION = 0.01;
+		static constexpr double HANDSHAKE_RESEND_TIME = 0.2;
+		static constexpr double KEEPALIVE_TIME = 1.0;
+		static constexpr double CONNECTION_TIMEOUT = 300.0;
+
+		// note: a handshake cookie is accepted in the bucket it was issued
+		//       in and the one after, so it lives between one and two of these
+		static constexpr double COOKIE_BUCKET_TIME = 5.0;
+
+		// note: per source admission limits, well above what a client sends
+		//       at full rate including fragment bursts, a source that was
+		//       quiet for the idle time gives its table slot up
+		static constexpr double ADMISSION_RATE = 1000.0;
+		static constexpr double ADMISSION_BURST = 256.0;
+		static constexpr double ADMISSION_IDLE_TIME = 10.0;
+
+		// note: channel messages share a data packet with the payload
+		static constexpr int32 CHANNEL_PACKET_BUDGET = 512;
+
 		enum ProtocolPacketType {
 			PROTOCOL_PACKET_REQUEST,
 			PROTOCOL_PACKET_CHALLENGE,
@@ -23,6 +54,8 @@ namespace charlie {
 			PROTOCOL_PACKET_REJECTED,
 			PROTOCOL_PACKET_DATA,
 			PROTOCOL_PACKET_DISCONNECT,
+			PROTOCOL_PACKET_FRAGMENT,
+			PROTOCOL_PACKET_FRAGMENT_ACK,
 			PROTOCOL_PACKET_COUNT,
 			PROTOCOL_PACKET_MASTER_SERVER,
 		};
@@ -81,7 +114,7 @@ namespace charlie {
 
 		struct ProtocolResponsePacket {
 			ProtocolResponsePacket();
-			explicit ProtocolResponsePacket(const uint64 response);
+			ProtocolResponsePacket(const uint64 key, const uint64 response);
 
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
@@ -91,11 +124,13 @@ namespace charlie {
 			{
 				bool result = true;
 				result &= stream.serialize(type_);
+				result &= stream.serialize(key_);
 				result &= stream.serialize(response_);
 				return result;
 			}
 
 			uint8 type_;
+			uint64 key_;
 			uint64 response_;
 		};
 
@@ -121,7 +156,8 @@ namespace charlie {
 
 		struct ProtocolDataPacket {
 			ProtocolDataPacket();
-			explicit ProtocolDataPacket(const uint16 sequence,
+			explicit ProtocolDataPacket(const uint16 connection,
+				const uint16 sequence,
 				const uint16 ack,
 				const uint32 ack_bits,
 				const uint32 ticks);
@@ -134,22 +170,114 @@ namespace charlie {
 			{
 				bool result = true;
 				result &= stream.serialize(type_);
+				result &= stream.serialize(connection_);
 				result &= stream.serialize(sequence_);
 				result &= stream.serialize(acknowledge_);
 				result &= stream.serialize(ack_bits_);
 				result &= stream.serialize(ticks_);
+				result &= stream.serialize(tag_);
 				return result;
 			}
 
 			uint8  type_;
+			uint16 connection_;
 			uint16 sequence_;
 			uint16 acknowledge_;
 			uint32 ack_bits_;
 			uint32 ticks_;
+			uint32 tag_; // Keyed hash of the header, proves the session on a new address
+		};
+
+		// note: one per channel message in a data packet ahead of the payload,
+		//       the message bytes follow the header
+		struct ProtocolChannelMessage {
+			ProtocolChannelMessage();
+			explicit ProtocolChannelMessage(const uint8 channel,
+				const uint16 id,
+				const uint16 length);
+
+			bool read(NetworkStreamReader& reader);
+			bool write(NetworkStreamWriter& writer);
+
+			template <typename Stream>
+			bool serialize(Stream& stream)
+			{
+				bool result = true;
+				result &= stream.serialize(channel_);
+				result &= stream.serialize(id_);
+				result &= stream.serialize(length_);
+				return result;
+			}
+
+			uint8  channel_;
+			uint16 id_;
+			uint16 length_;
+		};
+
+		// note: the fragment payload follows the header in the same datagram
+		struct ProtocolFragmentPacket {
+			ProtocolFragmentPacket();
+			explicit ProtocolFragmentPacket(const uint16 connection,
+				const uint16 message,
+				const uint8 index,
+				const uint8 count,
+				const uint16 length);
+
+			bool read(NetworkStreamReader& reader);
+			bool write(NetworkStreamWriter& writer);
+
+			template <typename Stream>
+			bool serialize(Stream& stream)
+			{
+				bool result = true;
+				result &= stream.serialize(type_);
+				result &= stream.serialize(connection_);
+				result &= stream.serialize(message_);
+				result &= stream.serialize(index_);
+				result &= stream.serialize(count_);
+				result &= stream.serialize(length_);
+				return result;
+			}
+
+			uint8  type_;
+			uint16 connection_;
+			uint16 message_;
+			uint8  index_;
+			uint8  count_;
+			uint16 length_;
+		};
+
+		struct ProtocolFragmentAckPacket {
+			ProtocolFragmentAckPacket();
+			explicit ProtocolFragmentAckPacket(const uint16 connection,
+				const uint16 message,
+				const uint64 received_low,
+				const uint64 received_high);
+
+			bool read(NetworkStreamReader& reader);
+			bool write(NetworkStreamWriter& writer);
+
+			template <typename Stream>
+			bool serialize(Stream& stream)
+			{
+				bool result = true;
+				result &= stream.serialize(type_);
+				result &= stream.serialize(connection_);
+				result &= stream.serialize(message_);
+				result &= stream.serialize(received_[0]);
+				result &= stream.serialize(received_[1]);
+				return result;
+			}
+
+			uint8  type_;
+			uint16 connection_;
+			uint16 message_;
+			uint64 received_[2];
 		};
 
 		struct ProtocolDisconnectPacket {
 			ProtocolDisconnectPacket();
+			explicit ProtocolDisconnectPacket(const uint16 connection, const uint32 tag);
 
 			bool read(NetworkStreamReader& reader);
 			bool write(NetworkStreamWriter& writer);
@@ -159,10 +287,14 @@ namespace charlie {
 			{
 				bool result = true;
 				result &= stream.serialize(type_);
+				result &= stream.serialize(connection_);
+				result &= stream.serialize(tag_);
 				return result;
 			}
 
 			uint8 type_;
+			uint16 connection_;
+			uint32 tag_;
 		};
 	} // !network
 } // !charlie
@@ -2,14 +2,24 @@
 
 #include <charlie.hpp>
 
+#if defined(_WIN32)
 #define NOMINMAX
 #include <Windows.h>
 #include <windowsx.h>
 #include <ShellScalingApi.h> // SetProcessDpiAwareness
 #include <gl/GL.h>
+#else
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#endif
 #include <cmath>
+#include <cstdlib>
 #include <SDL_stdinc.h>
 
+#if defined(_WIN32)
 struct input_t {
 	charlie::Mouse mouse_;
 	charlie::Keyboard keyboard_;
@@ -347,6 +357,7 @@ win32_main_proc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 
 	return result;
 }
+#endif // _WIN32
 
 namespace charlie {
 	
@@ -552,7 +563,7 @@ namespace charlie {
 
 	float Vector2::length() const
 	{
-		return std::sqrtf(x_ * x_ + y_ * y_);
+		return std::sqrt(x_ * x_ + y_ * y_);
 	}
 
 	void Vector2::normalize()
@@ -568,7 +579,14 @@ namespace charlie {
 	//static 
 	void Time::sleep(const Time& slice)
 	{
+#if defined(_WIN32)
 		Sleep((DWORD)(slice.as_ticks() / 1000));
+#else
+		timespec duration = {};
+		duration.tv_sec = static_cast<time_t>(slice.as_ticks() / 1000000);
+		duration.tv_nsec = static_cast<long>((slice.as_ticks() % 1000000) * 1000);
+		nanosleep(&duration, nullptr);
+#endif
 	}
 
 	Time Time::deltatime()
@@ -582,6 +600,7 @@ namespace charlie {
 
 	Time Time::now()
 	{
+#if defined(_WIN32)
 		static LARGE_INTEGER start = {};
 		static LARGE_INTEGER frequecy = {};
 		if (!start.QuadPart) {
@@ -594,6 +613,19 @@ namespace charlie {
 		QueryPerformanceCounter(&current);
 
 		return Time((current.QuadPart - start.QuadPart) / frequecy.QuadPart);
+#else
+		static timespec start = {};
+		if (!start.tv_sec && !start.tv_nsec) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+		}
+
+		timespec current = {};
+		clock_gettime(CLOCK_MONOTONIC, &current);
+
+		const int64 seconds = int64(current.tv_sec - start.tv_sec);
+		const int64 nanoseconds = int64(current.tv_nsec - start.tv_nsec);
+		return Time(seconds * 1000000 + nanoseconds / 1000);
+#endif
 	}
 
 	Time::Time()
@@ -696,6 +728,7 @@ namespace charlie {
 
 	bool FileContent::load(const char* filename)
 	{
+#if defined(_WIN32)
 		HANDLE handle = CreateFileA(filename,
 			GENERIC_READ,
 			FILE_SHARE_READ,
@@ -726,16 +759,140 @@ namespace charlie {
 		data_ = data;
 
 		return true;
+#else
+		const int handle = open(filename, O_RDONLY);
+		if (handle < 0) {
+			return false;
+		}
+
+		struct stat info = {};
+		if (fstat(handle, &info) != 0 || info.st_size == 0) {
+			close(handle);
+			return false;
+		}
+
+		const uint64 size = static_cast<uint64>(info.st_size);
+		uint8* data = (uint8*)malloc(size);
+		if (!data || read(handle, data, size) != static_cast<ssize_t>(size)) {
+			free(data);
+			close(handle);
+			return false;
+		}
+
+		close(handle);
+
+		size_ = size;
+		data_ = data;
+
+		return true;
+#endif
 	}
 
 	void FileContent::release()
 	{
 		if (data_) {
+#if defined(_WIN32)
 			VirtualFree(data_, 0, MEM_RELEASE);
+#else
+			free(data_);
+#endif
+		}
+
+		size_ = 0;
+		data_ = nullptr;
+	}
+
+	MappedFile::MappedFile()
+		: size_(0)
+		, data_(nullptr)
+		, mapping_(nullptr)
+	{
+	}
+
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+	bool MappedFile::open(const char* filename)
+	{
+		close();
+
+#if defined(_WIN32)
+		HANDLE handle = CreateFileA(filename,
+			GENERIC_READ,
+			FILE_SHARE_READ,
+			NULL,
+			OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL,
+			NULL);
+		if (handle == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		LARGE_INTEGER size = {};
+		if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+			CloseHandle(handle);
+			return false;
+		}
+
+		// note: the view keeps the file open, both handles can go right away
+		HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(handle);
+		if (!mapping) {
+			return false;
+		}
+
+		const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (!data) {
+			return false;
+		}
+
+		size_ = static_cast<uint64>(size.QuadPart);
+		data_ = static_cast<const uint8*>(data);
+		mapping_ = const_cast<void*>(data);
+
+		return true;
+#else
+		const int handle = ::open(filename, O_RDONLY);
+		if (handle < 0) {
+			return false;
+		}
+
+		struct stat info = {};
+		if (fstat(handle, &info) != 0 || info.st_size == 0) {
+			::close(handle);
+			return false;
+		}
+
+		void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, handle, 0);
+		::close(handle);
+		if (data == MAP_FAILED) {
+			return false;
+		}
+
+		size_ = static_cast<uint64>(info.st_size);
+		data_ = static_cast<const uint8*>(data);
+		mapping_ = data;
+
+		return true;
+#endif
+	}
+
+	void MappedFile::close()
+	{
+		if (mapping_) {
+#if defined(_WIN32)
+			UnmapViewOfFile(mapping_);
+#else
+			munmap(mapping_, static_cast<size_t>(size_));
+#endif
 		}
 
 		size_ = 0;
 		data_ = nullptr;
+		mapping_ = nullptr;
 	}
 
 	Mouse::Mouse()
@@ -0,0 +1,575 @@
+// charlie_uring.cc
+
+#include "charlie_uring.hpp"
+#include "charlie_network.hpp"
+
+#if defined(__linux__)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#endif
+
+namespace charlie {
+	namespace network {
+#if defined(__linux__)
+		struct IORing::Ring {
+			void* sq_memory_;
+			size_t sq_size_;
+			void* cq_memory_;
+			size_t cq_size_;
+			io_uring_sqe* sqes_;
+			size_t sqes_size_;
+			uint32* sq_head_;
+			uint32* sq_tail_;
+			uint32* sq_array_;
+			uint32 sq_mask_;
+			uint32 sq_entries_;
+			uint32* cq_head_;
+			uint32* cq_tail_;
+			io_uring_cqe* cqes_;
+			uint32 cq_mask_;
+		};
+
+		// note: slots hold pooled packets, a completed receive hands its
+		//       packet to the caller and a send keeps its packet alive
+		//       until the kernel is done with it
+		struct IORing::ReceiveSlot {
+			msghdr header_;
+			iovec vector_;
+			sockaddr_in remote_;
+			PacketHandle packet_;
+		};
+
+		struct IORing::SendSlot {
+			msghdr header_;
+			iovec vector_;
+			sockaddr_in remote_;
+			PacketHandle packet_;
+		};
+
+		namespace {
+			enum CompletionKind : uint64 {
+				COMPLETION_RECEIVE = 1,
+				COMPLETION_SEND,
+				COMPLETION_CANCEL,
+			};
+
+			inline uint64 make_user_data(const CompletionKind kind, const int32 slot)
+			{
+				return (static_cast<uint64>(kind) << 32) | static_cast<uint32>(slot);
+			}
+
+			inline int io_uring_setup(const uint32 entries, io_uring_params* params)
+			{
+				return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+			}
+
+			inline int io_uring_enter(const int fd, const uint32 to_submit, const uint32 min_complete, const uint32 flags)
+			{
+				return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+			}
+
+			inline int io_uring_register(const int fd, const uint32 opcode, void* arg, const uint32 count)
+			{
+				return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+			}
+
+			// note: receives on a non-blocking socket need the kernel to arm
+			//       an internal poll (fast poll, 5.7+) instead of completing
+			//       with EAGAIN, and the probe api itself needs 5.6+
+			int open_ring(const uint32 entries, io_uring_params& params)
+			{
+				params = {};
+				const int fd = io_uring_setup(entries, &params);
+				if (fd < 0) {
+					return -1;
+				}
+
+				if ((params.features & IORING_FEAT_FAST_POLL) == 0) {
+					::close(fd);
+					return -1;
+				}
+
+				constexpr uint32 op_count = 64;
+				uint64 storage[(sizeof(io_uring_probe) + op_count * sizeof(io_uring_probe_op)) / sizeof(uint64)] = {};
+				io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(storage);
+				if (io_uring_register(fd, IORING_REGISTER_PROBE, probe, op_count) < 0) {
+					::close(fd);
+					return -1;
+				}
+
+				const uint8 required[] = { IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_ASYNC_CANCEL };
+				for (const uint8 op : required) {
+					if (op > probe->last_op || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0) {
+						::close(fd);
+						return -1;
+					}
+				}
+
+				return fd;
+			}
+
+			bool push(IORing::Ring& ring, const io_uring_sqe& entry)
+			{
+				const uint32 head = __atomic_load_n(ring.sq_head_, __ATOMIC_ACQUIRE);
+				const uint32 tail = *ring.sq_tail_;
+				if (tail - head >= ring.sq_entries_) {
+					return false;
+				}
+
+				const uint32 index = tail & ring.sq_mask_;
+				ring.sqes_[index] = entry;
+				ring.sq_array_[index] = index;
+				__atomic_store_n(ring.sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+				return true;
+			}
+		} // !anon
+
+		// static
+		bool IORing::is_supported()
+		{
+			io_uring_params params = {};
+			const int fd = open_ring(4, params);
+			if (fd < 0) {
+				return false;
+			}
+
+			::close(fd);
+			return true;
+		}
+
+		IORing::IORing()
+			: socket_(~0ull)
+			, fd_(-1)
+			, ring_(nullptr)
+			, receive_slots_(nullptr)
+			, send_slots_(nullptr)
+			, pending_submits_(0)
+			, in_flight_(0)
+		{
+		}
+
+		IORing::~IORing()
+		{
+			close();
+		}
+
+		bool IORing::is_valid() const
+		{
+			return fd_ >= 0;
+		}
+
+		bool IORing::open(const uint64 socket)
+		{
+			if (is_valid()) {
+				close();
+			}
+
+			io_uring_params params = {};
+			fd_ = open_ring(RING_ENTRY_COUNT, params);
+			if (fd_ < 0) {
+				return false;
+			}
+
+			ring_ = new Ring{};
+			ring_->sq_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32);
+			ring_->cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			if (params.features & IORING_FEAT_SINGLE_MMAP) {
+				if (ring_->cq_size_ > ring_->sq_size_) {
+					ring_->sq_size_ = ring_->cq_size_;
+				}
+				ring_->cq_size_ = ring_->sq_size_;
+			}
+
+			ring_->sq_memory_ = mmap(nullptr, ring_->sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+			if (ring_->sq_memory_ == MAP_FAILED) {
+				ring_->sq_memory_ = nullptr;
+				close();
+				return false;
+			}
+
+			if (params.features & IORING_FEAT_SINGLE_MMAP) {
+				ring_->cq_memory_ = ring_->sq_memory_;
+			}
+			else {
+				ring_->cq_memory_ = mmap(nullptr, ring_->cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+				if (ring_->cq_memory_ == MAP_FAILED) {
+					ring_->cq_memory_ = nullptr;
+					close();
+					return false;
+				}
+			}
+
+			ring_->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+			void* sqes = mmap(nullptr, ring_->sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+			if (sqes == MAP_FAILED) {
+				close();
+				return false;
+			}
+
+			uint8* sq = static_cast<uint8*>(ring_->sq_memory_);
+			uint8* cq = static_cast<uint8*>(ring_->cq_memory_);
+			ring_->sqes_ = static_cast<io_uring_sqe*>(sqes);
+			ring_->sq_head_ = reinterpret_cast<uint32*>(sq + params.sq_off.head);
+			ring_->sq_tail_ = reinterpret_cast<uint32*>(sq + params.sq_off.tail);
+			ring_->sq_array_ = reinterpret_cast<uint32*>(sq + params.sq_off.array);
+			ring_->sq_mask_ = *reinterpret_cast<uint32*>(sq + params.sq_off.ring_mask);
+			ring_->sq_entries_ = *reinterpret_cast<uint32*>(sq + params.sq_off.ring_entries);
+			ring_->cq_head_ = reinterpret_cast<uint32*>(cq + params.cq_off.head);
+			ring_->cq_tail_ = reinterpret_cast<uint32*>(cq + params.cq_off.tail);
+			ring_->cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+			ring_->cq_mask_ = *reinterpret_cast<uint32*>(cq + params.cq_off.ring_mask);
+
+			socket_ = socket;
+			receive_slots_ = new ReceiveSlot[RECEIVE_SLOT_COUNT]{};
+			send_slots_ = new SendSlot[SEND_SLOT_COUNT]{};
+			free_send_slots_.clear();
+			for (int32 slot = SEND_SLOT_COUNT - 1; slot >= 0; slot--) {
+				free_send_slots_.push_back(slot);
+			}
+
+			// note: every receive slot stays posted in the kernel, a slot is
+			//       only re-armed after its datagram has been handed out
+			for (int32 slot = 0; slot < RECEIVE_SLOT_COUNT; slot++) {
+				post_receive(slot);
+			}
+
+			if (!submit(false)) {
+				close();
+				return false;
+			}
+
+			return true;
+		}
+
+		void IORing::close()
+		{
+			if (!is_valid()) {
+				return;
+			}
+
+			// note: posted receives keep pointers into our slots, cancel
+			//       them and wait for every completion before freeing
+			if (ring_ && ring_->sqes_) {
+				for (int32 slot = 0; slot < RECEIVE_SLOT_COUNT; slot++) {
+					post_cancel(slot);
+				}
+
+				while (in_flight_ > 0) {
+					if (!submit(true)) {
+						break;
+					}
+					reap();
+				}
+			}
+
+			if (ring_) {
+				if (ring_->sqes_) {
+					munmap(ring_->sqes_, ring_->sqes_size_);
+				}
+				if (ring_->cq_memory_ && ring_->cq_memory_ != ring_->sq_memory_) {
+					munmap(ring_->cq_memory_, ring_->cq_size_);
+				}
+				if (ring_->sq_memory_) {
+					munmap(ring_->sq_memory_, ring_->sq_size_);
+				}
+				delete ring_;
+				ring_ = nullptr;
+			}
+
+			::close(fd_);
+			fd_ = -1;
+
+			delete[] receive_slots_;
+			receive_slots_ = nullptr;
+			delete[] send_slots_;
+			send_slots_ = nullptr;
+			free_send_slots_.clear();
+			ready_receives_ = {};
+			pending_submits_ = 0;
+			in_flight_ = 0;
+		}
+
+		int32 IORing::receive_batch(Datagram* datagrams, const int32 count)
+		{
+			if (!is_valid()) {
+				return -1;
+			}
+
+			reap();
+
+			int32 received = 0;
+			while (received < count && !ready_receives_.empty()) {
+				const int32 slot = ready_receives_.front();
+				ready_receives_.pop();
+
+				ReceiveSlot& receive = receive_slots_[slot];
+				Datagram& datagram = datagrams[received++];
+				datagram.address_.host_ = ntohl(receive.remote_.sin_addr.s_addr);
+				datagram.address_.port_ = ntohs(receive.remote_.sin_port);
+				std::swap(datagram.packet_, receive.packet_);
+
+				post_receive(slot);
+			}
+
+			if (pending_submits_ > 0) {
+				submit(false);
+			}
+
+			if (received == 0) {
+				errno = EAGAIN;
+				return -1;
+			}
+
+			return received;
+		}
+
+		int32 IORing::send_batch(const Datagram* datagrams, const int32 count, SendCounters& counters)
+		{
+			if (!is_valid()) {
+				return 0;
+			}
+
+			reap();
+
+			int32 sent = 0;
+			for (int32 index = 0; index < count; index++) {
+				// note: every send slot is still in flight, push what we have
+				//       and wait for the kernel to hand some slots back
+				if (free_send_slots_.empty()) {
+					counters.syscalls_++;
+					if (!submit(true)) {
+						break;
+					}
+					reap();
+					if (free_send_slots_.empty()) {
+						break;
+					}
+				}
+
+				const int32 slot = free_send_slots_.back();
+				free_send_slots_.pop_back();
+
+				const Datagram& datagram = datagrams[index];
+				SendSlot& send = send_slots_[slot];
+				send.packet_ = datagram.packet_;
+				send.remote_ = {};
+				send.remote_.sin_family = AF_INET;
+				send.remote_.sin_port = htons(datagram.address_.port_);
+				send.remote_.sin_addr.s_addr = htonl(datagram.address_.host_);
+				send.vector_.iov_base = send.packet_.data();
+				send.vector_.iov_len = static_cast<size_t>(send.packet_.length());
+				send.header_ = {};
+				send.header_.msg_name = &send.remote_;
+				send.header_.msg_namelen = sizeof(send.remote_);
+				send.header_.msg_iov = &send.vector_;
+				send.header_.msg_iovlen = 1;
+
+				io_uring_sqe entry = {};
+				entry.opcode = IORING_OP_SENDMSG;
+				entry.fd = static_cast<int32>(socket_);
+				entry.addr = reinterpret_cast<uint64>(&send.header_);
+				entry.len = 1;
+				entry.user_data = make_user_data(COMPLETION_SEND, slot);
+				if (!push(*ring_, entry)) {
+					counters.syscalls_++;
+					submit(false);
+					if (!push(*ring_, entry)) {
+						send.packet_.reset();
+						free_send_slots_.push_back(slot);
+						break;
+					}
+				}
+
+				pending_submits_++;
+				in_flight_++;
+				sent++;
+			}
+
+			// note: the whole batch goes to the kernel with one enter call,
+			//       send errors are not reported back, same as a lost datagram
+			if (pending_submits_ > 0) {
+				counters.syscalls_++;
+				submit(false);
+			}
+			counters.datagrams_ += static_cast<uint64>(sent);
+
+			return sent;
+		}
+
+		void IORing::post_receive(const int32 slot)
+		{
+			ReceiveSlot& receive = receive_slots_[slot];
+			if (!receive.packet_.is_unique()) {
+				receive.packet_ = PacketHandle::acquire();
+			}
+			receive.vector_.iov_base = receive.packet_.data();
+			receive.vector_.iov_len = static_cast<size_t>(receive.packet_.capacity());
+			receive.header_ = {};
+			receive.header_.msg_name = &receive.remote_;
+			receive.header_.msg_namelen = sizeof(receive.remote_);
+			receive.header_.msg_iov = &receive.vector_;
+			receive.header_.msg_iovlen = 1;
+
+			io_uring_sqe entry = {};
+			entry.opcode = IORING_OP_RECVMSG;
+			entry.fd = static_cast<int32>(socket_);
+			entry.addr = reinterpret_cast<uint64>(&receive.header_);
+			entry.len = 1;
+			entry.user_data = make_user_data(COMPLETION_RECEIVE, slot);
+			if (!push(*ring_, entry)) {
+				submit(false);
+				if (!push(*ring_, entry)) {
+					assert(!"io_uring submission queue full!");
+					return;
+				}
+			}
+
+			pending_submits_++;
+			in_flight_++;
+		}
+
+		void IORing::post_cancel(const int32 slot)
+		{
+			io_uring_sqe entry = {};
+			entry.opcode = IORING_OP_ASYNC_CANCEL;
+			entry.fd = -1;
+			entry.addr = make_user_data(COMPLETION_RECEIVE, slot);
+			entry.user_data = make_user_data(COMPLETION_CANCEL, slot);
+			if (!push(*ring_, entry)) {
+				submit(false);
+				if (!push(*ring_, entry)) {
+					return;
+				}
+			}
+
+			pending_submits_++;
+			in_flight_++;
+		}
+
+		bool IORing::submit(const bool wait)
+		{
+			const uint32 flags = wait ? IORING_ENTER_GETEVENTS : 0;
+			while (true) {
+				const int r = io_uring_enter(fd_, pending_submits_, wait ? 1 : 0, flags);
+				if (r < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					return false;
+				}
+
+				pending_submits_ -= static_cast<uint32>(r) < pending_submits_ ? static_cast<uint32>(r) : pending_submits_;
+				return true;
+			}
+		}
+
+		void IORing::reap()
+		{
+			// note: the completion queue lives in shared memory, reaping
+			//       it is plain loads and stores without entering the kernel
+			uint32 head = *ring_->cq_head_;
+			const uint32 tail = __atomic_load_n(ring_->cq_tail_, __ATOMIC_ACQUIRE);
+			while (head != tail) {
+				const io_uring_cqe& completion = ring_->cqes_[head & ring_->cq_mask_];
+				const CompletionKind kind = static_cast<CompletionKind>(completion.user_data >> 32);
+				const int32 slot = static_cast<int32>(completion.user_data & 0xffffffffull);
+				in_flight_--;
+
+				if (kind == COMPLETION_RECEIVE) {
+					if (completion.res >= 0) {
+						receive_slots_[slot].packet_.set_length(completion.res);
+						ready_receives_.push(slot);
+					}
+					else if (completion.res != -ECANCELED) {
+						// note: icmp errors from a previous send surface here
+						post_receive(slot);
+					}
+				}
+				else if (kind == COMPLETION_SEND) {
+					send_slots_[slot].packet_.reset();
+					free_send_slots_.push_back(slot);
+				}
+
+				head++;
+			}
+
+			__atomic_store_n(ring_->cq_head_, head, __ATOMIC_RELEASE);
+		}
+#else
+		struct IORing::Ring {};
+		struct IORing::ReceiveSlot {};
+		struct IORing::SendSlot {};
+
+		// static
+		bool IORing::is_supported()
+		{
+			return false;
+		}
+
+		IORing::IORing()
+			: socket_(~0ull)
+			, fd_(-1)
+			, ring_(nullptr)
+			, receive_slots_(nullptr)
+			, send_slots_(nullptr)
+			, pending_submits_(0)
+			, in_flight_(0)
+		{
+		}
+
+		IORing::~IORing()
+		{
+		}
+
+		bool IORing::is_valid() const
+		{
+			return false;
+		}
+
+		bool IORing::open(const uint64)
+		{
+			return false;
+		}
+
+		void IORing::close()
+		{
+		}
+
+		int32 IORing::receive_batch(Datagram*, const int32)
+		{
+			return -1;
+		}
+
+		int32 IORing::send_batch(const Datagram*, const int32, SendCounters&)
+		{
+			return 0;
+		}
+
+		void IORing::post_receive(const int32)
+		{
+		}
+
+		void IORing::post_cancel(const int32)
+		{
+		}
+
+		bool IORing::submit(const bool)
+		{
+			return false;
+		}
+
+		void IORing::reap()
+		{
+		}
+#endif
+	} // !network
+} // !charlie
@@ -0,0 +1,54 @@
+// charlie_uring.hpp
+
+#ifndef CHARLIE_URING_HPP_INCLUDED
+#define CHARLIE_URING_HPP_INCLUDED
+
+#include <charlie.hpp>
+
+namespace charlie {
+	namespace network {
+		struct Datagram;
+		struct SendCounters;
+
+		// note: linux io_uring backend for UDPSocket, receives stay posted
+		//       in the ring and completions are reaped from shared memory,
+		//       on other platforms open() always fails
+		struct IORing {
+			static constexpr uint32 RING_ENTRY_COUNT = 256;
+			static constexpr int32 RECEIVE_SLOT_COUNT = 64;
+			static constexpr int32 SEND_SLOT_COUNT = 64;
+			static bool is_supported();
+
+			IORing();
+			~IORing();
+
+			bool is_valid() const;
+			bool open(const uint64 socket);
+			void close();
+
+			int32 receive_batch(Datagram* datagrams, const int32 count);
+			int32 send_batch(const Datagram* datagrams, const int32 count, SendCounters& counters);
+
+			struct Ring;
+			struct ReceiveSlot;
+			struct SendSlot;
+
+			void post_receive(const int32 slot);
+			void post_cancel(const int32 slot);
+			bool submit(const bool wait);
+			void reap();
+
+			uint64 socket_;
+			int32 fd_;
+			Ring* ring_;
+			ReceiveSlot* receive_slots_;
+			SendSlot* send_slots_;
+			DynamicArray<int32> free_send_slots_;
+			Queue<int32> ready_receives_;
+			uint32 pending_submits_;
+			uint32 in_flight_;
+		};
+	} // !network
+} // !charlie
+
+#endif // !CHARLIE_URING_HPP_INCLUDED
@@ -2,8 +2,10 @@
 
 
 #include "charlie_messages.hpp"
+#include "charlie_network.hpp"
 #include "config.h"
 #include "leveldata.h"
+#include "map_format.h"
 #include "Singleton.hpp"
 #include "sprite_handler.hpp"
 
@@ -14,7 +16,7 @@ namespace charlie
 	}
 
 	LevelManager::LevelManager() : height_(0), width_(0), spawn_index_(0), state_(LevelManagerState::INITIALIZED),
-		level_id_(0)
+		level_id_(0), hash_(0)
 	{
 	}
 
@@ -28,32 +30,6 @@ namespace charlie
 		return state_ == LevelManagerState::WAITING_FOR_DATA;
 	}
 
-	void LevelManager::create_tile(uint8 level_id, uint8 x, charlie::uint8 y)
-	{
-		const Tile tile{ level_id, x, y };
-		data_.tiles_.push_back(tile);
-		data_.tiles_loaded_ += 1;
-		create_level_object(tile.tile_id_, tile.x_, tile.y_);
-	}
-
-	uint32 LevelManager::get_chunk(const uint32 send_to)
-	{
-		for (auto& send : send_progress_)
-		{
-			if (send.first == send_to)
-			{
-				return send.second;
-			}
-		}
-		return 0;
-	}
-
-	bool LevelManager::is_done_sending() const
-	{
-		printf("Tiles loaded %i \n", data_.tiles_loaded_);
-		return data_.tiles_loaded_ > (data_.sizeY_ * data_.sizeX_) - 1;
-	}
-
 	SDLSprite* LevelManager::load_asset_with_id(int type, int x, int y)
 	{
 		switch (type)
@@ -99,6 +75,13 @@ namespace charlie
 	bool LevelManager::load_assets(Leveldata& data)
 	{
 		data_ = data;
+		if (!CompiledMap::compile(data_, compiled_))
+		{
+			// Still playable here, only clients that lack the map can not get it
+			compiled_.clear();
+		}
+
+		hash_ = data_.content_hash();
 		height_ = data_.sizeY_ * config::LEVEL_OBJECT_HEIGHT;
 		width_ = data_.sizeX_ * config::LEVEL_OBJECT_WIDTH;
 		levelObjects_.resize(data_.sizeY_ * data_.sizeX_);
@@ -114,16 +97,113 @@ namespace charlie
 		return true;
 	}
 
-	void LevelManager::render(SDL_Rect camera, SDL_Renderer* renderer)
+	// note: spawn points and colliders come precomputed from the file, the
+	//       tile grid is only walked for the sprites, the file itself is kept
+	//       so clients that lack the map get it with its layers and objects
+	bool LevelManager::load_compiled(const CompiledMap& map)
 	{
-		for (auto& levelObject : levelObjects_)
+		if (map.header_ == nullptr)
+		{
+			return false;
+		}
+
+		const uint8* bytes = reinterpret_cast<const uint8*>(map.header_);
+		compiled_.assign(bytes, bytes + map.size_);
+
+		const int size_x = map.header_->size_x_;
+		const int size_y = map.header_->size_y_;
+		data_ = Leveldata();
+		data_.sizeX_ = size_x;
+		data_.sizeY_ = size_y;
+		data_.tiles_.resize(size_t(size_x * size_y));
+		hash_ = map.header_->hash_;
+		height_ = size_y * config::LEVEL_OBJECT_HEIGHT;
+		width_ = size_x * config::LEVEL_OBJECT_WIDTH;
+		levelObjects_.resize(data_.tiles_.size());
+
+		for (int y = 0; y < size_y; y++)
 		{
-			if (levelObject.sprite_ == nullptr)
+			for (int x = 0; x < size_x; x++)
 			{
+				const int index = y * size_x + x;
+				const uint8 type = map.tiles_[index];
+				data_.tiles_[index] = Tile{ type, static_cast<uint8>(x), static_cast<uint8>(y) };
+
+				LevelObject& levelObject = levelObjects_[index];
+				levelObject.pos_ = Vector2(x * config::LEVEL_OBJECT_WIDTH, y * config::LEVEL_OBJECT_HEIGHT);
+				levelObject.sprite_ = load_asset_with_id(type, x, y);
+				levelObject.blocked_ = type == COLLIDER;
+			}
+		}
+
+		decorations_.clear();
+		for (int32 layer = 0; layer < map.layer_count_; layer++)
+		{
+			const uint8* cells = map.layers_ + layer * size_x * size_y;
+			for (int index = 0; index < size_x * size_y; index++)
+			{
+				if (cells[index] == 0)
+				{
+					continue;
+				}
+
+				LevelObject decoration;
+				decoration.pos_ = Vector2((index % size_x) * config::LEVEL_OBJECT_WIDTH, (index / size_x) * config::LEVEL_OBJECT_HEIGHT);
+				decoration.sprite_ = load_asset_with_id(cells[index], index % size_x, index / size_x);
+				decorations_.push_back(decoration);
+			}
+		}
+
+		colliders_.resize(size_t(map.collider_count_));
+		for (int32 index = 0; index < map.collider_count_; index++)
+		{
+			const MapRect& rect = map.colliders_[index];
+			LevelObject& collider = colliders_[index];
+			collider.pos_ = Vector2(rect.x_ * config::LEVEL_OBJECT_WIDTH, rect.y_ * config::LEVEL_OBJECT_HEIGHT);
+			collider.collider_ = RectangleCollider((int)collider.pos_.x_, (int)collider.pos_.y_, rect.w_ * config::LEVEL_OBJECT_WIDTH, rect.h_ * config::LEVEL_OBJECT_HEIGHT);
+			collider.blocked_ = true;
+		}
+
+		spawn_points_.resize(size_t(map.spawn_count_));
+		for (int32 index = 0; index < map.spawn_count_; index++)
+		{
+			spawn_points_[index] = Vector2(map.spawns_[index].x_ * config::LEVEL_OBJECT_WIDTH, map.spawns_[index].y_ * config::LEVEL_OBJECT_HEIGHT);
+		}
+
+		// Placed objects are not bound to the grid
+		for (int32 index = 0; index < map.object_count_; index++)
+		{
+			const MapObject& object = map.objects_[index];
+			if (object.type_ == MAP_OBJECT_SPAWN)
+			{
+				spawn_points_.push_back(Vector2(object.x_, object.y_));
 				continue;
 			}
-			SDL_Rect rect = { (int)levelObject.pos_.x_ - camera.x, (int)levelObject.pos_.y_ - camera.y, levelObject.sprite_->get_area().w, levelObject.sprite_->get_area().h };
-			SDL_RenderCopy(renderer, levelObject.sprite_->get_texture(), nullptr, &rect);
+
+			LevelObject collider;
+			collider.pos_ = Vector2(object.x_, object.y_);
+			collider.collider_ = RectangleCollider(object.x_, object.y_, object.w_, object.h_);
+			collider.blocked_ = true;
+			colliders_.push_back(collider);
+		}
+
+		state_ = LevelManagerState::LEVEL_LOADED;
+		return true;
+	}
+
+	void LevelManager::render(SDL_Rect camera, SDL_Renderer* renderer)
+	{
+		for (auto* objects : { &levelObjects_, &decorations_ })
+		{
+			for (auto& levelObject : *objects)
+			{
+				if (levelObject.sprite_ == nullptr)
+				{
+					continue;
+				}
+				SDL_Rect rect = { (int)levelObject.pos_.x_ - camera.x, (int)levelObject.pos_.y_ - camera.y, levelObject.sprite_->get_area().w, levelObject.sprite_->get_area().h };
+				SDL_RenderCopy(renderer, levelObject.sprite_->get_texture(), nullptr, &rect);
+			}
 		}
 	}
 
@@ -138,7 +218,7 @@ namespace charlie
 		return pos;
 	}
 
-	void LevelManager::request_map_data(uint8 level_id, uint8 size_x, uint8 size_y)
+	void LevelManager::request_map_data(uint8 level_id, uint8 size_x, uint8 size_y, uint64 hash)
 	{
 		if (state_ != LevelManagerState::LEVEL_LOADED)
 		{
@@ -146,38 +226,117 @@ namespace charlie
 			data_.sizeX_ = size_x;
 			data_.sizeY_ = size_y;
 			level_id_ = level_id;
+			hash_ = hash;
 			levelObjects_.resize(data_.sizeY_ * data_.sizeX_);
 			state_ = LevelManagerState::WAITING_FOR_DATA;
 		}
 	}
 
-	Tile LevelManager::get_level_data(uint32 player_id)
+	const DynamicArray<uint8>& LevelManager::level_stream()
 	{
-		Tile send{};
-
-		// Continue sending
-		for (auto& progress : send_progress_)
+		if (stream_.empty())
 		{
-			if (progress.first == player_id)
+			DynamicArray<uint8> map;
+			run_length_encode(compiled_.data(), static_cast<int32>(compiled_.size()), map);
+			if (compiled_.empty() || !fits_map_stream(map))
 			{
-				if (progress.second >= (uint32)(data_.sizeY_ * data_.sizeX_))
-				{
-					printf("Trying to get data outsize array");
-					return send;
-				}
-				send = data_.get_tile(progress.second);
-				progress.second += 1;
-				return send;
+				printf("Level stream of %i bytes does not fit one message \n", static_cast<int>(map.size()));
+				return stream_;
+			}
+
+			// Header first, the writer gives back how long it turned out
+			stream_.resize(map.size() + MAP_STREAM_HEADER_SIZE);
+			network::NetworkStreamWriter writer(stream_.data(), static_cast<int32>(stream_.size()));
+			network::NetworkMessageLevelData message(level_id_, static_cast<uint8>(data_.sizeX_), static_cast<uint8>(data_.sizeY_),
+				static_cast<uint32>(map.size()), static_cast<uint32>(compiled_.size()));
+			if (!message.write(writer) || !writer.serialize(map.size(), map.data()))
+			{
+				assert(!"could not write level stream!");
 			}
+			stream_.resize(static_cast<size_t>(writer.length()));
+
+			printf("Level stream %i byte map in %i bytes \n", static_cast<int>(compiled_.size()), static_cast<int>(stream_.size()));
+		}
+
+		return stream_;
+	}
+
+	LevelStreamResult LevelManager::stream_level(network::Connection* connection)
+	{
+		// note: progress is kept per connection slot, a request repeated by
+		//       the same connection is already on its way and is ignored
+		const int32 index = network::ConnectionPool::index_of(connection->id_);
+		if (index >= static_cast<int32>(streamed_to_.size()))
+		{
+			streamed_to_.resize(static_cast<size_t>(index) + 1);
+		}
+
+		if (streamed_to_[index] == connection->id_)
+		{
+			return LevelStreamResult::SENT;
+		}
+
+		// note: the stream is known to fit one message, so the only refusal
+		//       left is the connection's pending message limit
+		const DynamicArray<uint8>& stream = level_stream();
+		if (stream.empty())
+		{
+			return LevelStreamResult::UNAVAILABLE;
+		}
+
+		if (!connection->send_message(stream.data(), static_cast<int32>(stream.size())))
+		{
+			return LevelStreamResult::BUSY;
+		}
+
+		streamed_to_[index] = connection->id_;
+		return LevelStreamResult::SENT;
+	}
+
+	bool LevelManager::receive_level(network::NetworkStreamReader& reader)
+	{
+		network::NetworkMessageLevelData message;
+		if (!message.read(reader))
+		{
+			assert(!"could not read level stream!");
+		}
+
+		if (!waiting_for_data() || message.level_id_ != level_id_)
+		{
+			printf("Ignoring level stream for level %i \n", message.level_id_);
+			return false;
+		}
+
+		if (static_cast<int32>(message.length_) != reader.length() - reader.position())
+		{
+			printf("Level stream length mismatch \n");
+			return false;
+		}
+
+		if (message.size_ == 0 || message.size_ > message.length_ * RUN_LENGTH_MAX_RATIO)
+		{
+			printf("Level stream size %u is not valid \n", message.size_);
+			return false;
+		}
+
+		// note: decoded into words so the map starts 8 byte aligned, the
+		//       hash is recomputed as the header is just as untrusted as the
+		//       rest of the stream
+		DynamicArray<uint64> words((message.size_ + 7) / 8);
+		uint8* bytes = reinterpret_cast<uint8*>(words.data());
+		CompiledMap map;
+		if (!run_length_decode(reader.data() + reader.position(), static_cast<int32>(message.length_), bytes, static_cast<int32>(message.size_)) ||
+			!map.view(bytes, message.size_))
+		{
+			return false;
 		}
+
+		if (map.header_->hash_ != hash_ || map.content_hash() != hash_)
 		{
-			// Send first time
-			std::pair<uint32, uint32> progress(player_id, 0);
-			send = data_.get_tile(progress.second);
-			progress.second += 1;
-			send_progress_.push_back(progress);
+			printf("Level stream does not match the announced hash \n");
+			return false;
 		}
 
-		return send;
+		return load_compiled(map);
 	}
 }
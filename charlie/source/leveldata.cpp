@@ -1,93 +1,98 @@
 ﻿#include "leveldata.h"
 #include <fstream>
-#include <sstream>
+#include <iterator>
 #include <string>
 #include "level_manager.h"
 #include <config.h>
 
 namespace charlie
 {
-	Leveldata::Leveldata() : sizeX_(0), sizeY_(0), tiles_loaded_(0)
+	Leveldata::Leveldata() : sizeX_(0), sizeY_(0)
 	{
 	}
 
-	void Leveldata::get_size(const std::string path)
+	bool Leveldata::create_level(uint8 level_id)
 	{
-		std::ifstream map(path.c_str());
-		//If the map couldn't be loaded
-		if (!map.is_open())
-		{
-			printf("Unable to load map file!\n");
-		}
-
-		std::string line;
-		sizeY_ = 0;
-
-		std::string tile;
-		sizeX_ = 0;
-
-		while (std::getline(map, line)) {
-			++sizeY_;
-
-			if (sizeY_ > 1)
-			{
-				continue;
-			}
-
-			std::stringstream ss(line);
-			while (ss >> tile) {
-				++sizeX_;
-			}
-		}
-
-		map.close();
+		const auto path = config::LEVEL_PATH_PREFIX + "map" + std::to_string(level_id) + ".txt";
+		return load_text(path);
 	}
 
-	bool Leveldata::create_level(uint8 level_id)
+	// note: the whole file is read once and parsed in place, the width is
+	//       taken from the first row and every row must match it
+	bool Leveldata::load_text(const std::string& path)
 	{
-		const auto id_string = "map" + std::to_string(level_id) + ".txt";
-		auto prefix = config::LEVEL_PATH_PREFIX;
-		const auto path = (prefix.append(id_string)).c_str();
-		get_size(path);
-
-		std::ifstream map(path);
-
+		std::ifstream map(path.c_str(), std::ios::binary);
 		if (!map.is_open())
 		{
 			printf("Unable to load map file!\n");
 			return false;
 		}
 
-		tiles_.resize(size_t(sizeY_ * sizeX_));
-
-		for (int y = 0; y < sizeY_; y++) {
-			for (int x = 0; x < sizeX_; x++) {
-
-				//Determines what kind of block will be made
-				int id = -1;
+		const std::string text((std::istreambuf_iterator<char>(map)), std::istreambuf_iterator<char>());
+		map.close();
 
-				//Read block from map file
-				map >> id;
+		tiles_.clear();
+		sizeX_ = 0;
+		sizeY_ = 0;
 
-				//If the was a problem in reading the map
-				if (map.fail())
+		int x = 0;
+		size_t at = 0;
+		while (at <= text.size())
+		{
+			const char c = at < text.size() ? text[at] : '\n';
+			if (c >= '0' && c <= '9')
+			{
+				int id = 0;
+				while (at < text.size() && text[at] >= '0' && text[at] <= '9')
 				{
-					//Stop loading map
-					printf("Error loading map: Unexpected end of file!\n");
-					return false;
+					id = id * 10 + (text[at++] - '0');
+					if (id > 255)
+					{
+						printf("Wrong id for x: %i y: %i", x, sizeY_);
+						return false;
+					}
 				}
-				if (id < 0)
+
+				if (x > 254 || sizeY_ > 254 || (sizeY_ > 0 && x >= sizeX_))
 				{
-					printf("Wrong id for x: %i y: %i", x, y);
+					printf("Error loading map: Row %i is too long!\n", sizeY_);
 					return false;
 				}
 
-				const Tile tile{ static_cast<uint8>(id), static_cast<uint8>(x), static_cast<uint8>(y) };
-				tiles_[y * sizeX_ + x] = tile;
+				tiles_.push_back(Tile{ static_cast<uint8>(id), static_cast<uint8>(x), static_cast<uint8>(sizeY_) });
+				x++;
+				continue;
+			}
 
+			if (c == '\n' && x > 0)
+			{
+				if (sizeY_ == 0)
+				{
+					sizeX_ = x;
+				}
+				else if (x != sizeX_)
+				{
+					//Stop loading map
+					printf("Error loading map: Unexpected end of row %i!\n", sizeY_);
+					return false;
+				}
+				sizeY_++;
+				x = 0;
+			}
+			else if (c != '\n' && c != ' ' && c != '\t' && c != '\r')
+			{
+				printf("Wrong id for x: %i y: %i", x, sizeY_);
+				return false;
 			}
+			at++;
 		}
-		map.close();
+
+		if (sizeY_ == 0)
+		{
+			printf("Error loading map: Unexpected end of file!\n");
+			return false;
+		}
+
 		return true;
 	}
 
@@ -102,23 +107,24 @@ namespace charlie
 		return type;
 	}
 
-	Tile Leveldata::get_tile(uint32 tile_number)
+	// note: 64 bit fnv-1a over the size and the tile ids, the same as the
+	//       hash of the compiled map when it has no layers or objects, two
+	//       maps with the same hash are taken to be the same map
+	uint64 Leveldata::content_hash() const
 	{
-		if (sizeX_ > 255 || sizeY_ > 255)
-		{
-			assert(!"Level size too big");
-		}
-
-		if (sizeX_ <= 0 || sizeY_ <= 0)
+		uint64 hash = 0xcbf29ce484222325ull;
+		const auto mix = [&hash](const uint8 value)
 		{
-			assert(!"Level size zero");
-		}
+			hash ^= value;
+			hash *= 0x100000001b3ull;
+		};
 
-		if (tile_number > tiles_.size())
+		mix(static_cast<uint8>(sizeX_));
+		mix(static_cast<uint8>(sizeY_));
+		for (const auto& tile : tiles_)
 		{
-			assert(!"Trying to get tile outside the map");
+			mix(tile.tile_id_);
 		}
-		tiles_loaded_ += 1;
-		return tiles_[tile_number];
+		return hash;
 	}
 }
@@ -0,0 +1,191 @@
+﻿#include "map_cache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "map_format.h"
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace charlie
+{
+	namespace
+	{
+		bool make_directory(const std::string& directory)
+		{
+#if defined(_WIN32)
+			return _mkdir(directory.c_str()) == 0 || errno == EEXIST;
+#else
+			return mkdir(directory.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+		}
+	}
+
+	MapCache::MapCache() : capacity_(0), size_(0), clock_(0)
+	{
+	}
+
+	bool MapCache::open(const std::string& directory, const uint64 capacity)
+	{
+		directory_ = directory;
+		capacity_ = capacity;
+		size_ = 0;
+		clock_ = 0;
+		entries_.clear();
+
+		if (!make_directory(directory_))
+		{
+			printf("Unable to create map cache directory %s \n", directory_.c_str());
+			return false;
+		}
+
+		read_index();
+		trim();
+		return true;
+	}
+
+	bool MapCache::load(const uint64 hash, CompiledMap& map)
+	{
+		Entry* entry = find(hash);
+		if (!entry)
+		{
+			return false;
+		}
+
+		// Any entry that does not read back as the map it claims to be is dropped
+		if (!map.open(path_of(hash).c_str()) || map.header_->hash_ != hash || map.content_hash() != hash)
+		{
+			printf("Map cache entry %016llx is invalid \n", static_cast<unsigned long long>(hash));
+			map.close();
+			evict(hash);
+			write_index();
+			return false;
+		}
+
+		entry->last_used_ = ++clock_;
+		write_index();
+		return true;
+	}
+
+	bool MapCache::store(const uint64 hash, const DynamicArray<uint8>& map)
+	{
+		if (directory_.empty() || map.empty() || find(hash))
+		{
+			return false;
+		}
+
+		std::ofstream file(path_of(hash).c_str(), std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(map.data()), static_cast<std::streamsize>(map.size()));
+		if (!file.good())
+		{
+			printf("Unable to write map cache entry %016llx \n", static_cast<unsigned long long>(hash));
+			file.close();
+			std::remove(path_of(hash).c_str());
+			return false;
+		}
+		file.close();
+
+		entries_.push_back(Entry{ hash, map.size(), ++clock_ });
+		size_ += map.size();
+		trim();
+		write_index();
+		return true;
+	}
+
+	void MapCache::evict(const uint64 hash)
+	{
+		for (auto it = entries_.begin(); it != entries_.end(); ++it)
+		{
+			if (it->hash_ == hash)
+			{
+				std::remove(path_of(hash).c_str());
+				size_ -= it->size_;
+				entries_.erase(it);
+				return;
+			}
+		}
+	}
+
+	void MapCache::trim()
+	{
+		while (size_ > capacity_ && !entries_.empty())
+		{
+			auto oldest = entries_.begin();
+			for (auto it = entries_.begin(); it != entries_.end(); ++it)
+			{
+				if (it->last_used_ < oldest->last_used_)
+				{
+					oldest = it;
+				}
+			}
+
+			printf("Evicting map cache entry %016llx \n", static_cast<unsigned long long>(oldest->hash_));
+			evict(oldest->hash_);
+		}
+	}
+
+	bool MapCache::read_index()
+	{
+		std::ifstream index((directory_ + "index.txt").c_str());
+		if (!index.is_open())
+		{
+			return false;
+		}
+
+		std::string line;
+		while (std::getline(index, line))
+		{
+			uint64 hash = 0, size = 0, last_used = 0;
+			std::stringstream ss(line);
+			if (!(ss >> std::hex >> hash >> std::dec >> size >> last_used) || find(hash))
+			{
+				continue;
+			}
+
+			entries_.push_back(Entry{ hash, size, last_used });
+			size_ += size;
+			clock_ = last_used > clock_ ? last_used : clock_;
+		}
+		return true;
+	}
+
+	bool MapCache::write_index() const
+	{
+		std::ofstream index((directory_ + "index.txt").c_str(), std::ios::trunc);
+		for (const auto& entry : entries_)
+		{
+			char line[64];
+			snprintf(line, sizeof(line), "%016llx %llu %llu\n",
+				static_cast<unsigned long long>(entry.hash_),
+				static_cast<unsigned long long>(entry.size_),
+				static_cast<unsigned long long>(entry.last_used_));
+			index << line;
+		}
+		return index.good();
+	}
+
+	MapCache::Entry* MapCache::find(const uint64 hash)
+	{
+		for (auto& entry : entries_)
+		{
+			if (entry.hash_ == hash)
+			{
+				return &entry;
+			}
+		}
+		return nullptr;
+	}
+
+	std::string MapCache::path_of(const uint64 hash) const
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.cmap", static_cast<unsigned long long>(hash));
+		return directory_ + name;
+	}
+}
@@ -0,0 +1,527 @@
+﻿#include "map_format.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include "charlie_network.hpp"
+#include "config.h"
+#include "leveldata.h"
+#include "level_manager.h"
+
+namespace charlie
+{
+	namespace
+	{
+		void write_le(DynamicArray<uint8>& dst, const size_t at, const uint64 value, const int32 length)
+		{
+			for (int32 index = 0; index < length; index++)
+			{
+				dst[at + index] = static_cast<uint8>(value >> (index * 8));
+			}
+		}
+
+		size_t align_up(const size_t value)
+		{
+			return (value + 7) & ~size_t(7);
+		}
+
+		bool is_little_endian()
+		{
+			const uint16 probe = 1;
+			return *reinterpret_cast<const uint8*>(&probe) == 1;
+		}
+
+		// note: 64 bit fnv-1a, the same as Leveldata::content_hash over the
+		//       size and the tile ids, layers and objects are only mixed in
+		//       when there are any so a map without them keeps the hash of
+		//       its text map and a client holding either one matches
+		uint64 hash_content(const uint8 size_x, const uint8 size_y, const uint8* tiles,
+			const uint8* layers, const int32 layer_count, const MapObject* objects, const int32 object_count)
+		{
+			uint64 hash = 0xcbf29ce484222325ull;
+			const auto mix = [&hash](const uint64 value, const int32 length)
+			{
+				for (int32 index = 0; index < length; index++)
+				{
+					hash ^= static_cast<uint8>(value >> (index * 8));
+					hash *= 0x100000001b3ull;
+				}
+			};
+
+			const int32 tile_count = int32(size_x) * size_y;
+			mix(size_x, 1);
+			mix(size_y, 1);
+			for (int32 index = 0; index < tile_count; index++)
+			{
+				mix(tiles[index], 1);
+			}
+
+			if (layer_count == 0 && object_count == 0)
+			{
+				return hash;
+			}
+
+			mix(static_cast<uint64>(layer_count), 4);
+			for (int32 index = 0; index < layer_count * tile_count; index++)
+			{
+				mix(layers[index], 1);
+			}
+
+			mix(static_cast<uint64>(object_count), 4);
+			for (int32 index = 0; index < object_count; index++)
+			{
+				const MapObject& object = objects[index];
+				mix(object.x_, 2);
+				mix(object.y_, 2);
+				mix(object.w_, 2);
+				mix(object.h_, 2);
+				mix(object.type_, 2);
+			}
+			return hash;
+		}
+
+		// note: blocked tiles are merged into horizontal runs first and a run
+		//       with the same span as one in the row above extends that rect
+		//       down, so walls come out as a handful of rects instead of one
+		//       collider per tile
+		void build_colliders(const Leveldata& data, DynamicArray<MapRect>& rects)
+		{
+			size_t row_start = 0;
+			for (int y = 0; y < data.sizeY_; y++)
+			{
+				const size_t next_row_start = rects.size();
+				int x = 0;
+				while (x < data.sizeX_)
+				{
+					if (data.tiles_[y * data.sizeX_ + x].tile_id_ != COLLIDER)
+					{
+						x++;
+						continue;
+					}
+
+					int end = x + 1;
+					while (end < data.sizeX_ && data.tiles_[y * data.sizeX_ + end].tile_id_ == COLLIDER)
+					{
+						end++;
+					}
+
+					bool extended = false;
+					for (size_t index = row_start; index < next_row_start; index++)
+					{
+						MapRect& rect = rects[index];
+						if (rect.x_ == x && rect.w_ == end - x && rect.y_ + rect.h_ == y)
+						{
+							rect.h_++;
+							extended = true;
+							break;
+						}
+					}
+
+					if (!extended)
+					{
+						rects.push_back(MapRect{ static_cast<uint16>(x), static_cast<uint16>(y), static_cast<uint16>(end - x), 1 });
+					}
+					x = end;
+				}
+
+				// Rects that did not grow this row can not grow any further
+				size_t keep = next_row_start;
+				for (size_t index = row_start; index < next_row_start; index++)
+				{
+					if (rects[index].y_ + rects[index].h_ == y + 1)
+					{
+						keep = index < keep ? index : keep;
+					}
+				}
+				row_start = keep;
+			}
+		}
+	}
+
+	// note: packbits style runs, a control byte below 128 is followed by
+	//       that many plus one literal bytes, from 128 up it repeats the next
+	//       byte (control - 125) times, so runs of 3 to 130 bytes take 2 bytes
+	//       and a map never grows by more than one byte in 128
+	void run_length_encode(const uint8* data, const int32 count, DynamicArray<uint8>& stream)
+	{
+		int32 index = 0;
+		while (index < count)
+		{
+			int32 run = 1;
+			while (index + run < count && run < 130 && data[index + run] == data[index])
+			{
+				run++;
+			}
+
+			if (run >= 3)
+			{
+				stream.push_back(static_cast<uint8>(run + 125));
+				stream.push_back(data[index]);
+				index += run;
+				continue;
+			}
+
+			// Collect literals until the next run worth coding starts
+			int32 literal = 0;
+			while (index + literal < count && literal < 128)
+			{
+				const int32 at = index + literal;
+				if (at + 2 < count && data[at] == data[at + 1] && data[at] == data[at + 2])
+				{
+					break;
+				}
+				literal++;
+			}
+
+			stream.push_back(static_cast<uint8>(literal - 1));
+			stream.insert(stream.end(), data + index, data + index + literal);
+			index += literal;
+		}
+	}
+
+	bool run_length_decode(const uint8* data, const int32 length, uint8* output, const int32 count)
+	{
+		int32 index = 0;
+		int32 at = 0;
+		while (at < length)
+		{
+			const uint8 control = data[at++];
+			const bool repeat = control >= 128;
+			const int32 run = repeat ? control - 125 : control + 1;
+			if (index + run > count || (repeat ? at + 1 : at + run) > length)
+			{
+				printf("Run length data is corrupt at byte %i \n", at);
+				return false;
+			}
+
+			for (int32 offset = 0; offset < run; offset++, index++)
+			{
+				output[index] = repeat ? data[at] : data[at + offset];
+			}
+			at += repeat ? 1 : run;
+		}
+
+		if (index != count)
+		{
+			printf("Run length data is short, %i of %i bytes \n", index, count);
+			return false;
+		}
+
+		return true;
+	}
+
+	bool fits_map_stream(const DynamicArray<uint8>& coded)
+	{
+		return coded.size() <= size_t(network::Connection::MAX_MESSAGE_SIZE - MAP_STREAM_HEADER_SIZE);
+	}
+
+	MapContent::MapContent() : layer_count_(0)
+	{
+	}
+
+	bool CompiledMap::compile(const Leveldata& data, DynamicArray<uint8>& output)
+	{
+		return compile(data, MapContent(), output);
+	}
+
+	bool CompiledMap::compile(const Leveldata& data, const MapContent& content, DynamicArray<uint8>& output)
+	{
+		if (data.sizeX_ <= 0 || data.sizeY_ <= 0 || data.tiles_.size() != size_t(data.sizeX_ * data.sizeY_))
+		{
+			printf("Can not compile a map without tiles \n");
+			return false;
+		}
+
+		if (content.layer_count_ < 0 || content.layers_.size() != size_t(content.layer_count_) * data.tiles_.size())
+		{
+			printf("Map layers do not match the size of the map \n");
+			return false;
+		}
+
+		DynamicArray<MapPoint> spawns;
+		for (const auto& tile : data.tiles_)
+		{
+			if (tile.tile_id_ == SPAWN_POINT)
+			{
+				spawns.push_back(MapPoint{ tile.x_, tile.y_ });
+			}
+		}
+
+		DynamicArray<MapRect> colliders;
+		build_colliders(data, colliders);
+
+		static constexpr uint16 section_count = 5;
+		MapSection sections[section_count] =
+		{
+			{ MAP_SECTION_TILES, static_cast<uint32>(data.tiles_.size()), 0, static_cast<uint32>(data.tiles_.size()) },
+			{ MAP_SECTION_SPAWNS, static_cast<uint32>(spawns.size()), 0, static_cast<uint32>(spawns.size() * sizeof(MapPoint)) },
+			{ MAP_SECTION_COLLIDERS, static_cast<uint32>(colliders.size()), 0, static_cast<uint32>(colliders.size() * sizeof(MapRect)) },
+			{ MAP_SECTION_LAYERS, static_cast<uint32>(content.layer_count_), 0, static_cast<uint32>(content.layers_.size()) },
+			{ MAP_SECTION_OBJECTS, static_cast<uint32>(content.objects_.size()), 0, static_cast<uint32>(content.objects_.size() * sizeof(MapObject)) },
+		};
+
+		size_t end = sizeof(MapFileHeader) + section_count * sizeof(MapSection);
+		for (auto& section : sections)
+		{
+			section.offset_ = static_cast<uint32>(align_up(end));
+			end = section.offset_ + section.size_;
+		}
+
+		output.assign(end, 0);
+
+		write_le(output, 0, MAP_FILE_MAGIC, 4);
+		write_le(output, 4, MAP_FILE_VERSION, 2);
+		write_le(output, 6, section_count, 2);
+		write_le(output, 8, static_cast<uint64>(data.sizeX_), 2);
+		write_le(output, 10, static_cast<uint64>(data.sizeY_), 2);
+
+		for (uint16 index = 0; index < section_count; index++)
+		{
+			const size_t at = sizeof(MapFileHeader) + index * sizeof(MapSection);
+			write_le(output, at, sections[index].type_, 4);
+			write_le(output, at + 4, sections[index].count_, 4);
+			write_le(output, at + 8, sections[index].offset_, 4);
+			write_le(output, at + 12, sections[index].size_, 4);
+		}
+
+		for (size_t index = 0; index < data.tiles_.size(); index++)
+		{
+			output[sections[0].offset_ + index] = data.tiles_[index].tile_id_;
+		}
+		for (size_t index = 0; index < spawns.size(); index++)
+		{
+			const size_t at = sections[1].offset_ + index * sizeof(MapPoint);
+			write_le(output, at, spawns[index].x_, 2);
+			write_le(output, at + 2, spawns[index].y_, 2);
+		}
+		for (size_t index = 0; index < colliders.size(); index++)
+		{
+			const size_t at = sections[2].offset_ + index * sizeof(MapRect);
+			write_le(output, at, colliders[index].x_, 2);
+			write_le(output, at + 2, colliders[index].y_, 2);
+			write_le(output, at + 4, colliders[index].w_, 2);
+			write_le(output, at + 6, colliders[index].h_, 2);
+		}
+		for (size_t index = 0; index < content.layers_.size(); index++)
+		{
+			output[sections[3].offset_ + index] = content.layers_[index];
+		}
+		for (size_t index = 0; index < content.objects_.size(); index++)
+		{
+			const MapObject& object = content.objects_[index];
+			const size_t at = sections[4].offset_ + index * sizeof(MapObject);
+			write_le(output, at, object.x_, 2);
+			write_le(output, at + 2, object.y_, 2);
+			write_le(output, at + 4, object.w_, 2);
+			write_le(output, at + 6, object.h_, 2);
+			write_le(output, at + 8, object.type_, 2);
+		}
+
+		const uint64 hash = hash_content(static_cast<uint8>(data.sizeX_), static_cast<uint8>(data.sizeY_), output.data() + sections[0].offset_,
+			content.layers_.data(), content.layer_count_, content.objects_.data(), static_cast<int32>(content.objects_.size()));
+		write_le(output, 16, hash, 8);
+
+		// Clients that lack the map get it in one message, a map too large for that is never shipped
+		DynamicArray<uint8> coded;
+		run_length_encode(output.data(), static_cast<int32>(output.size()), coded);
+		if (!fits_map_stream(coded))
+		{
+			printf("Map of %i bytes streams as %i bytes, more than one message carries \n", static_cast<int>(output.size()), static_cast<int>(coded.size()));
+			return false;
+		}
+
+		return true;
+	}
+
+	CompiledMap::CompiledMap() : header_(nullptr), size_(0), tiles_(nullptr), spawns_(nullptr), spawn_count_(0),
+		colliders_(nullptr), collider_count_(0), layers_(nullptr), layer_count_(0), objects_(nullptr), object_count_(0)
+	{
+	}
+
+	bool CompiledMap::open(const char* filename)
+	{
+		if (!file_.open(filename))
+		{
+			return false;
+		}
+
+		if (!view(file_.data_, file_.size_))
+		{
+			printf("Compiled map %s is corrupt \n", filename);
+			close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void CompiledMap::close()
+	{
+		// An empty view clears every section pointer
+		file_.close();
+		view(nullptr, 0);
+	}
+
+	bool CompiledMap::open_level(const uint8 level_id)
+	{
+		const auto path = config::LEVEL_PATH_PREFIX + "map" + std::to_string(level_id) + ".cmap";
+		return open(path.c_str());
+	}
+
+	// note: everything is checked up front so the rest of the game can use
+	//       the section pointers without bounds checks of its own
+	bool CompiledMap::view(const uint8* data, const uint64 size)
+	{
+		header_ = nullptr;
+		size_ = 0;
+		tiles_ = nullptr;
+		spawns_ = nullptr;
+		colliders_ = nullptr;
+		layers_ = nullptr;
+		objects_ = nullptr;
+		spawn_count_ = 0;
+		collider_count_ = 0;
+		layer_count_ = 0;
+		object_count_ = 0;
+
+		if (!is_little_endian() || data == nullptr || size < sizeof(MapFileHeader) || (reinterpret_cast<uintptr_t>(data) & 7) != 0)
+		{
+			return false;
+		}
+
+		const MapFileHeader* header = reinterpret_cast<const MapFileHeader*>(data);
+		if (header->magic_ != MAP_FILE_MAGIC || header->version_ != MAP_FILE_VERSION)
+		{
+			return false;
+		}
+
+		if (header->size_x_ == 0 || header->size_y_ == 0 || header->size_x_ > 255 || header->size_y_ > 255)
+		{
+			return false;
+		}
+
+		const uint64 table_end = sizeof(MapFileHeader) + uint64(header->section_count_) * sizeof(MapSection);
+		if (table_end > size)
+		{
+			return false;
+		}
+
+		const MapSection* sections = reinterpret_cast<const MapSection*>(data + sizeof(MapFileHeader));
+		for (uint16 index = 0; index < header->section_count_; index++)
+		{
+			const MapSection& section = sections[index];
+			if ((section.offset_ & 7) != 0 || section.offset_ < table_end || uint64(section.offset_) + section.size_ > size)
+			{
+				return false;
+			}
+		}
+
+		header_ = header;
+
+		const MapSection* tiles = find_section(MAP_SECTION_TILES);
+		const MapSection* spawns = find_section(MAP_SECTION_SPAWNS);
+		const MapSection* colliders = find_section(MAP_SECTION_COLLIDERS);
+		const uint32 tile_count = uint32(header->size_x_) * header->size_y_;
+		if (tiles == nullptr || tiles->count_ != tile_count || tiles->size_ != tile_count ||
+			spawns == nullptr || spawns->size_ != uint64(spawns->count_) * sizeof(MapPoint) ||
+			colliders == nullptr || colliders->size_ != uint64(colliders->count_) * sizeof(MapRect))
+		{
+			header_ = nullptr;
+			return false;
+		}
+
+		const MapPoint* points = reinterpret_cast<const MapPoint*>(data + spawns->offset_);
+		for (uint32 index = 0; index < spawns->count_; index++)
+		{
+			if (points[index].x_ >= header->size_x_ || points[index].y_ >= header->size_y_)
+			{
+				header_ = nullptr;
+				return false;
+			}
+		}
+
+		const MapRect* rects = reinterpret_cast<const MapRect*>(data + colliders->offset_);
+		for (uint32 index = 0; index < colliders->count_; index++)
+		{
+			const MapRect& rect = rects[index];
+			if (rect.w_ == 0 || rect.h_ == 0 || rect.x_ + rect.w_ > header->size_x_ || rect.y_ + rect.h_ > header->size_y_)
+			{
+				header_ = nullptr;
+				return false;
+			}
+		}
+
+		// Layers and objects are optional, older maps have neither
+		const MapSection* layers = find_section(MAP_SECTION_LAYERS);
+		const MapSection* objects = find_section(MAP_SECTION_OBJECTS);
+		if ((layers != nullptr && layers->size_ != uint64(layers->count_) * tile_count) ||
+			(objects != nullptr && objects->size_ != uint64(objects->count_) * sizeof(MapObject)))
+		{
+			header_ = nullptr;
+			return false;
+		}
+
+		const MapObject* placed = objects != nullptr ? reinterpret_cast<const MapObject*>(data + objects->offset_) : nullptr;
+		const uint32 object_count = objects != nullptr ? objects->count_ : 0;
+		const uint32 width = uint32(header->size_x_) * config::LEVEL_OBJECT_WIDTH;
+		const uint32 height = uint32(header->size_y_) * config::LEVEL_OBJECT_HEIGHT;
+		for (uint32 index = 0; index < object_count; index++)
+		{
+			const MapObject& object = placed[index];
+			const bool valid_type = object.type_ == MAP_OBJECT_COLLIDER || object.type_ == MAP_OBJECT_SPAWN;
+			const bool empty = object.type_ == MAP_OBJECT_COLLIDER && (object.w_ == 0 || object.h_ == 0);
+			if (!valid_type || empty || uint32(object.x_) + object.w_ > width || uint32(object.y_) + object.h_ > height)
+			{
+				header_ = nullptr;
+				return false;
+			}
+		}
+
+		if (layers != nullptr)
+		{
+			layers_ = data + layers->offset_;
+			layer_count_ = static_cast<int32>(layers->count_);
+		}
+		objects_ = placed;
+		object_count_ = static_cast<int32>(object_count);
+
+		tiles_ = data + tiles->offset_;
+		spawns_ = points;
+		spawn_count_ = static_cast<int32>(spawns->count_);
+		colliders_ = rects;
+		collider_count_ = static_cast<int32>(colliders->count_);
+		size_ = size;
+		return true;
+	}
+
+	const MapSection* CompiledMap::find_section(const uint32 type) const
+	{
+		if (header_ == nullptr)
+		{
+			return nullptr;
+		}
+
+		const MapSection* sections = reinterpret_cast<const MapSection*>(reinterpret_cast<const uint8*>(header_) + sizeof(MapFileHeader));
+		for (uint16 index = 0; index < header_->section_count_; index++)
+		{
+			if (sections[index].type_ == type)
+			{
+				return &sections[index];
+			}
+		}
+		return nullptr;
+	}
+
+	// note: recomputed from the sections, a map that came over the network
+	//       or from the cache is only used when this matches its header
+	uint64 CompiledMap::content_hash() const
+	{
+		if (header_ == nullptr)
+		{
+			return 0;
+		}
+
+		return hash_content(static_cast<uint8>(header_->size_x_), static_cast<uint8>(header_->size_y_), tiles_,
+			layers_, layer_count_, objects_, object_count_);
+	}
+}
@@ -1,10 +1,16 @@
 ﻿#include "reliable_events.h"
 
 #include "player.hpp"
+#include "charlie_metrics.hpp"
 
 namespace charlie
 {
-	Event::Event() : event_id_(), type_(EventType::INVALID), entity_id_(0), creator_(0), send_to_(0), rot_(0), tile_()
+	namespace
+	{
+		metrics::Counter events_created("server_reliable_events_created_total", "Reliable events created for a player");
+	}
+
+	Event::Event() : event_id_(), type_(EventType::INVALID), entity_id_(0), creator_(0), send_to_(0), rot_(0)
 	{
 	}
 
@@ -106,6 +112,7 @@ namespace charlie
 		}
 
 		event_id_ += 1;
+		events_created.add();
 	}
 
 	void ReliableEvents::create_destroy_event(const int32 entity_id, const int32 send_to, const EventType event, const DynamicArray<Player>& players)
@@ -141,6 +148,7 @@ namespace charlie
 		}
 		printf("RELIABLE MESSAGE: reliable events in queue %i \n", (int)events_.size());
 		event_id_ += 1;
+		events_created.add();
 	}
 
 	void ReliableEvents::clear()
@@ -170,16 +178,6 @@ namespace charlie
 		e.send_to_ = send_to;
 		events_.push_back(e);
 		event_id_ += 1;
-	}
-
-	void ReliableEvents::send_level_data(Tile tile, int32 send_to)
-	{
-		Event e;
-		e.event_id_ = event_id_;
-		e.tile_ = tile;
-		e.type_ = EventType::SEND_LEVEL_DATA;
-		e.send_to_ = send_to;
-		events_.push_back(e);
-		event_id_ += 1;
+		events_created.add();
 	}
 }
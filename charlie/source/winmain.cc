@@ -1,5 +1,6 @@
 // winmain.cc
 
+#if defined(_WIN32)
 #include <Windows.h>
 
 extern int main(int argc, char **argv);
@@ -8,3 +9,4 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE prev_instance, LPSTR command_li
 {
    return main(__argc, __argv);
 }
+#endif // _WIN32
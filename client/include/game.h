@@ -2,6 +2,7 @@
 #include <sdl_application.hpp>
 
 #include "level_manager.h"
+#include "map_cache.h"
 #include "master_server_client.h"
 #include "player.hpp"
 #include "projectile.h"
@@ -22,6 +23,10 @@ namespace charlie
 		void on_acknowledge(network::Connection* connection, uint16 sequence) override;
 		void on_receive(network::Connection* connection, network::NetworkStreamReader& reader) override;
 		void on_send(network::Connection* connection, uint16 sequence, network::NetworkStreamWriter& writer) override;
+		void on_channel_message(network::Connection* connection, network::Channel channel, network::NetworkStreamReader& reader) override;
+		void on_receive_message(network::Connection* connection, network::NetworkStreamReader& reader) override;
+		void read_messages(network::Connection* connection, network::BitStreamReader& bit_reader);
+		void synchronize_tick(network::Connection* connection);
 
 		// Modify entities
 		void spawn_entity(network::NetworkMessageEntitySpawn message);
@@ -36,25 +41,28 @@ namespace charlie
 		static bool contains(const DynamicArray<Projectile>& vector, int32 id);
 
 		// Messages
-		void create_ack_message(int32 event_id_);
+		void request_level_data(int32 event_id);
 
 		SDL_Renderer* renderer_;
 
 		// Networking
 		network::Connection connection_;
 		const Time tickrate_;
+		Time tick_interval_; // tickrate_ slewed toward the server clock
 		Time accumulator_;
 		Time lastSend_;
 		Time lastReceive_;
-		Queue<network::NetworkMessageAck> message_queue_;
-		Queue<network::NetworkMessageLevelDataRequest> level_message_queue_;
 		gameplay::Inputinator inputinator_;
+		gameplay::SnapshotRing snapshots_;
+		bool has_decoded_snapshot_;
+		uint16 decoded_snapshot_; // Reported back so the server only deltas against what we have
 		Networkinfo networkinfo_;
 		Vector2 oldPos_;
 		Vector2 newPos_;
 		int32 tick_;
 		int32 server_tick_;
 		Time server_time_;
+		gameplay::ClockSync clock_;
 		network::IPAddress server_;
 
 		// Gameplay
@@ -65,6 +73,7 @@ namespace charlie
 		DynamicArray<Projectile> projectiles_;
 		DynamicArray<int32> projectiles_to_remove_;
 		LevelManager level_manager_;
+		MapCache map_cache_;
 		TextHandler text_handler_;
 		SDLFont text_font_;
 		int32 local_projectile_index_;
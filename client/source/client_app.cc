@@ -19,7 +19,15 @@ bool ClientApp::on_init()
 	menu_.on_init(renderer_.get_renderer());
 	state_ = SceneState::MENU;
 
-	network_.set_send_rate(Time(1.0 / 60.0));
+	network_.set_send_rate(Time(1.0 / 60.0), Time(1.0 / 20.0));
+	network_.set_payload_budget(512, 1024);
+
+	network::ConditionerProfile profile;
+	if (!network::ConditionerProfile::from_name(config::NETWORK_CONDITIONER, profile)) {
+		printf("WRN: unknown network conditioner '%s'\n", config::NETWORK_CONDITIONER);
+	}
+	network_.set_conditioner(profile, config::NETWORK_CONDITIONER_SEED);
+
 	if (!network_.initialize({})) {
 		return false;
 	}
@@ -31,6 +39,17 @@ void ClientApp::on_exit()
 {
 	menu_.on_exit();
 	game_.on_exit();
+
+	if (network_.send_conditioner_.profile_.is_enabled()) {
+		const network::ConditionerCounters& sent = network_.send_conditioner_.counters_;
+		const network::ConditionerCounters& received = network_.receive_conditioner_.counters_;
+		printf("NFO: conditioner '%s' send - submitted: %llu delivered: %llu dropped: %llu burst: %llu throttled: %llu duplicated: %llu reordered: %llu\n",
+			config::NETWORK_CONDITIONER,
+			sent.submitted_, sent.delivered_, sent.dropped_, sent.burst_dropped_, sent.throttled_, sent.duplicated_, sent.reordered_);
+		printf("NFO: conditioner '%s' receive - submitted: %llu delivered: %llu dropped: %llu burst: %llu throttled: %llu duplicated: %llu reordered: %llu\n",
+			config::NETWORK_CONDITIONER,
+			received.submitted_, received.delivered_, received.dropped_, received.burst_dropped_, received.throttled_, received.duplicated_, received.reordered_);
+	}
 }
 
 bool ClientApp::on_tick(const Time& dt)
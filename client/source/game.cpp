@@ -4,6 +4,7 @@
 #include "game.h"
 #include "level_manager.h"
 #include "leveldata.h"
+#include "map_format.h"
 #include "player.hpp"
 #include "Singleton.hpp"
 
@@ -12,6 +13,9 @@ namespace charlie
 	Game::Game()
 		: renderer_(nullptr)
 		, tickrate_(1.0 / 60.0)
+		, tick_interval_(1.0 / 60.0)
+		, has_decoded_snapshot_(false)
+		, decoded_snapshot_(0)
 		, tick_(0)
 		, server_tick_(0)
 		, local_projectile_index_(0)
@@ -26,6 +30,15 @@ namespace charlie
 		renderer_ = renderer;
 		connection_.set_listener(this);
 		connection_.connect(server_);
+		snapshots_.clear();
+		has_decoded_snapshot_ = false;
+		clock_.reset();
+
+		// note: without a cache every map is simply downloaded again
+		if (!map_cache_.open(config::MAP_CACHE_DIRECTORY, config::MAP_CACHE_CAPACITY))
+		{
+			printf("WRN: map cache is disabled\n");
+		}
 
 		text_font_.create(config::FONT_PATH, 20, SDL_Color({ 255,255,255,255 }));
 		text_handler_.renderer_ = renderer_;
@@ -65,9 +78,10 @@ namespace charlie
 			return true;
 		}
 
+		// note: ticks are slewed to follow the server, the simulation step stays fixed
 		accumulator_ += dt;
-		while (accumulator_ >= tickrate_) {
-			accumulator_ -= tickrate_;
+		while (accumulator_ >= tick_interval_) {
+			accumulator_ -= tick_interval_;
 
 			tick_ += 1;
 
@@ -164,27 +178,85 @@ namespace charlie
 	{
 		networkinfo_.packet_received(reader.length());
 
-		while (reader.position() < reader.length()) {
-			switch (reader.peek()) {
+		network::BitStreamReader bit_reader(reader);
+		read_messages(connection, bit_reader);
+	}
+
+	void Game::on_channel_message(network::Connection* connection, network::Channel channel, network::NetworkStreamReader& reader)
+	{
+		network::BitStreamReader bit_reader(reader);
+		read_messages(connection, bit_reader);
+	}
+
+	void Game::on_receive_message(network::Connection* connection, network::NetworkStreamReader& reader)
+	{
+		// note: the only fragmented message from the server is the level stream
+		if (reader.peek() != network::NETWORK_MESSAGE_LEVEL_DATA)
+		{
+			assert(!"unknown fragmented message received from server!");
+			return;
+		}
+
+		if (!level_manager_.receive_level(reader))
+		{
+			printf("WRN: could not load streamed level\n");
+			return;
+		}
+
+		map_cache_.store(level_manager_.hash_, level_manager_.compiled_);
+	}
+
+	// note: the client runs ahead of the server by the time an input takes to
+	//       get there plus the jitter and a small buffer, small errors change
+	//       the tick length for a while and only large ones move the tick
+	void Game::synchronize_tick(network::Connection* connection)
+	{
+		const int buffer = 2;
+		const float tick_seconds = tickrate_.as_seconds();
+		const Time now = Time::now();
+		const float server_tick = server_tick_ + (clock_.server_time(now) - server_time_).as_seconds() / tick_seconds;
+		const Time lead = connection->smoothed_round_trip_time() / 2 + connection->round_trip_variance();
+		const float target = server_tick + lead.as_seconds() / tick_seconds + buffer;
+		const float error = target - (tick_ + accumulator_.as_seconds() / tick_interval_.as_seconds());
+
+		if (error > gameplay::ClockSync::SNAP_TICKS || error < -gameplay::ClockSync::SNAP_TICKS)
+		{
+			tick_ = static_cast<int32>(target);
+			accumulator_ = Time(0.0);
+			tick_interval_ = tickrate_;
+			return;
+		}
+
+		tick_interval_ = gameplay::ClockSync::tick_interval(tickrate_, error);
+	}
+
+	void Game::read_messages(network::Connection* connection, network::BitStreamReader& bit_reader)
+	{
+		while (bit_reader.bits_remaining() >= 8) {
+			switch (bit_reader.peek()) {
 			case network::NETWORK_MESSAGE_SERVER_TICK:
 			{
 				network::NetworkMessageServerTick message;
-				if (!message.read(reader)) {
+				if (!message.read(bit_reader)) {
 					assert(!"could not read message!");
 				}
 
-				const auto delay = networkinfo_.rtt_avg_ / tickrate_.as_milliseconds();
-				const int buffer = 2;
-				tick_ = message.server_tick_ + static_cast<int32>(delay) + buffer;
+				// note: the round trip measured from this packet's ack, not the
+				//       smoothed one, so the filter can pick the least delayed,
+				//       a packet that measured nothing gives no sample
+				if (connection->has_round_trip_sample()) {
+					clock_.add_sample(Time(message.server_time_), connection->last_received_time_, connection->round_trip_time());
+				}
 				server_tick_ = message.server_tick_;
 				server_time_ = Time(message.server_time_);
 				lastReceive_ = Time::now();
+				synchronize_tick(connection);
 			} break;
 
 			case network::NETWORK_MESSAGE_ENTITY_STATE:
 			{
 				network::NetworkMessageEntityState message;
-				if (!message.read(reader)) {
+				if (!message.read(bit_reader)) {
 					assert(!"could not read message!");
 				}
 
@@ -210,10 +282,64 @@ namespace charlie
 				}
 			} break;
 
+			case network::NETWORK_MESSAGE_ENTITY_DELTA:
+			{
+				network::NetworkMessageEntityDelta message;
+				if (!message.read(bit_reader)) {
+					assert(!"could not read message!");
+				}
+
+				const gameplay::EntitySnapshot* baseline = nullptr;
+				if (message.has_baseline_)
+				{
+					baseline = snapshots_.find(message.baseline_);
+					if (!baseline)
+					{
+						printf("WRN: missing snapshot baseline %d\n", message.baseline_);
+						break;
+					}
+				}
+
+				// note: the connection only hands us packets newer than the last,
+				//       so its acknowledge is the sequence of this packet
+				gameplay::EntitySnapshot& snapshot = snapshots_.insert(connection->acknowledge_);
+				if (!snapshot.decode(baseline, message))
+				{
+					printf("WRN: could not decode entity snapshot\n");
+					snapshot.valid_ = false;
+					break;
+				}
+
+				has_decoded_snapshot_ = true;
+				decoded_snapshot_ = connection->acknowledge_;
+
+				for (const gameplay::EntityState& state : snapshot.entities_)
+				{
+					gameplay::PositionSnapshot position;
+					position.tick_ = tick_;
+					position.servertime_ = server_time_;
+					position.position.x_ = state.x_;
+					position.position.y_ = state.y_;
+					position.rotation = state.rotation_;
+					position.turret_rotation = state.turret_rotation_;
+
+					for (auto& e : entities_)
+					{
+						if (e.id_ == state.id_)
+						{
+							e.interpolator_.acc_ = Time(0.0);
+							e.interpolator_.add_position(position);
+							e.interpolator_.clear_old_snapshots();
+							break;
+						}
+					}
+				}
+			} break;
+
 			case network::NETWORK_MESSAGE_PLAYER_STATE:
 			{
 				network::NetworkMessagePlayerState message;
-				if (!message.read(reader)) {
+				if (!message.read(bit_reader)) {
 					assert(!"could not read message!");
 				}
 				if (!inputinator_.hasSnapshot(tick_))
@@ -226,19 +352,17 @@ namespace charlie
 			case network::NETWORK_MESSAGE_PLAYER_SPAWN:
 			{
 				network::NetworkMessagePlayerSpawn message;
-				if (!message.read(reader)) {
+				if (!message.read(bit_reader)) {
 					assert(!"could not read message!");
 				}
 
 				spawn_player(message);
-
-				create_ack_message(message.event_id_);
 			} break;
 
 			case network::NETWORK_MESSAGE_ENTITY_SPAWN:
 			{
 				network::NetworkMessageEntitySpawn message;
-				if (!message.read(reader)) {
+				if (!message.read(bit_reader)) {
 					assert(!"could not read message!");
 				}
 
@@ -246,14 +370,12 @@ namespace charlie
 				{
 					spawn_entity(message);
 				}
-
-				create_ack_message(message.event_id_);
 			} break;
 
 			case network::NETWORK_MESSAGE_DISCONNECTED:
 			{
 				network::NetworkMessagePlayerDisconnected message;
-				if (!message.read(reader)) {
+				if (!message.read(bit_reader)) {
 					assert(!"could not read message!");
 				}
 
@@ -261,25 +383,20 @@ namespace charlie
 				{
 					entities_to_remove_.push_back(message.entity_id_);
 				}
-
-				create_ack_message(message.message_id_);
 			} break;
 			case network::NETWORK_MESSAGE_PLAYER_DESTROYED:
 			{
 				network::NetworkMessagePlayerDestroy message;
-				if (!message.read(reader)) {
+				if (!message.read(bit_reader)) {
 					assert(!"could not read message!");
 				}
 
 				player_.state_ = PlayerState::DEAD;
-
-				create_ack_message(message.event_id_);
-
 			} break;
 			case network::NETWORK_MESSAGE_PROJECTILE_SPAWN:
 			{
 				network::NetworkMessageProjectileSpawn message;
-				if (!message.read(reader)) {
+				if (!message.read(bit_reader)) {
 					assert(!"could not read message!");
 				}
 
@@ -287,14 +404,12 @@ namespace charlie
 				{
 					spawn_projectile(message);
 				}
-
-				create_ack_message(message.event_id_);
 			} break;
 
 			case network::NETWORK_MESSAGE_PROJECTILE_DESTROYED:
 			{
 				network::NetworkMessageProjectileDestroy message;
-				if (!message.read(reader)) {
+				if (!message.read(bit_reader)) {
 					assert(!"could not read message!");
 				}
 
@@ -303,14 +418,12 @@ namespace charlie
 					projectiles_to_remove_.push_back(message.entity_id_);
 					printf("RELIABLE MESSAGE: Destroying projectile: %i \n", message.entity_id_);
 				}
-
-				create_ack_message(message.event_id_);
 			} break;
 
 			case network::NETWORK_MESSAGE_ENTITY_DESTROYED:
 			{
 				network::NetworkMessageEntityDestroy message;
-				if (!message.read(reader)) {
+				if (!message.read(bit_reader)) {
 					assert(!"could not read message!");
 				}
 
@@ -319,14 +432,12 @@ namespace charlie
 					entities_to_remove_.push_back(message.entity_id_);
 					printf("RELIABLE MESSAGE: Destroying projectile: %i \n", message.entity_id_);
 				}
-
-				create_ack_message(message.event_id_);
 			} break;
 
 			case network::NETWORK_MESSAGE_LEVEL_INFO:
 			{
 				network::NetworkMessageLevelInfo message;
-				if (!message.read(reader)) {
+				if (!message.read(bit_reader)) {
 					assert(!"could not read message!");
 				}
 
@@ -336,8 +447,15 @@ namespace charlie
 				cam_.init(level_width_, level_heigth_, { (int)player_.transform_.position_.x_, (int)player_.transform_.position_.y_, config::SCREEN_WIDTH, config::SCREEN_HEIGHT });
 
 				auto data = Leveldata();
-				//Attempt to load level if exits on client
-				if (data.create_level(message.level_id_))
+				CompiledMap map;
+				//Attempt to load level if exits on client, shipped maps only count when their content matches the server's
+				if ((map.open_level(message.level_id_) && map.header_->hash_ == message.hash_ && map.content_hash() == message.hash_) ||
+					map_cache_.load(message.hash_, map))
+				{
+					level_manager_ = LevelManager();
+					level_manager_.load_compiled(map);
+				}
+				else if (data.create_level(message.level_id_) && data.content_hash() == message.hash_)
 				{
 					level_manager_ = LevelManager();
 					level_manager_.load_assets(data);
@@ -346,31 +464,9 @@ namespace charlie
 				{
 
 					// Request level data for current level
-					level_manager_.request_map_data(message.level_id_, message.size_x_, message.size_y_);
-					network::NetworkMessageLevelDataRequest msg(message.event_id_);
-					level_message_queue_.push(msg);
-				}
-
-				create_ack_message(message.event_id_);
-			} break;
-
-			case network::NETWORK_MESSAGE_LEVEL_DATA:
-			{
-				network::NetworkMessageLevelData message;
-				if (!message.read(reader)) {
-					assert(!"could not read message!");
-				}
-				//printf("RELIABLE MESSAGE: x: %i y: %i id: %i \n", message.x_, message.y_, message.level_tile_);
-
-				level_manager_.create_tile(message.level_tile_, message.x_, message.y_);
-				create_ack_message(message.event_id_);
-
-				if (!level_manager_.is_done_sending())
-				{
-					network::NetworkMessageLevelDataRequest msg(message.event_id_);
-					level_message_queue_.push(msg);
+					level_manager_.request_map_data(message.level_id_, message.size_x_, message.size_y_, message.hash_);
+					request_level_data(message.event_id_);
 				}
-
 			} break;
 
 			default:
@@ -384,35 +480,18 @@ namespace charlie
 	void Game::on_send(network::Connection* connection, const uint16 sequence, network::NetworkStreamWriter& writer)
 	{
 		// Send rate is same as client tick rate (server tick calculated on_receive)
+		network::BitStreamWriter bit_writer(writer);
 		if (!inputinator_.get_snapshots().empty())
 		{
 			const auto snapshot = inputinator_.get_snapshots().back();
-			network::NetworkMessageInputCommand command(snapshot.input_bits_, snapshot.turret_rotation, snapshot.fire_, snapshot.tick_);
-			if (!command.write(writer)) {
+			network::NetworkMessageInputCommand command(snapshot.input_bits_, snapshot.turret_rotation, snapshot.fire_, snapshot.tick_, has_decoded_snapshot_, decoded_snapshot_);
+			if (!command.write(bit_writer)) {
 				assert(!"could not write network command!");
 			}
 		}
 
-		if (level_manager_.waiting_for_data())
-		{
-			while (!level_message_queue_.empty() && writer.length() < 1024 - sizeof(network::NetworkMessageLevelDataRequest))
-			{
-				network::NetworkMessageLevelDataRequest msg = level_message_queue_.front();
-				if (!msg.write(writer)) {
-					assert(!"could not write network command!");
-				}
-				level_message_queue_.pop();
-				//printf("RELIABLE MESSAGE: Requesting next tile from server \n");
-			}
-		}
-
-		while (!message_queue_.empty() && writer.length() < 1024 - sizeof(network::NetworkMessageAck))
-		{
-			network::NetworkMessageAck msg = message_queue_.front();
-			if (!msg.write(writer)) {
-				assert(!"could not write network command!");
-			}
-			message_queue_.pop();
+		if (!bit_writer.flush()) {
+			assert(!"could not flush network commands!");
 		}
 
 		lastSend_ = Time::now();
@@ -524,11 +603,19 @@ namespace charlie
 		return false;
 	}
 
-	void Game::create_ack_message(int32 event_id_)
+	void Game::request_level_data(int32 event_id)
 	{
-		network::NetworkMessageAck msg;
-		msg.event_id_ = event_id_;
-		message_queue_.push(msg);
-		printf("RELIABLE MESSAGE: Message confirmation sent with id %i \n", msg.event_id_);
+		uint8 buffer[network::MessageChannel::MAX_MESSAGE_SIZE];
+		network::NetworkStreamWriter writer(buffer, sizeof(buffer));
+		network::BitStreamWriter bit_writer(writer);
+		network::NetworkMessageLevelDataRequest msg(event_id);
+		if (!msg.write(bit_writer) || !bit_writer.flush()) {
+			assert(!"could not write network command!");
+		}
+
+		if (!connection_.queue_message(network::CHANNEL_RELIABLE_ORDERED, buffer, writer.length()))
+		{
+			printf("WRN: could not queue level data request\n");
+		}
 	}
 }
@@ -71,7 +71,7 @@ namespace charlie
 			return;
 		}
 
-		if (!socket_.send(master_server_, writer_.stream_.buffer_, writer_.length()))
+		if (!socket_.send(master_server_, writer_.data(), writer_.length()))
 		{
 			printf("MasterServerClient::request_server: send failed! \n");
 		}
@@ -81,7 +81,9 @@ namespace charlie
 	{
 		network::NetworkStream stream;
 
-		socket_.receive(master_server_, stream.buffer_, stream.length_);
+		if (!socket_.receive(master_server_, stream.buffer_, stream.length_)) {
+			return false;
+		}
 
 		network::NetworkStreamReader reader_(stream);
 
@@ -0,0 +1,71 @@
+// main.cc
+
+#include "leveldata.h"
+#include "map_format.h"
+#include "tiled_import.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace charlie;
+
+namespace {
+	bool has_extension(const char* filename, const char* extension)
+	{
+		const size_t length = strlen(filename);
+		const size_t extension_length = strlen(extension);
+		return length >= extension_length && strcmp(filename + length - extension_length, extension) == 0;
+	}
+} // !anon
+
+// note: usage - mapc <input.txt|input.tmj|input.json> <output.cmap>, the
+//       output is opened again after writing so a map that does not load
+//       is never shipped
+int main(int argc, char** argv)
+{
+	if (argc < 3) {
+		printf("usage: mapc <input.txt|input.tmj|input.json> <output.cmap>\n");
+		return 1;
+	}
+
+	Leveldata data;
+	MapContent content;
+	const bool tiled = has_extension(argv[1], ".tmj") || has_extension(argv[1], ".json");
+	if (tiled ? !import_tiled_map(argv[1], data, content) : !data.load_text(argv[1])) {
+		printf("could not read %s\n", argv[1]);
+		return 1;
+	}
+
+	DynamicArray<uint8> output;
+	if (!CompiledMap::compile(data, content, output)) {
+		return 1;
+	}
+
+	{
+		std::ofstream stream(argv[2], std::ios::binary | std::ios::trunc);
+		stream.write(reinterpret_cast<const char*>(output.data()), static_cast<std::streamsize>(output.size()));
+		if (!stream.good()) {
+			printf("could not write %s\n", argv[2]);
+			return 1;
+		}
+	}
+
+	CompiledMap map;
+	if (!map.open(argv[2]) || map.header_->hash_ != map.content_hash()) {
+		printf("could not verify %s\n", argv[2]);
+		return 1;
+	}
+
+	printf("%s: %dx%d tiles, %d spawn points, %d colliders, %d layers, %d objects, %d bytes\n",
+		argv[2],
+		static_cast<int32>(map.header_->size_x_),
+		static_cast<int32>(map.header_->size_y_),
+		map.spawn_count_,
+		map.collider_count_,
+		map.layer_count_,
+		map.object_count_,
+		static_cast<int32>(output.size()));
+
+	return 0;
+}
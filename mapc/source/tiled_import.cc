@@ -0,0 +1,253 @@
+// tiled_import.cc
+
+#include "tiled_import.hpp"
+#include "config.h"
+#include "leveldata.h"
+#include "level_manager.h"
+#include "map_format.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#if defined(_MSC_VER)
+#pragma warning(push, 0)
+#endif
+#include <tileson.hpp>
+#if defined(_MSC_VER)
+#pragma warning(pop)
+#endif
+
+namespace charlie {
+	namespace {
+		// note: the top three bits of a gid are the flip flags
+		constexpr uint32 TILED_GID_MASK = 0x1fffffff;
+
+		// note: the vendored tileson predates Tiled 1.6, newer versions write
+		//       the format version as a string and, from 1.9 on, the object
+		//       type as "class", both are rewritten to what tileson reads
+		void upgrade_json(nlohmann::json& json)
+		{
+			if (json.is_object()) {
+				if (json.count("version") > 0 && json["version"].is_string()) {
+					json["version"] = std::atoi(json["version"].get<std::string>().c_str());
+				}
+				if (json.count("class") > 0 && json.count("type") == 0) {
+					json["type"] = json["class"];
+				}
+			}
+
+			if (json.is_structured()) {
+				for (auto& item : json) {
+					upgrade_json(item);
+				}
+			}
+		}
+
+		std::unique_ptr<tson::Map> parse_tiled_map(const char* filename)
+		{
+			std::ifstream stream(filename, std::ios::binary);
+			if (!stream.is_open()) {
+				return std::make_unique<tson::Map>(tson::ParseStatus::FileNotFound, std::string("file not found"));
+			}
+
+			// note: tileson reports parse errors but throws on values of the wrong type
+			try {
+				nlohmann::json json;
+				stream >> json;
+				upgrade_json(json);
+				const std::string text = json.dump();
+				tson::Tileson tileson;
+				return tileson.parse(text.data(), text.size());
+			}
+			catch (const nlohmann::json::exception& error) {
+				return std::make_unique<tson::Map>(tson::ParseStatus::ParseError, std::string(error.what()));
+			}
+		}
+
+		bool has_flag(tson::Property* property)
+		{
+			return property != nullptr && property->getType() == tson::Type::Boolean && property->getValue<bool>();
+		}
+
+		bool is_collision_layer(tson::Layer& layer)
+		{
+			return layer.getName() == "collision" || has_flag(layer.getProp("collision"));
+		}
+
+		int32 tile_id_of(tson::Map& map, const uint32 gid)
+		{
+			if (gid == 0) {
+				return 0;
+			}
+
+			auto it = map.getTileMap().find(static_cast<int>(gid));
+			if (it != map.getTileMap().end()) {
+				tson::Property* property = it->second->getProp("tile_id");
+				if (property != nullptr && property->getType() == tson::Type::Int) {
+					return property->getValue<int>();
+				}
+			}
+
+			int32 first = 0;
+			for (auto& tileset : map.getTilesets()) {
+				if (tileset.getFirstgid() <= static_cast<int>(gid) && tileset.getFirstgid() > first) {
+					first = tileset.getFirstgid();
+				}
+			}
+			return first > 0 ? static_cast<int32>(gid) - first + 1 : -1;
+		}
+
+		// note: groups are flattened so nested layers keep their draw order
+		void collect_layers(std::vector<tson::Layer>& layers, DynamicArray<tson::Layer*>& output)
+		{
+			for (auto& layer : layers) {
+				if (layer.getType() == tson::LayerType::Group) {
+					collect_layers(layer.getLayers(), output);
+				}
+				else {
+					output.push_back(&layer);
+				}
+			}
+		}
+
+		bool read_grid(tson::Map& map, tson::Layer& layer, DynamicArray<uint8>& cells)
+		{
+			const auto& data = layer.getData();
+			if (data.size() != cells.size()) {
+				printf("layer %s has %d of %d cells, only uncompressed finite maps are supported\n",
+					layer.getName().c_str(), static_cast<int32>(data.size()), static_cast<int32>(cells.size()));
+				return false;
+			}
+
+			for (size_t index = 0; index < data.size(); index++) {
+				const int32 id = tile_id_of(map, static_cast<uint32>(data[index]) & TILED_GID_MASK);
+				if (id < 0 || id > 255) {
+					printf("layer %s has no tile id for gid %u\n", layer.getName().c_str(), static_cast<uint32>(data[index]) & TILED_GID_MASK);
+					return false;
+				}
+				cells[index] = static_cast<uint8>(id);
+			}
+			return true;
+		}
+
+		bool read_objects(tson::Layer& layer, const float scale_x, const float scale_y, const int32 width, const int32 height, DynamicArray<MapObject>& objects)
+		{
+			const bool collision_layer = layer.getName() == "collision";
+			const bool spawn_layer = layer.getName() == "spawns";
+
+			for (auto& object : layer.getObjects()) {
+				const bool collider = object.getType() == "collider" || (collision_layer && object.getType().empty());
+				const bool spawn = object.getType() == "spawn" || (spawn_layer && object.getType().empty());
+				if (!collider && !spawn) {
+					continue;
+				}
+
+				if (collider && object.getObjectType() != tson::ObjectType::Rectangle) {
+					printf("object %d in layer %s is not a rectangle, skipped\n", object.getId(), layer.getName().c_str());
+					continue;
+				}
+
+				// Tiled sizes are in its own tile pixels, the game's tiles are larger
+				const int32 x = static_cast<int32>(object.getPosition().x * scale_x);
+				const int32 y = static_cast<int32>(object.getPosition().y * scale_y);
+				const int32 w = collider ? static_cast<int32>(object.getSize().x * scale_x) : 0;
+				const int32 h = collider ? static_cast<int32>(object.getSize().y * scale_y) : 0;
+				if (x < 0 || y < 0 || x + w > width || y + h > height || (collider && (w <= 0 || h <= 0))) {
+					printf("object %d in layer %s is outside the map\n", object.getId(), layer.getName().c_str());
+					return false;
+				}
+
+				MapObject entry = {};
+				entry.x_ = static_cast<uint16>(x);
+				entry.y_ = static_cast<uint16>(y);
+				entry.w_ = static_cast<uint16>(w);
+				entry.h_ = static_cast<uint16>(h);
+				entry.type_ = collider ? MAP_OBJECT_COLLIDER : MAP_OBJECT_SPAWN;
+				objects.push_back(entry);
+			}
+			return true;
+		}
+	} // !anon
+
+	bool import_tiled_map(const char* filename, Leveldata& data, MapContent& content)
+	{
+		std::unique_ptr<tson::Map> map = parse_tiled_map(filename);
+		if (map->getStatus() != tson::ParseStatus::OK) {
+			printf("could not parse %s: %s\n", filename, map->getStatusMessage().c_str());
+			return false;
+		}
+
+		if (map->getOrientation() != "orthogonal" || map->isInfinite()) {
+			printf("%s must be a finite orthogonal map\n", filename);
+			return false;
+		}
+
+		const int32 size_x = map->getSize().x;
+		const int32 size_y = map->getSize().y;
+		if (size_x <= 0 || size_y <= 0 || size_x > 255 || size_y > 255) {
+			printf("%s is %dx%d tiles, at most 255x255 is supported\n", filename, size_x, size_y);
+			return false;
+		}
+
+		DynamicArray<tson::Layer*> layers;
+		collect_layers(map->getLayers(), layers);
+
+		const size_t tile_count = static_cast<size_t>(size_x * size_y);
+		DynamicArray<uint8> ground;
+		DynamicArray<uint8> blocked(tile_count, 0);
+		DynamicArray<uint8> cells(tile_count, 0);
+		const float scale_x = static_cast<float>(config::LEVEL_OBJECT_WIDTH) / static_cast<float>(map->getTileSize().x);
+		const float scale_y = static_cast<float>(config::LEVEL_OBJECT_HEIGHT) / static_cast<float>(map->getTileSize().y);
+
+		content = MapContent();
+		for (tson::Layer* layer : layers) {
+			if (layer->getType() == tson::LayerType::ObjectGroup) {
+				if (!read_objects(*layer, scale_x, scale_y, size_x * config::LEVEL_OBJECT_WIDTH, size_y * config::LEVEL_OBJECT_HEIGHT, content.objects_)) {
+					return false;
+				}
+				continue;
+			}
+
+			if (layer->getType() != tson::LayerType::TileLayer) {
+				continue;
+			}
+
+			if (!read_grid(*map, *layer, cells)) {
+				return false;
+			}
+
+			if (is_collision_layer(*layer)) {
+				for (size_t index = 0; index < tile_count; index++) {
+					blocked[index] |= cells[index] != 0;
+				}
+			}
+			else if (ground.empty()) {
+				ground = cells;
+			}
+			else {
+				content.layers_.insert(content.layers_.end(), cells.begin(), cells.end());
+				content.layer_count_++;
+			}
+		}
+
+		if (ground.empty()) {
+			printf("%s has no tile layer to use as ground\n", filename);
+			return false;
+		}
+
+		data = Leveldata();
+		data.sizeX_ = size_x;
+		data.sizeY_ = size_y;
+		data.tiles_.resize(tile_count);
+		for (size_t index = 0; index < tile_count; index++) {
+			uint8 id = ground[index] == 0 ? static_cast<uint8>(FREE) : ground[index];
+			if (blocked[index]) {
+				id = static_cast<uint8>(COLLIDER);
+			}
+			data.tiles_[index] = Tile{ id, static_cast<uint8>(index % size_x), static_cast<uint8>(index / size_x) };
+		}
+
+		return true;
+	}
+} // !charlie
@@ -0,0 +1,30 @@
+// tiled_import.hpp
+
+#ifndef TILED_IMPORT_HPP_INCLUDED
+#define TILED_IMPORT_HPP_INCLUDED
+
+#include <charlie.hpp>
+
+namespace charlie {
+	struct Leveldata;
+	struct MapContent;
+
+	// note: reads a Tiled json map (.tmj or .json) into the gameplay grid
+	//       and the extra layers and objects of a compiled map
+	//
+	//       - the first tile layer is the ground and becomes the grid, empty
+	//         cells are free
+	//       - a tile layer named "collision" or with the bool property
+	//         "collision" set blocks every cell it covers and is not drawn
+	//       - other tile layers are drawn over the ground in order
+	//       - objects of type "collider", or in an object layer named
+	//         "collision", are collider rects
+	//       - objects of type "spawn", or in an object layer named "spawns",
+	//         are spawn points
+	//
+	//       a tile's id is its int property "tile_id" when it has one, else
+	//       its index in the tileset plus one
+	bool import_tiled_map(const char* filename, Leveldata& data, MapContent& content);
+} // !charlie
+
+#endif // !TILED_IMPORT_HPP_INCLUDED
@@ -1,21 +1,33 @@
 ﻿#pragma once
 #include "sdl_window.hpp"
+#include "charlie_network.hpp"
+#include "charlie_gameplay.hpp"
 
 namespace charlie
 {
+	// note: clients live in the slot of their connection id, so lookups
+	//       from network callbacks are a single array access
 	struct ClientList {
 		ClientList();
 
-		int32 add_client(const uint64 connection);
-		int32 find_client(const uint64 connection);
-		void remove_client(const uint64 connection);
+		int32 add_client(const uint16 connection);
+		int32 find_client(const uint16 connection) const;
+		void remove_client(const uint16 connection);
+		int32 count() const;
 
 		struct Client {
 			int32  id_{ -1 };
-			uint64 connection_{};
+			uint16 connection_{};
+			bool has_baseline_{ false };
+			uint16 baseline_{};
+			bool level_owed_{ false }; // Level stream refused, retried from on_send
+			gameplay::SnapshotRing snapshots_;
 		};
 
+		Client* get_client(const uint16 connection);
+
 		int32 next_;
+		int32 count_;
 		DynamicArray<Client> clients_;
 	};
 }
@@ -4,6 +4,7 @@
 #define SERVER_APP_HPP_INCLUDED
 
 #include <sdl_application.hpp>
+#include <charlie_metrics.hpp>
 #include "ClientList.h"
 #include "level_manager.h"
 #include "projectile.h"
@@ -32,8 +33,11 @@ struct ServerApp final : SDLApplication, network::IServiceListener, network::ICo
 	virtual void on_acknowledge(network::Connection* connection, const uint16 sequence);
 	virtual void on_receive(network::Connection* connection, network::NetworkStreamReader& reader);
 	virtual void on_send(network::Connection* connection, const uint16 sequence, network::NetworkStreamWriter& writer);
+	virtual void on_channel_message(network::Connection* connection, const network::Channel channel, network::NetworkStreamReader& reader);
 
-	void write_message(const Event& reliable_event, network::NetworkStreamWriter& writer) const;
+	void read_messages(network::Connection* connection, network::BitStreamReader& bit_reader);
+	void queue_reliable_events(network::Connection* connection, const int32 id);
+	void write_message(const Event& reliable_event, network::BitStreamWriter& writer) const;
 
 	// note: gameplay
 	void read_input_queue();
@@ -45,7 +49,6 @@ struct ServerApp final : SDLApplication, network::IServiceListener, network::ICo
 	void spawn_projectile(Vector2 pos, float rotation, int32 id);
 	void remove_projectile(int32 id);
 
-	static void remove_from_array(DynamicArray<Event>& arr, int32 id);
 	void remove_from_deque(std::deque<gameplay::InputCommand>& arr, int32 tick);
 	static bool contains(const DynamicArray<int32>& arr, int32 id);
 
@@ -56,11 +59,11 @@ struct ServerApp final : SDLApplication, network::IServiceListener, network::ICo
 	Time accumulator_;
 	uint32 tick_;
 	ClientList clients_;
-	gameplay::ReliableMessageQueue reliable_queue_;
 	DynamicArray<Event> spawn_event_list;
 	DynamicArray<Event> destroy_event_list_;
 	ReliableEvents reliable_events_;
 	std::deque<gameplay::InputCommand> input_queue_;
+	metrics::SnapshotFile metrics_file_;
 
 	// note: gameplay
 	Camera cam_;
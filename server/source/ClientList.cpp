@@ -4,35 +4,62 @@ namespace charlie
 {
 	ClientList::ClientList()
 		: next_(0)
+		, count_(0)
 	{
 	}
 
-	int32 ClientList::add_client(const uint64 connection)
+	int32 ClientList::add_client(const uint16 connection)
 	{
+		const int32 index = network::ConnectionPool::index_of(connection);
+		if (index >= static_cast<int32>(clients_.size())) {
+			clients_.resize(static_cast<size_t>(index) + 1);
+		}
+
 		const int32 id = next_++;
-		clients_.push_back({ id, connection });
+		clients_[index].id_ = id;
+		clients_[index].connection_ = connection;
+		clients_[index].has_baseline_ = false;
+		clients_[index].level_owed_ = false;
+		clients_[index].snapshots_.clear();
+		count_++;
 		return id;
 	}
 
-	int32 ClientList::find_client(const uint64 connection)
+	int32 ClientList::find_client(const uint16 connection) const
+	{
+		const int32 index = network::ConnectionPool::index_of(connection);
+		if (index >= static_cast<int32>(clients_.size()) || clients_[index].connection_ != connection) {
+			return -1;
+		}
+		return clients_[index].id_;
+	}
+
+	ClientList::Client* ClientList::get_client(const uint16 connection)
 	{
-		for (auto& client : clients_) {
-			if (client.connection_ == connection) {
-				return client.id_;
-			}
+		const int32 index = network::ConnectionPool::index_of(connection);
+		if (index >= static_cast<int32>(clients_.size()) || clients_[index].connection_ != connection) {
+			return nullptr;
 		}
-		return -1;
+		return &clients_[index];
 	}
 
-	void ClientList::remove_client(const uint64 connection)
+	void ClientList::remove_client(const uint16 connection)
 	{
-		auto it = clients_.begin();
-		while (it != clients_.end()) {
-			if ((*it).connection_ == connection) {
-				clients_.erase(it);
-				break;
-			}
-			++it;
+		const int32 index = network::ConnectionPool::index_of(connection);
+		if (index >= static_cast<int32>(clients_.size()) || clients_[index].connection_ != connection) {
+			return;
 		}
+
+		clients_[index].id_ = -1;
+		clients_[index].connection_ = 0;
+		clients_[index].has_baseline_ = false;
+		clients_[index].level_owed_ = false;
+		clients_[index].snapshots_.clear();
+		count_--;
+	}
+
+	int32 ClientList::count() const
+	{
+		return count_;
 	}
 }
@@ -2,14 +2,50 @@
 
 #include "server_app.hpp"
 #include <charlie_messages.hpp>
+#include <charlie_metrics.hpp>
 #include <cstdio>
 #include <cmath>
-#include <WinSock2.h>
+#include <algorithm>
 
 #include "collision_handler.h"
 #include "config.h"
+#include "map_format.h"
 #include "reliable_events.h"
 
+namespace
+{
+	metrics::Counter ticks("server_ticks_total", "Simulation ticks run");
+	metrics::Histogram tick_duration("server_tick_seconds", "Time spent simulating one tick");
+	metrics::Gauge players("server_players", "Players in the game");
+	metrics::Gauge projectiles("server_projectiles", "Live projectiles");
+	metrics::Gauge reliable_events_pending("server_reliable_events_pending", "Reliable events waiting for room in a send window");
+	metrics::Counter reliable_events_queued("server_reliable_events_queued_total", "Reliable events handed to a connection");
+	metrics::Counter reliable_events_deferred("server_reliable_events_deferred_total", "Times a full send window held back reliable events");
+
+	// note: one line per connection when it goes away, enough to tell a
+	//       lossy link from a slow one after the fact
+	void print_connection_stats(const network::Connection* connection)
+	{
+		network::ConnectionInfo info;
+		connection->fill_info(info, Time::now());
+
+		const network::ConnectionStats& stats = info.stats_;
+		printf("NETWORK: Connection %i stats - connected %.1fs, rtt %.1fms, srtt %.1fms, rttvar %.1fms, loss %.1f%%, sent %llu packets %llu bytes, received %llu packets %llu bytes, resent %llu messages %llu fragments\n",
+			info.id_,
+			info.connected_time_.as_seconds(),
+			info.round_trip_time_.as_milliseconds(),
+			info.smoothed_round_trip_time_.as_milliseconds(),
+			info.round_trip_variance_.as_milliseconds(),
+			stats.loss_ * 100.0f,
+			static_cast<unsigned long long>(stats.packets_sent_),
+			static_cast<unsigned long long>(stats.bytes_sent_),
+			static_cast<unsigned long long>(stats.packets_received_),
+			static_cast<unsigned long long>(stats.bytes_received_),
+			static_cast<unsigned long long>(stats.messages_resent_),
+			static_cast<unsigned long long>(stats.fragments_resent_));
+	}
+} // !anon
+
 ServerApp::ServerApp()
 	: tickrate_(1.0 / 60.0)
 	, tick_(0)
@@ -21,9 +57,11 @@ ServerApp::ServerApp()
 
 bool ServerApp::on_init()
 {
-	network_.set_send_rate(Time(1.0 / 20.0));
+	network_.set_send_rate(Time(1.0 / 60.0), Time(1.0 / 10.0));
+	network_.set_payload_budget(512, 1024);
 	network_.set_allow_connections(true);
-	if (!network_.initialize(network::IPAddress(network::IPAddress::ANY_HOST, 54345))) {
+	network_.set_network_thread(true);
+	if (!network_.initialize(network::IPAddress(network::IPAddress::ANY_HOST, 54345), network::UDPSocket::Backend::IOUring)) {
 		return false;
 	}
 
@@ -32,19 +70,30 @@ bool ServerApp::on_init()
 	network_.add_service_listener(this);
 
 	current_map_ = config::map;
-	auto data = Leveldata();
-	data.create_level(current_map_);
 	level_manager_ = LevelManager();
-	level_manager_.load_assets(data);
+	level_manager_.level_id_ = current_map_;
+
+	// Compiled maps load straight from the mapped file, the text map is the fallback
+	CompiledMap map;
+	if (!map.open_level(current_map_) || !level_manager_.load_compiled(map))
+	{
+		auto data = Leveldata();
+		data.create_level(current_map_);
+		level_manager_.load_assets(data);
+	}
 
 	level_width_ = level_manager_.width_;
 	level_heigth_ = level_manager_.height_;
 
+	metrics_file_.open(config::METRICS_FILE.c_str(), Time(config::METRICS_INTERVAL));
+
 	return true;
 }
 
 void ServerApp::on_exit()
 {
+	metrics_file_.write();
+	metrics_file_.close();
 }
 
 bool ServerApp::on_tick(const Time& dt)
@@ -57,6 +106,7 @@ bool ServerApp::on_tick(const Time& dt)
 
 	accumulator_ += dt;
 	while (accumulator_ >= tickrate_) {
+		const Time tick_start = Time::now();
 		accumulator_ -= tickrate_;
 		tick_++;
 
@@ -89,15 +139,23 @@ bool ServerApp::on_tick(const Time& dt)
 		{
 			remove_projectile(id);
 		}
+
+		ticks.add();
+		tick_duration.observe(Time::now() - tick_start);
 	}
 
+	players.set(static_cast<int64>(players_.size()));
+	projectiles.set(static_cast<int64>(projectiles_.size()));
+	reliable_events_pending.set(static_cast<int64>(reliable_events_.events_.size()));
+	metrics_file_.update(Time::now());
+
 	return true;
 }
 
 void ServerApp::on_draw()
 {
 	char myString[10] = "";
-	sprintf_s(myString, "%ld", long(tick_));
+	snprintf(myString, sizeof(myString), "%ld", long(tick_));
 
 	for (auto& player : players_)
 	{
@@ -113,19 +171,20 @@ void ServerApp::on_draw()
 void ServerApp::on_timeout(network::Connection* connection)
 {
 	connection->set_listener(nullptr);
-	const uint32 id = clients_.find_client((uint64)connection);
+	print_connection_stats(connection);
+	const uint32 id = clients_.find_client(connection->id_);
 
 	destroy_player(id);
 
-	clients_.remove_client((uint64)connection);
-	printf("NETWORK: Player %i disconnected. Players %i \n", id, (int)clients_.clients_.size());
+	clients_.remove_client(connection->id_);
+	printf("NETWORK: Player %i disconnected. Players %i \n", id, clients_.count());
 }
 
 void ServerApp::on_connect(network::Connection* connection)
 {
 	connection->set_listener(this);
 
-	const auto id = clients_.add_client((uint64)connection);
+	const auto id = clients_.add_client(connection->id_);
 
 	Player player;
 	player.id_ = id;
@@ -156,41 +215,68 @@ void ServerApp::on_connect(network::Connection* connection)
 	// Send level name
 	reliable_events_.send_level_info(current_map_, player.id_);
 
-	printf("NETWORK: Player joined. players: %i\n", (int)clients_.clients_.size());
+	printf("NETWORK: Player joined. players: %i\n", clients_.count());
 }
 
 void ServerApp::on_disconnect(network::Connection* connection)
 {
 	connection->set_listener(nullptr);
+	print_connection_stats(connection);
 
-	const uint32 id = clients_.find_client((uint64)connection);
+	const uint32 id = clients_.find_client(connection->id_);
 
 	destroy_player(id);
 
-	clients_.remove_client((uint64)connection);
+	clients_.remove_client(connection->id_);
 
-	printf("NETWORK: Player disconnected. players: %i\n", (int)clients_.clients_.size());
+	printf("NETWORK: Player disconnected. players: %i\n", clients_.count());
 }
 
 void ServerApp::on_acknowledge(network::Connection* connection,
 	const uint16 sequence)
 {
+	// note: an acknowledged packet is not a decoded snapshot, the delta
+	//       baseline follows what the client reports in its input commands
 }
 
 void ServerApp::on_receive(network::Connection* connection,
 	network::NetworkStreamReader& reader)
 {
-	const int32 id = clients_.find_client((uint64)connection);
+	network::BitStreamReader bit_reader(reader);
+	read_messages(connection, bit_reader);
+}
+
+void ServerApp::on_channel_message(network::Connection* connection,
+	const network::Channel channel,
+	network::NetworkStreamReader& reader)
+{
+	network::BitStreamReader bit_reader(reader);
+	read_messages(connection, bit_reader);
+}
 
-	while (reader.position() < reader.length()) {
-		switch (reader.peek()) {
+void ServerApp::read_messages(network::Connection* connection,
+	network::BitStreamReader& bit_reader)
+{
+	const int32 id = clients_.find_client(connection->id_);
+
+	while (bit_reader.bits_remaining() >= 8) {
+		switch (bit_reader.peek()) {
 		case(network::NETWORK_MESSAGE_INPUT_COMMAND):
 		{
 			network::NetworkMessageInputCommand command;
-			if (!command.read(reader)) {
+			if (!command.read(bit_reader)) {
 				assert(!"could not read command!");
 			}
 
+			// note: deltas go against the newest snapshot the client says it
+			//       decoded, one that fell out of our history means full snapshots
+			if (ClientList::Client* client = clients_.get_client(connection->id_)) {
+				if (command.has_snapshot_ && (!client->has_baseline_ || static_cast<int16>(command.snapshot_ - client->baseline_) > 0)) {
+					client->has_baseline_ = true;
+					client->baseline_ = command.snapshot_;
+				}
+			}
+
 			input_queue_.clear();
 
 			for (auto& player : players_) {
@@ -207,27 +293,26 @@ void ServerApp::on_receive(network::Connection* connection,
 			}
 		} break;
 
-		case(network::NETWORK_MESSAGE_ACK):
-		{
-			network::NetworkMessageAck msg;
-			if (!msg.read(reader)) {
-				assert(!"could not read command!");
-			}
-
-			reliable_queue_.mark_received(msg.event_id_);
-		} break;
-
 		case(network::NETWORK_MESSAGE_LEVEL_REQUEST):
 		{
 			network::NetworkMessageLevelDataRequest msg;
-			if (!msg.read(reader)) {
+			if (!msg.read(bit_reader)) {
 				assert(!"could not read command!");
 			}
 
-			const Tile tile = level_manager_.get_level_data(id);
-			reliable_events_.send_level_data(tile, id);
-
-			reliable_queue_.mark_received(msg.event_id_);
+			// note: the whole map goes out as one fragmented message, the
+			//       client asks only once so a stream refused for a busy
+			//       connection is retried from on_send until it is taken
+			const LevelStreamResult result = level_manager_.stream_level(connection);
+			if (result == LevelStreamResult::BUSY) {
+				printf("WRN: could not stream level to player %i, retrying\n", id);
+				if (ClientList::Client* client = clients_.get_client(connection->id_)) {
+					client->level_owed_ = true;
+				}
+			}
+			else if (result == LevelStreamResult::UNAVAILABLE) {
+				printf("WRN: level can not be streamed to player %i\n", id);
+			}
 		} break;
 
 		default:
@@ -242,71 +327,102 @@ void ServerApp::on_send(network::Connection* connection,
 	const uint16 sequence,
 	network::NetworkStreamWriter& writer)
 {
-	const int32 id = clients_.find_client((uint64)connection);
+	ClientList::Client* client = clients_.get_client(connection->id_);
+	if (!client) {
+		return;
+	}
 
+	const int32 id = client->id_;
+
+	// note: wait for the pending messages to drain before asking again
+	if (client->level_owed_ && !connection->has_pending_messages() && level_manager_.stream_level(connection) != LevelStreamResult::BUSY) {
+		client->level_owed_ = false;
+	}
+
+	network::BitStreamWriter bit_writer(writer);
 	{
 		network::NetworkMessageServerTick message(Time::now().as_ticks(), tick_);
-		if (!message.write(writer)) {
+		if (!message.write(bit_writer)) {
 			assert(!"failed to write message!");
 		}
 	}
 
 	{
 		// Send player update and entity updates to one player
+		gameplay::EntitySnapshot& snapshot = client->snapshots_.insert(sequence);
 		for (auto& player : players_)
 		{
 			if (player.id_ == id)
 			{
 				network::NetworkMessagePlayerState message(player.transform_, player.turret_transform_.rotation_);
-				if (!message.write(writer)) {
+				if (!message.write(bit_writer)) {
 					assert(!"failed to write message!");
 				}
 				continue;
 			}
 
-			network::NetworkMessageEntityState message(player.transform_, player.turret_transform_.rotation_, player.id_);
-			if (!message.write(writer)) {
-				assert(!"failed to write message!");
-			}
+			const network::NetworkMessageEntityState state(player.transform_, player.turret_transform_.rotation_, player.id_);
+			gameplay::EntityState entity{};
+			entity.id_ = static_cast<uint8>(state.entity_id_);
+			entity.x_ = state.x_;
+			entity.y_ = state.y_;
+			entity.rotation_ = state.rotation_;
+			entity.turret_rotation_ = state.turret_rotation_;
+			snapshot.add(entity);
+		}
+
+		// note: encode against the last snapshot this client acknowledged
+		const gameplay::EntitySnapshot* baseline = client->has_baseline_ ? client->snapshots_.find(client->baseline_) : nullptr;
+		network::NetworkMessageEntityDelta message;
+		snapshot.encode(baseline, message);
+		if (!message.write(bit_writer)) {
+			assert(!"failed to write message!");
 		}
 	}
 
-	// Send reliable messages
+	// note: reliable events ride the ordered channel, written before this
+	//       payload, so queue them for the next packet
+	queue_reliable_events(connection, id);
+
+	if (!bit_writer.flush()) {
+		assert(!"failed to flush messages!");
+	}
+}
+
+void ServerApp::queue_reliable_events(network::Connection* connection, const int32 id)
+{
+	auto it = reliable_events_.events_.begin();
+	while (it != reliable_events_.events_.end())
 	{
-		// Remove confirmed messages
-		for (auto& msg : reliable_queue_.buffer_)
+		if ((*it).send_to_ != id)
 		{
-			if (msg.received_)
-			{
-				remove_from_array(reliable_events_.events_, msg.id_);
-			}
+			++it;
+			continue;
 		}
 
-		// Create message from event
-		for (const Event& reliable_event : reliable_events_.events_)
-		{
-			if (writer.length() >= 1024 - sizeof(reliable_event))
-			{
-				break;
-			}
+		uint8 buffer[network::MessageChannel::MAX_MESSAGE_SIZE];
+		network::NetworkStreamWriter writer(buffer, sizeof(buffer));
+		network::BitStreamWriter bit_writer(writer);
+		write_message(*it, bit_writer);
+		if (!bit_writer.flush()) {
+			assert(!"failed to flush message!");
+		}
 
-			if (id == reliable_event.send_to_)
-			{
-				gameplay::Message msg{};
-				msg.id_ = reliable_event.event_id_;
-				msg.seq_ = sequence;
-				msg.received_ = false;
-
-				// Keep track of sent reliable messages
-				reliable_queue_.add_message(msg);
-				write_message(reliable_event, writer);
-				printf("RELIABLE MESSAGE: Sent message with id %i \n", (int)reliable_event.event_id_);
-			}
+		// note: a full send window keeps the rest for a later packet
+		if (!connection->queue_message(network::CHANNEL_RELIABLE_ORDERED, buffer, writer.length()))
+		{
+			reliable_events_deferred.add();
+			break;
 		}
+
+		reliable_events_queued.add();
+
+		printf("RELIABLE MESSAGE: Queued message with id %i \n", (int)(*it).event_id_);
+		it = reliable_events_.events_.erase(it);
 	}
 }
 
-void ServerApp::write_message(const Event& reliable_event, network::NetworkStreamWriter& writer) const
+void ServerApp::write_message(const Event& reliable_event, network::BitStreamWriter& writer) const
 {
 	switch (reliable_event.type_)
 	{
@@ -376,16 +492,7 @@ void ServerApp::write_message(const Event& reliable_event, network::NetworkStrea
 
 	case(EventType::SEND_LEVEL_INFO):
 	{
-		network::NetworkMessageLevelInfo message(current_map_, (uint8)level_manager_.data_.sizeX_, (uint8)level_manager_.data_.sizeY_, reliable_event.event_id_);
-		if (!message.write(writer))
-		{
-			assert(!"failed to write message!");
-		}
-	} break;
-
-	case(EventType::SEND_LEVEL_DATA):
-	{
-		network::NetworkMessageLevelData message(reliable_event.tile_, reliable_event.event_id_);
+		network::NetworkMessageLevelInfo message(current_map_, (uint8)level_manager_.data_.sizeX_, (uint8)level_manager_.data_.sizeY_, level_manager_.hash_, reliable_event.event_id_);
 		if (!message.write(writer))
 		{
 			assert(!"failed to write message!");
@@ -633,20 +740,6 @@ bool ServerApp::contains(const DynamicArray<int32>& arr, const int32 id)
 	return std::find(arr.begin(), arr.end(), id) != arr.end();
 }
 
-void ServerApp::remove_from_array(DynamicArray<Event>& arr, int32 id)
-{
-	auto it = arr.begin();
-	while (it != arr.end())
-	{
-		if ((*it).event_id_ == id)
-		{
-			arr.erase(it);
-			break;
-		}
-		++it;
-	}
-}
-
 void ServerApp::remove_from_deque(std::deque<gameplay::InputCommand>& arr, int32 tick)
 {
 	auto it = arr.begin();
@@ -1,5 +1,4 @@
 ﻿#include "server_register.h"
-#include <WinSock2.h>
 #include <config.h>
 #include <fstream>
 
@@ -62,7 +61,7 @@ namespace charlie
 		{
 			printf("MasterServerClient::request_server: Failed to open socket \n");
 		}
-		if (!socket_.send(master_server_, writer_.stream_.buffer_, writer_.length()))
+		if (!socket_.send(master_server_, writer_.data(), writer_.length()))
 		{
 			printf("request_server send failed! \n");
 		}